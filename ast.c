@@ -80,7 +80,7 @@ static void free_expr(Expr *expr) {
     }
     switch (expr->kind) {
         case EXPR_STRING:
-            free(expr->as.string_value);
+            free(expr->as.string.value);
             break;
         case EXPR_VAR:
             free(expr->as.var_name);
@@ -99,6 +99,16 @@ static void free_expr(Expr *expr) {
             }
             free(expr->as.call.args.items);
             break;
+        case EXPR_ARRAY:
+            for (size_t i = 0; i < expr->as.array.items.len; i++) {
+                free_expr(expr->as.array.items.items[i]);
+            }
+            free(expr->as.array.items.items);
+            break;
+        case EXPR_INDEX:
+            free(expr->as.index.name);
+            free_expr(expr->as.index.index);
+            break;
         case EXPR_INT:
         case EXPR_BOOL:
             break;
@@ -121,6 +131,7 @@ static void free_stmt(Stmt *stmt) {
             break;
         case STMT_SHIFT:
             free(stmt->as.shift.name);
+            free_expr(stmt->as.shift.index);
             free_expr(stmt->as.shift.value);
             break;
         case STMT_FORK:
@@ -171,7 +182,22 @@ const char *type_name(TypeKind t) {
         case TYPE_BOOL: return "pulse";
         case TYPE_STRING: return "text";
         case TYPE_VOID: return "mist";
+        case TYPE_ARRAY: return "ember array";
         case TYPE_ERROR: return "<error>";
     }
     return "<unknown-type>";
 }
+
+/* Value of an integer literal, optionally negated, wrapping like the
+   generated code does. */
+int expr_literal_int(const Expr *e, long *out) {
+    if (e->kind == EXPR_INT) {
+        *out = e->as.int_value;
+        return 1;
+    }
+    if (e->kind == EXPR_UNARY && e->as.unary.op == UN_NEG && e->as.unary.operand->kind == EXPR_INT) {
+        *out = (long)(0UL - (unsigned long)e->as.unary.operand->as.int_value);
+        return 1;
+    }
+    return 0;
+}
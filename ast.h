@@ -8,6 +8,7 @@ typedef enum TypeKind {
     TYPE_BOOL,
     TYPE_STRING,
     TYPE_VOID,
+    TYPE_ARRAY, /* fixed-size ember array, only as a local binding */
     TYPE_ERROR
 } TypeKind;
 
@@ -18,12 +19,15 @@ typedef enum ExprKind {
     EXPR_VAR,
     EXPR_UNARY,
     EXPR_BINARY,
-    EXPR_CALL
+    EXPR_CALL,
+    EXPR_ARRAY,
+    EXPR_INDEX
 } ExprKind;
 
 typedef enum UnaryOp {
     UN_NEG,
-    UN_FLIP
+    UN_FLIP,
+    UN_SPAN /* length of a text */
 } UnaryOp;
 
 typedef enum BinaryOp {
@@ -41,6 +45,10 @@ typedef enum BinaryOp {
     BIN_ATLEAST
 } BinaryOp;
 
+/* Largest element count of an ember array. Arrays live in the glyph's
+   frame, so this bounds the stack they take. */
+#define ARRAY_MAX_LEN 65536
+
 typedef struct Expr Expr;
 typedef struct Stmt Stmt;
 typedef struct Block Block;
@@ -59,7 +67,10 @@ struct Expr {
     union {
         long int_value;
         int bool_value;
-        char *string_value;
+        struct {
+            char *value;
+            size_t len; /* bytes in value, which may include NUL */
+        } string;
         char *var_name;
         struct {
             UnaryOp op;
@@ -74,6 +85,14 @@ struct Expr {
             char *name;
             ExprArray args;
         } call;
+        struct {
+            ExprArray items; /* empty for a zero-filled ember[len] */
+            long len;
+        } array;
+        struct {
+            char *name;
+            Expr *index;
+        } index;
     } as;
 };
 
@@ -115,6 +134,7 @@ struct Stmt {
         } morph;
         struct {
             char *name;
+            Expr *index; /* element being assigned, NULL for the whole variable */
             Expr *value;
         } shift;
         struct {
@@ -156,6 +176,7 @@ typedef struct Function {
     ParamArray params;
     TypeKind return_type;
     Block *body;
+    int memo; /* declared `memo glyph`: results are cached by argument values */
     int line;
     int col;
 } Function;
@@ -182,5 +203,6 @@ void function_array_push(FunctionArray *arr, Function fn);
 void free_program(Program *program);
 
 const char *type_name(TypeKind t);
+int expr_literal_int(const Expr *e, long *out);
 
 #endif
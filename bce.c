@@ -0,0 +1,271 @@
+#include "bce.h"
+
+#include "cfg.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Induction variables are only trusted while they stay far from overflow:
+   constant starts and loop limits up to 2^40, steps up to 2^20. */
+#define BCE_MAX_START (1L << 40)
+#define BCE_MAX_STEP (1L << 20)
+
+typedef struct BoundsScan {
+    const IRFunction *fn;
+    const CFG *cfg;
+    int *defs;
+    int *block_of;
+    signed char *counter; /* per variable: -1 not yet known, 0 no, 1 yes */
+    int *stack;
+    unsigned char *from_body;
+    unsigned char *to_use;
+} BoundsScan;
+
+/* The guard a loop header places on a variable: the header ends in
+   jmp_false (less (load v), K) leaving the loop, and its in-loop successor
+   is entered from the header alone. */
+typedef struct LoopGuard {
+    long limit;
+    int body;
+    int load; /* temp holding v as tested */
+} LoopGuard;
+
+static const IRInstr *def_of(const BoundsScan *s, int t) {
+    return t >= 0 && s->defs[t] >= 0 ? &s->fn->code.items[s->defs[t]] : NULL;
+}
+
+static int const_value(const BoundsScan *s, int t, long *out) {
+    const IRInstr *d = def_of(s, t);
+    if (!d || d->op != IROP_IMM_INT) {
+        return 0;
+    }
+    *out = d->imm;
+    return 1;
+}
+
+static int loop_guard(const BoundsScan *s, int loop, int var, LoopGuard *out) {
+    const CFG *cfg = s->cfg;
+    int h = cfg->loops[loop].header;
+    const CFGBlock *hdr = &cfg->blocks[h];
+    const IRInstr *term = &s->fn->code.items[hdr->end - 1];
+    if (term->op != IROP_JMP_FALSE || hdr->succs.len != 2) {
+        return 0;
+    }
+    int exit = cfg_block_of_label(cfg, term->label);
+    int body = hdr->succs.items[0] == exit ? hdr->succs.items[1] : hdr->succs.items[0];
+    if (exit < 0 || body == exit || cfg_loop_contains(cfg, loop, exit) || !cfg_loop_contains(cfg, loop, body) ||
+        cfg->blocks[body].preds.len != 1) {
+        return 0;
+    }
+    const IRInstr *cmp = def_of(s, term->src1);
+    if (!cmp || cmp->op != IROP_BIN || cmp->binop != IRBIN_LESS) {
+        return 0;
+    }
+    const IRInstr *load = def_of(s, cmp->src1);
+    if (!load || load->op != IROP_LOAD_VAR || load->var_index != var || s->defs[cmp->src1] < (int)hdr->start ||
+        s->defs[cmp->src1] >= (int)hdr->end || !const_value(s, cmp->src2, &out->limit)) {
+        return 0;
+    }
+    for (size_t i = (size_t)s->defs[cmp->src1]; i < hdr->end; i++) {
+        const IRInstr *in = &s->fn->code.items[i];
+        if (in->op == IROP_STORE_VAR && in->var_index == var) {
+            return 0;
+        }
+    }
+    out->body = body;
+    out->load = cmp->src1;
+    return 1;
+}
+
+/* A counter starts at a small constant and only grows by small steps, each
+   inside a loop whose header keeps it below a small limit. Every execution
+   of a step is preceded by a passing test of that guard, and no other store
+   can repeat in between without passing the guard again, so the counter
+   never goes negative or wraps. */
+static int is_counter(BoundsScan *s, int var) {
+    if (s->counter[var] >= 0) {
+        return s->counter[var];
+    }
+    const IRFunction *fn = s->fn;
+    int ok = var >= fn->param_count;
+    for (size_t i = 0; i < fn->code.len && ok; i++) {
+        const IRInstr *in = &fn->code.items[i];
+        if (in->op != IROP_STORE_VAR || in->var_index != var) {
+            continue;
+        }
+        long c;
+        if (const_value(s, in->src1, &c)) {
+            ok = c >= 0 && c <= BCE_MAX_START;
+            continue;
+        }
+        const IRInstr *add = def_of(s, in->src1);
+        if (!add || add->op != IROP_BIN || add->binop != IRBIN_ADD) {
+            ok = 0;
+            break;
+        }
+        const IRInstr *a = def_of(s, add->src1);
+        int step = add->src2;
+        if (!a || a->op != IROP_LOAD_VAR || a->var_index != var) {
+            a = def_of(s, add->src2);
+            step = add->src1;
+        }
+        LoopGuard guard;
+        int block = s->block_of[i];
+        int loop = s->cfg->blocks[block].loop;
+        ok = a && a->op == IROP_LOAD_VAR && a->var_index == var && const_value(s, step, &c) && c > 0 &&
+             c <= BCE_MAX_STEP && loop >= 0 && loop_guard(s, loop, var, &guard) && guard.limit <= BCE_MAX_START &&
+             cfg_dominates(s->cfg, guard.body, block);
+    }
+    s->counter[var] = (signed char)ok;
+    return ok;
+}
+
+/* Marks the blocks of loop reachable from start (forward) or reaching it
+   (backward) without passing through the header. */
+static void flood(BoundsScan *s, int loop, int start, int forward, unsigned char *seen) {
+    const CFG *cfg = s->cfg;
+    int header = cfg->loops[loop].header;
+    memset(seen, 0, cfg->len);
+    size_t sp = 0;
+    seen[start] = 1;
+    s->stack[sp++] = start;
+    while (sp > 0) {
+        const CFGBlock *blk = &cfg->blocks[s->stack[--sp]];
+        const CFGEdgeArray *edges = forward ? &blk->succs : &blk->preds;
+        for (size_t k = 0; k < edges->len; k++) {
+            int n = edges->items[k];
+            if (n == header || seen[n] || !cfg_loop_contains(cfg, loop, n)) {
+                continue;
+            }
+            seen[n] = 1;
+            s->stack[sp++] = n;
+        }
+    }
+}
+
+/* Whether the load at instruction use reads the value the guard tested:
+   no store to the variable lies on a path from the loop body to it that
+   avoids the header. */
+static int same_as_tested(BoundsScan *s, int loop, const LoopGuard *guard, int var, size_t use) {
+    const IRFunction *fn = s->fn;
+    int ub = s->block_of[use];
+    flood(s, loop, guard->body, 1, s->from_body);
+    flood(s, loop, ub, 0, s->to_use);
+    for (size_t k = 0; k < s->cfg->loops[loop].blocks.len; k++) {
+        int b = s->cfg->loops[loop].blocks.items[k];
+        if (!s->from_body[b] || !s->to_use[b]) {
+            continue;
+        }
+        const CFGBlock *blk = &s->cfg->blocks[b];
+        for (size_t i = blk->start; i < blk->end; i++) {
+            const IRInstr *in = &fn->code.items[i];
+            if (in->op != IROP_STORE_VAR || in->var_index != var) {
+                continue;
+            }
+            /* A store after the load only reaches it around an inner loop. */
+            if (b != ub || i < use || s->cfg->blocks[ub].loop != loop) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* The check at code[at] always passes when its index is a counter read
+   inside a loop whose header tested counter < K with K at most the array
+   length. */
+static int check_redundant(BoundsScan *s, size_t at) {
+    const IRInstr *chk = &s->fn->code.items[at];
+    const IRInstr *load = def_of(s, chk->src1);
+    if (!load || load->op != IROP_LOAD_VAR || !is_counter(s, load->var_index)) {
+        return 0;
+    }
+    int var = load->var_index;
+    int block = s->block_of[at];
+    for (int loop = s->cfg->blocks[block].loop; loop >= 0; loop = s->cfg->loops[loop].parent) {
+        LoopGuard guard;
+        if (!loop_guard(s, loop, var, &guard) || guard.limit > chk->imm ||
+            !cfg_dominates(s->cfg, guard.body, block)) {
+            continue;
+        }
+        if (chk->src1 == guard.load) {
+            return 1;
+        }
+        size_t use = (size_t)s->defs[chk->src1];
+        if (cfg_loop_contains(s->cfg, loop, s->block_of[use]) &&
+            cfg_dominates(s->cfg, guard.body, s->block_of[use]) && same_as_tested(s, loop, &guard, var, use)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Removes array index checks that the enclosing loop's own condition
+   already proves. Expects phi-free IR. */
+int eliminate_bounds_checks(IRFunction *fn, int report) {
+    int any = 0;
+    for (size_t i = 0; i < fn->code.len && !any; i++) {
+        any = fn->code.items[i].op == IROP_CHECK_INDEX;
+    }
+    if (!any) {
+        return 0;
+    }
+
+    CFG cfg;
+    cfg_build(fn, &cfg);
+    cfg_compute_dominators(&cfg);
+    cfg_find_loops(&cfg);
+
+    BoundsScan s;
+    memset(&s, 0, sizeof(s));
+    s.fn = fn;
+    s.cfg = &cfg;
+    s.defs = xmalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1) * sizeof(int));
+    s.block_of = xmalloc((fn->code.len + 1) * sizeof(int));
+    s.counter = xmalloc(fn->vars.len + 1);
+    s.stack = xmalloc((cfg.len + 1) * sizeof(int));
+    s.from_body = xmalloc(cfg.len + 1);
+    s.to_use = xmalloc(cfg.len + 1);
+    memset(s.counter, -1, fn->vars.len + 1);
+    for (int t = 0; t < fn->temp_count; t++) {
+        s.defs[t] = -1;
+    }
+    for (size_t b = 0; b < cfg.len; b++) {
+        for (size_t i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) {
+            s.block_of[i] = (int)b;
+            int d = ir_instr_def(&fn->code.items[i]);
+            if (d >= 0) {
+                s.defs[d] = (int)i;
+            }
+        }
+    }
+
+    unsigned char *dead = xcalloc(fn->code.len + 1, 1);
+    int removed = 0;
+    for (size_t i = 0; i < fn->code.len; i++) {
+        const IRInstr *in = &fn->code.items[i];
+        if (in->op != IROP_CHECK_INDEX || !cfg.blocks[s.block_of[i]].reachable || !check_redundant(&s, i)) {
+            continue;
+        }
+        dead[i] = 1;
+        removed = 1;
+        if (report) {
+            printf("bce: %s:%d: bounds check removed\n", fn->name, in->line);
+        }
+    }
+    if (removed) {
+        ir_remove_instrs(fn, dead);
+    }
+
+    free(dead);
+    free(s.to_use);
+    free(s.from_body);
+    free(s.stack);
+    free(s.counter);
+    free(s.block_of);
+    free(s.defs);
+    free_cfg(&cfg);
+    return removed;
+}
@@ -0,0 +1,8 @@
+#ifndef BCE_H
+#define BCE_H
+
+#include "ir.h"
+
+int eliminate_bounds_checks(IRFunction *fn, int report);
+
+#endif
@@ -0,0 +1,13 @@
+/* printf reference for chant.anm; bench/run.sh builds it with $CC -O2. */
+#include <stdio.h>
+
+int main(void) {
+    long total = 0;
+    for (long i = 0; i < 2000000; i++) {
+        total = total + i * 37;
+        printf("%ld\n", i);
+        printf("%ld\n", total);
+        printf("%ld\n", 0 - i * 1000003);
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+#!/bin/sh
+# Builds every benchmark in bench/ at each optimization level and reports the
+# best wall-clock time over a few runs. Usage: bench/run.sh [benchmark.anm...]
+# A C file next to a benchmark (bench/chant.c) is its reference: it is built
+# with $CC -O2, must print the same output and is timed alongside.
+# Set ANEMO to use a compiler other than ./anemo, CC to pick the C compiler,
+# RUNS to change repetitions and LEVELS to pick which build flags to compare.
+
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+anemo=${ANEMO:-$root/anemo}
+cc=${CC:-cc}
+runs=${RUNS:-5}
+levels=${LEVELS:-"-O0 -O1 -O2"}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+export ANEMO_DISABLE_UPDATE_CHECK=1
+
+if [ "$#" -eq 0 ]; then
+    set -- "$root"/bench/*.anm
+fi
+
+now_ns() {
+    date +%s%N
+}
+
+time_best() {
+    best=""
+    i=0
+    while [ "$i" -lt "$runs" ]; do
+        start=$(now_ns)
+        "$1" >/dev/null
+        end=$(now_ns)
+        elapsed=$(((end - start) / 1000))
+        if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+            best=$elapsed
+        fi
+        i=$((i + 1))
+    done
+    printf '  %-24s %8d us\n' "$2" "$best"
+}
+
+for src in "$@"; do
+    name=$(basename "$src" .anm)
+    printf '%s\n' "$name"
+    reference=""
+    for level in $levels; do
+        cp "$src" "$work/$name.anm"
+        (cd "$work" && "$anemo" build $level "$name.anm" >/dev/null 2>&1)
+        output=$("$work/$name")
+        if [ -z "$reference" ]; then
+            reference=$output
+        elif [ "$output" != "$reference" ]; then
+            printf '  %-24s output differs from %s\n' "$level" "$(echo $levels | cut -d' ' -f1)"
+            exit 1
+        fi
+        time_best "$work/$name" "$level"
+    done
+    c_src="${src%.anm}.c"
+    if [ -f "$c_src" ]; then
+        "$cc" -O2 -o "$work/$name.ref" "$c_src"
+        if [ "$("$work/$name.ref")" != "$reference" ]; then
+            printf '  %-24s output differs from %s\n' "$cc -O2" "$(echo $levels | cut -d' ' -f1)"
+            exit 1
+        fi
+        time_best "$work/$name.ref" "$cc -O2 ($(basename "$c_src"))"
+    fi
+done
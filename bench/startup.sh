@@ -0,0 +1,40 @@
+#!/bin/sh
+# Builds examples/hello.anm against libc and with --no-libc and reports the
+# average time from exec to exit over many runs, including the fork of the
+# shell that starts each run. Usage: bench/startup.sh [program.anm]
+# Set ANEMO to use a compiler other than ./anemo and RUNS to change the
+# number of runs.
+
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+anemo=${ANEMO:-$root/anemo}
+runs=${RUNS:-2000}
+src=${1:-$root/examples/hello.anm}
+name=$(basename "$src" .anm)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+export ANEMO_DISABLE_UPDATE_CHECK=1
+
+now_ns() {
+    date +%s%N
+}
+
+printf '%s, %d runs\n' "$name" "$runs"
+for runtime in libc no-libc; do
+    flags=""
+    if [ "$runtime" = no-libc ]; then
+        flags="--no-libc"
+    fi
+    cp "$src" "$work/$name.anm"
+    (cd "$work" && "$anemo" build $flags "$name.anm" >/dev/null 2>&1)
+    start=$(now_ns)
+    i=0
+    while [ "$i" -lt "$runs" ]; do
+        "$work/$name" >/dev/null
+        i=$((i + 1))
+    done
+    end=$(now_ns)
+    printf '  %-24s %8d us per run\n' "$runtime" $(((end - start) / 1000 / runs))
+done
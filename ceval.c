@@ -0,0 +1,314 @@
+#include "ceval.h"
+
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Budget of one evaluation: instructions executed (array clears count one
+   per element) and nested calls. */
+#define CEVAL_MAX_STEPS 250000
+#define CEVAL_MAX_DEPTH 200
+
+typedef struct Evaluator {
+    const IRProgram *ir;
+    long steps;
+    int **labels; /* per glyph, instruction index of each label, built on first call */
+} Evaluator;
+
+/* Locals of one running glyph. Arrays are allocated on first use. */
+typedef struct Frame {
+    const IRFunction *fn;
+    long *vars;
+    long **arrays;
+    long *temps;
+} Frame;
+
+static const int *label_index(Evaluator *ev, const IRFunction *fn) {
+    size_t f = (size_t)(fn - ev->ir->functions.items);
+    if (!ev->labels[f]) {
+        int *at = xmalloc((size_t)(fn->label_count > 0 ? fn->label_count : 1) * sizeof(int));
+        for (int l = 0; l < fn->label_count; l++) {
+            at[l] = -1;
+        }
+        for (size_t i = 0; i < fn->code.len; i++) {
+            const IRInstr *in = &fn->code.items[i];
+            if (in->op == IROP_LABEL && in->label >= 0 && in->label < fn->label_count) {
+                at[in->label] = (int)i;
+            }
+        }
+        ev->labels[f] = at;
+    }
+    return ev->labels[f];
+}
+
+static const long *rodata_values(const IRProgram *ir, int id) {
+    for (size_t i = 0; i < ir->arrays.len; i++) {
+        if (ir->arrays.items[i].id == id) {
+            return ir->arrays.items[i].values;
+        }
+    }
+    return NULL;
+}
+
+/* Elements of array var, or NULL when it is not an array. Constant arrays
+   are only ever read, so their rodata is used as is. */
+static long *array_of(Evaluator *ev, Frame *fr, int var) {
+    const IRVar *v = &fr->fn->vars.items[var];
+    if (v->array_len <= 0) {
+        return NULL;
+    }
+    if (!fr->arrays[var]) {
+        if (v->rodata >= 0) {
+            const long *values = rodata_values(ev->ir, v->rodata);
+            if (!values) {
+                return NULL;
+            }
+            fr->arrays[var] = xmalloc((size_t)v->array_len * sizeof(long));
+            memcpy(fr->arrays[var], values, (size_t)v->array_len * sizeof(long));
+        } else {
+            fr->arrays[var] = xcalloc((size_t)v->array_len, sizeof(long));
+        }
+        ev->steps += v->array_len;
+    }
+    return fr->arrays[var];
+}
+
+static int in_bounds(const Frame *fr, int var, long k) {
+    return k >= 0 && k < fr->fn->vars.items[var].array_len;
+}
+
+static int eval_function(Evaluator *ev, const IRFunction *fn, const long *args, int depth, long *out);
+
+/* Executes the instruction at *pc and advances it. Returns 1 to go on, 2
+   once the glyph returned and 0 when the evaluation has to give up. */
+static int step(Evaluator *ev, Frame *fr, size_t *pc, int depth, long *out) {
+    const IRFunction *fn = fr->fn;
+    const IRInstr *in = &fn->code.items[(*pc)++];
+    long *t = fr->temps;
+    switch (in->op) {
+        case IROP_LABEL:
+        case IROP_COUNT:
+            return 1;
+        case IROP_JMP:
+        case IROP_JMP_FALSE: {
+            if (in->op == IROP_JMP_FALSE && t[in->src1] != 0) {
+                return 1;
+            }
+            int at = in->label >= 0 && in->label < fn->label_count ? label_index(ev, fn)[in->label] : -1;
+            if (at < 0) {
+                return 0;
+            }
+            *pc = (size_t)at;
+            return 1;
+        }
+        case IROP_IMM_INT:
+        case IROP_IMM_BOOL:
+        case IROP_IMM_STR:
+            t[in->dst] = in->imm;
+            return 1;
+        case IROP_LOAD_VAR:
+            t[in->dst] = fr->vars[in->var_index];
+            return 1;
+        case IROP_STORE_VAR:
+            fr->vars[in->var_index] = t[in->src1];
+            return 1;
+        case IROP_BIN:
+            return ir_fold_binop(in->binop, t[in->src1], t[in->src2], &t[in->dst]);
+        case IROP_UN:
+            if (in->unop == IRUN_SPAN) {
+                return 0;
+            }
+            t[in->dst] = in->unop == IRUN_NEG ? (long)(0UL - (unsigned long)t[in->src1]) : t[in->src1] == 0;
+            return 1;
+        case IROP_CALL: {
+            const IRFunction *callee = ir_find_function(ev->ir, in->name);
+            long call_args[6];
+            long v = 0;
+            if (!callee || !callee->pure) {
+                return 0;
+            }
+            for (int a = 0; a < in->argc; a++) {
+                call_args[a] = t[in->args[a]];
+            }
+            if (!eval_function(ev, callee, call_args, depth + 1, &v)) {
+                return 0;
+            }
+            if (in->dst >= 0) {
+                t[in->dst] = v;
+            }
+            return 1;
+        }
+        case IROP_RET:
+            *out = in->has_value ? t[in->src1] : 0;
+            return 2;
+        case IROP_ARRAY_ZERO: {
+            long *a = array_of(ev, fr, in->var_index);
+            if (!a) {
+                return 0;
+            }
+            long len = fn->vars.items[in->var_index].array_len;
+            memset(a, 0, (size_t)len * sizeof(long));
+            ev->steps += len;
+            return 1;
+        }
+        case IROP_ARRAY_LOAD:
+        case IROP_ARRAY_STORE: {
+            long *a = array_of(ev, fr, in->var_index);
+            long k = t[in->src1];
+            if (!a || !in_bounds(fr, in->var_index, k)) {
+                return 0;
+            }
+            if (in->op == IROP_ARRAY_LOAD) {
+                t[in->dst] = a[k];
+            } else {
+                a[k] = t[in->src2];
+            }
+            return 1;
+        }
+        case IROP_CHECK_INDEX:
+            /* A failing check stops the program, which only runtime can do. */
+            return t[in->src1] >= 0 && t[in->src1] < in->imm;
+        case IROP_VEC_MAP:
+        case IROP_VEC_SUM: {
+            long lo = t[in->src1];
+            long hi = t[in->src2];
+            long *x = array_of(ev, fr, in->arrays[0]);
+            long *y = in->op == IROP_VEC_MAP ? array_of(ev, fr, in->arrays[1]) : x;
+            long *d = in->op == IROP_VEC_MAP ? array_of(ev, fr, in->var_index) : x;
+            if (!x || !y || !d) {
+                return 0;
+            }
+            if (lo >= hi) {
+                if (in->op == IROP_VEC_SUM) {
+                    t[in->dst] = 0;
+                }
+                return 1;
+            }
+            if (!in_bounds(fr, in->arrays[0], lo) || !in_bounds(fr, in->arrays[0], hi - 1) ||
+                (in->op == IROP_VEC_MAP &&
+                 (!in_bounds(fr, in->arrays[1], hi - 1) || !in_bounds(fr, in->var_index, hi - 1)))) {
+                return 0;
+            }
+            unsigned long sum = 0;
+            for (long k = lo; k < hi; k++) {
+                if (in->op == IROP_VEC_SUM) {
+                    sum += (unsigned long)x[k];
+                } else if (!ir_fold_binop(in->binop, x[k], y[k], &d[k])) {
+                    return 0;
+                }
+            }
+            if (in->op == IROP_VEC_SUM) {
+                t[in->dst] = (long)sum;
+            }
+            ev->steps += hi - lo;
+            return 1;
+        }
+        case IROP_CHANT:
+        case IROP_PHI:
+            return 0;
+    }
+    return 0;
+}
+
+/* Runs fn on args and stores what it yields in *out. Returns 0 when the
+   result has to be left to runtime. */
+static int eval_function(Evaluator *ev, const IRFunction *fn, const long *args, int depth, long *out) {
+    if (depth > CEVAL_MAX_DEPTH) {
+        return 0;
+    }
+    Frame fr;
+    fr.fn = fn;
+    fr.vars = xcalloc(fn->vars.len + 1, sizeof(long));
+    fr.arrays = xcalloc(fn->vars.len + 1, sizeof(long *));
+    fr.temps = xcalloc((size_t)fn->temp_count + 1, sizeof(long));
+    for (int p = 0; p < fn->param_count; p++) {
+        fr.vars[p] = args[p];
+    }
+
+    size_t pc = 0;
+    int status = 1;
+    while (status == 1) {
+        if (pc >= fn->code.len || ++ev->steps > CEVAL_MAX_STEPS) {
+            status = 0;
+            break;
+        }
+        status = step(ev, &fr, &pc, depth, out);
+    }
+
+    for (size_t v = 0; v < fn->vars.len; v++) {
+        free(fr.arrays[v]);
+    }
+    free(fr.temps);
+    free(fr.arrays);
+    free(fr.vars);
+    return status == 2;
+}
+
+/* Collects the constant arguments of a call. Returns 0 if any is not a
+   constant. */
+static int constant_args(const IRFunction *fn, const int *defs, const IRInstr *call, long *args) {
+    for (int a = 0; a < call->argc; a++) {
+        int d = call->args[a] >= 0 ? defs[call->args[a]] : -1;
+        if (d < 0) {
+            return 0;
+        }
+        const IRInstr *def = &fn->code.items[d];
+        if (def->op != IROP_IMM_INT && def->op != IROP_IMM_BOOL && def->op != IROP_IMM_STR) {
+            return 0;
+        }
+        args[a] = def->imm;
+    }
+    return 1;
+}
+
+int ceval_calls(const IRProgram *ir, IRFunction *fn, int report) {
+    int *defs = NULL;
+    Evaluator ev;
+    ev.ir = ir;
+    ev.steps = 0;
+    ev.labels = NULL;
+    int changed = 0;
+
+    for (size_t i = 0; i < fn->code.len; i++) {
+        IRInstr *in = &fn->code.items[i];
+        if (in->op != IROP_CALL || in->dst < 0) {
+            continue;
+        }
+        const IRFunction *callee = ir_find_function(ir, in->name);
+        if (!callee || !callee->pure || (callee->return_type != TYPE_INT && callee->return_type != TYPE_BOOL)) {
+            continue;
+        }
+        if (!defs) {
+            defs = ir_temp_defs(fn);
+            ev.labels = xcalloc(ir->functions.len, sizeof(int *));
+        }
+        long args[6];
+        long v = 0;
+        if (!constant_args(fn, defs, in, args)) {
+            continue;
+        }
+        ev.steps = 0;
+        if (!eval_function(&ev, callee, args, 0, &v)) {
+            continue;
+        }
+        if (report) {
+            printf("ceval: %s:%d: call to %s evaluated at compile time (%ld)\n", fn->name, in->line, in->name, v);
+        }
+        ir_free_instr(in);
+        in->op = callee->return_type == TYPE_INT ? IROP_IMM_INT : IROP_IMM_BOOL;
+        in->imm = v;
+        in->argc = 0;
+        changed = 1;
+    }
+
+    if (ev.labels) {
+        for (size_t f = 0; f < ir->functions.len; f++) {
+            free(ev.labels[f]);
+        }
+        free(ev.labels);
+    }
+    free(defs);
+    return changed;
+}
@@ -0,0 +1,12 @@
+#ifndef CEVAL_H
+#define CEVAL_H
+
+#include "ir.h"
+
+/* Runs calls to pure glyphs whose arguments are all constants at compile
+   time and replaces each with the value it yields. Calls that would take
+   too long, recurse too deep or stop the program are left to runtime.
+   Returns 1 if the code changed. */
+int ceval_calls(const IRProgram *ir, IRFunction *fn, int report);
+
+#endif
@@ -0,0 +1,471 @@
+#include "cfg.h"
+
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void grow(void **items, size_t *cap, size_t elem_size) {
+    size_t next = *cap == 0 ? 4 : *cap * 2;
+    *items = xrealloc(*items, next * elem_size);
+    *cap = next;
+}
+
+static void edge_push(CFGEdgeArray *arr, int block) {
+    if (arr->len == arr->cap) {
+        grow((void **)&arr->items, &arr->cap, sizeof(int));
+    }
+    arr->items[arr->len++] = block;
+}
+
+static void add_edge(CFG *cfg, int from, int to) {
+    CFGBlock *src = &cfg->blocks[from];
+    for (size_t i = 0; i < src->succs.len; i++) {
+        if (src->succs.items[i] == to) {
+            return;
+        }
+    }
+    edge_push(&src->succs, to);
+    edge_push(&cfg->blocks[to].preds, from);
+}
+
+static int ends_block(IROp op) {
+    return op == IROP_JMP || op == IROP_JMP_FALSE || op == IROP_RET;
+}
+
+static void new_block(CFG *cfg, size_t start, int label) {
+    if (cfg->len == cfg->cap) {
+        grow((void **)&cfg->blocks, &cfg->cap, sizeof(CFGBlock));
+    }
+    CFGBlock blk;
+    memset(&blk, 0, sizeof(blk));
+    blk.start = start;
+    blk.end = start;
+    blk.label = label;
+    blk.idom = -1;
+    blk.rpo_index = -1;
+    blk.loop = -1;
+    cfg->blocks[cfg->len++] = blk;
+}
+
+int cfg_block_of_label(const CFG *cfg, int label) {
+    if (label < 0 || label >= cfg->label_count) {
+        return -1;
+    }
+    return cfg->label_block[label];
+}
+
+static void mark_reachable(CFG *cfg) {
+    if (cfg->len == 0) {
+        return;
+    }
+    int *stack = xmalloc(cfg->len * sizeof(int));
+    size_t sp = 0;
+    cfg->blocks[0].reachable = 1;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        CFGBlock *b = &cfg->blocks[stack[--sp]];
+        for (size_t i = 0; i < b->succs.len; i++) {
+            CFGBlock *s = &cfg->blocks[b->succs.items[i]];
+            if (!s->reachable) {
+                s->reachable = 1;
+                stack[sp++] = b->succs.items[i];
+            }
+        }
+    }
+    free(stack);
+}
+
+void cfg_build(const IRFunction *fn, CFG *out_cfg) {
+    CFG cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.label_count = fn->label_count;
+    cfg.label_block = xmalloc((size_t)(cfg.label_count > 0 ? cfg.label_count : 1) * sizeof(int));
+    for (int i = 0; i < cfg.label_count; i++) {
+        cfg.label_block[i] = -1;
+    }
+
+    for (size_t i = 0; i < fn->code.len; i++) {
+        const IRInstr *in = &fn->code.items[i];
+        int starts = cfg.len == 0 || in->op == IROP_LABEL || ends_block(fn->code.items[i - 1].op);
+        if (starts) {
+            new_block(&cfg, i, in->op == IROP_LABEL ? in->label : -1);
+        }
+        if (in->op == IROP_LABEL) {
+            /* Consecutive labels share one block. */
+            cfg.label_block[in->label] = (int)cfg.len - 1;
+        }
+        cfg.blocks[cfg.len - 1].end = i + 1;
+    }
+
+    for (size_t b = 0; b < cfg.len; b++) {
+        const IRInstr *last = &fn->code.items[cfg.blocks[b].end - 1];
+        int fallthrough = b + 1 < cfg.len;
+        switch (last->op) {
+            case IROP_JMP:
+                add_edge(&cfg, (int)b, cfg.label_block[last->label]);
+                fallthrough = 0;
+                break;
+            case IROP_JMP_FALSE:
+                add_edge(&cfg, (int)b, cfg.label_block[last->label]);
+                break;
+            case IROP_RET:
+                fallthrough = 0;
+                break;
+            default:
+                break;
+        }
+        if (fallthrough) {
+            add_edge(&cfg, (int)b, (int)b + 1);
+        }
+    }
+
+    mark_reachable(&cfg);
+    *out_cfg = cfg;
+}
+
+static void compute_rpo(CFG *cfg) {
+    free(cfg->rpo);
+    cfg->rpo = xmalloc((cfg->len > 0 ? cfg->len : 1) * sizeof(int));
+    cfg->rpo_len = 0;
+    if (cfg->len == 0) {
+        return;
+    }
+
+    int *stack = xmalloc(cfg->len * sizeof(int));
+    size_t *next_succ = xcalloc(cfg->len, sizeof(size_t));
+    unsigned char *visited = xcalloc(cfg->len, 1);
+    int *post = xmalloc(cfg->len * sizeof(int));
+    size_t post_len = 0;
+    size_t sp = 0;
+
+    stack[sp++] = 0;
+    visited[0] = 1;
+    while (sp > 0) {
+        int b = stack[sp - 1];
+        CFGBlock *blk = &cfg->blocks[b];
+        if (next_succ[b] < blk->succs.len) {
+            int s = blk->succs.items[next_succ[b]++];
+            if (!visited[s]) {
+                visited[s] = 1;
+                stack[sp++] = s;
+            }
+            continue;
+        }
+        post[post_len++] = b;
+        sp--;
+    }
+
+    for (size_t i = 0; i < post_len; i++) {
+        int b = post[post_len - 1 - i];
+        cfg->rpo[cfg->rpo_len++] = b;
+        cfg->blocks[b].rpo_index = (int)i;
+    }
+
+    free(post);
+    free(visited);
+    free(next_succ);
+    free(stack);
+}
+
+static int intersect(const CFG *cfg, int a, int b) {
+    while (a != b) {
+        while (cfg->blocks[a].rpo_index > cfg->blocks[b].rpo_index) {
+            a = cfg->blocks[a].idom;
+        }
+        while (cfg->blocks[b].rpo_index > cfg->blocks[a].rpo_index) {
+            b = cfg->blocks[b].idom;
+        }
+    }
+    return a;
+}
+
+/* Cooper, Harvey and Kennedy's iterative dominator algorithm over reverse
+   postorder. The entry block and unreachable blocks get idom -1. */
+void cfg_compute_dominators(CFG *cfg) {
+    compute_rpo(cfg);
+    if (cfg->len == 0) {
+        return;
+    }
+    for (size_t b = 0; b < cfg->len; b++) {
+        cfg->blocks[b].idom = -1;
+        cfg->blocks[b].dom_children.len = 0;
+    }
+    cfg->blocks[0].idom = 0;
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (size_t i = 1; i < cfg->rpo_len; i++) {
+            int b = cfg->rpo[i];
+            CFGBlock *blk = &cfg->blocks[b];
+            int new_idom = -1;
+            for (size_t p = 0; p < blk->preds.len; p++) {
+                int pred = blk->preds.items[p];
+                if (cfg->blocks[pred].idom < 0) {
+                    continue;
+                }
+                new_idom = new_idom < 0 ? pred : intersect(cfg, pred, new_idom);
+            }
+            if (new_idom != blk->idom) {
+                blk->idom = new_idom;
+                changed = 1;
+            }
+        }
+    }
+
+    cfg->blocks[0].idom = -1;
+    for (size_t i = 1; i < cfg->rpo_len; i++) {
+        int b = cfg->rpo[i];
+        edge_push(&cfg->blocks[cfg->blocks[b].idom].dom_children, b);
+    }
+}
+
+void cfg_compute_frontiers(CFG *cfg) {
+    for (size_t b = 0; b < cfg->len; b++) {
+        cfg->blocks[b].frontier.len = 0;
+    }
+    for (size_t i = 0; i < cfg->rpo_len; i++) {
+        int b = cfg->rpo[i];
+        CFGBlock *blk = &cfg->blocks[b];
+        if (blk->preds.len < 2) {
+            continue;
+        }
+        for (size_t p = 0; p < blk->preds.len; p++) {
+            int runner = blk->preds.items[p];
+            if (cfg->blocks[runner].rpo_index < 0) {
+                continue;
+            }
+            while (runner >= 0 && runner != blk->idom) {
+                CFGEdgeArray *df = &cfg->blocks[runner].frontier;
+                if (df->len == 0 || df->items[df->len - 1] != b) {
+                    edge_push(df, b);
+                }
+                runner = cfg->blocks[runner].idom;
+            }
+        }
+    }
+}
+
+int cfg_dominates(const CFG *cfg, int a, int b) {
+    if (cfg->blocks[b].rpo_index < 0) {
+        return 0;
+    }
+    while (b >= 0) {
+        if (a == b) {
+            return 1;
+        }
+        b = cfg->blocks[b].idom;
+    }
+    return 0;
+}
+
+/* Finds natural loops from back edges (edges whose target dominates their
+   source) and nests them. Requires cfg_compute_dominators. Loops are ordered
+   by header in reverse postorder, so an outer loop precedes its inner ones. */
+void cfg_find_loops(CFG *cfg) {
+    for (size_t l = 0; l < cfg->loop_count; l++) {
+        free(cfg->loops[l].latches.items);
+        free(cfg->loops[l].blocks.items);
+    }
+    cfg->loop_count = 0;
+    for (size_t b = 0; b < cfg->len; b++) {
+        cfg->blocks[b].loop = -1;
+        cfg->blocks[b].loop_depth = 0;
+    }
+
+    unsigned char *in_loop = xcalloc(cfg->len > 0 ? cfg->len : 1, 1);
+    int *work = xmalloc((cfg->len > 0 ? cfg->len : 1) * sizeof(int));
+    for (size_t i = 0; i < cfg->rpo_len; i++) {
+        int h = cfg->rpo[i];
+        CFGLoop loop;
+        memset(&loop, 0, sizeof(loop));
+        loop.header = h;
+        loop.parent = -1;
+        size_t wl = 0;
+        memset(in_loop, 0, cfg->len);
+        in_loop[h] = 1;
+        edge_push(&loop.blocks, h);
+
+        const CFGBlock *hdr = &cfg->blocks[h];
+        for (size_t p = 0; p < hdr->preds.len; p++) {
+            int latch = hdr->preds.items[p];
+            if (!cfg_dominates(cfg, h, latch)) {
+                continue;
+            }
+            edge_push(&loop.latches, latch);
+            if (!in_loop[latch]) {
+                in_loop[latch] = 1;
+                edge_push(&loop.blocks, latch);
+                work[wl++] = latch;
+            }
+        }
+        if (loop.latches.len == 0) {
+            free(loop.blocks.items);
+            continue;
+        }
+        while (wl > 0) {
+            const CFGBlock *blk = &cfg->blocks[work[--wl]];
+            for (size_t p = 0; p < blk->preds.len; p++) {
+                int pred = blk->preds.items[p];
+                if (!in_loop[pred] && cfg->blocks[pred].rpo_index >= 0) {
+                    in_loop[pred] = 1;
+                    edge_push(&loop.blocks, pred);
+                    work[wl++] = pred;
+                }
+            }
+        }
+
+        if (cfg->loop_count == cfg->loop_cap) {
+            grow((void **)&cfg->loops, &cfg->loop_cap, sizeof(CFGLoop));
+        }
+        cfg->loops[cfg->loop_count++] = loop;
+    }
+    free(work);
+    free(in_loop);
+
+    /* Headers come in reverse postorder, so each block's innermost loop is
+       the last one that contains it, and a loop's parent is the innermost
+       loop containing its header before the loop itself was recorded. */
+    for (size_t l = 0; l < cfg->loop_count; l++) {
+        CFGLoop *loop = &cfg->loops[l];
+        loop->parent = cfg->blocks[loop->header].loop;
+        loop->depth = loop->parent < 0 ? 1 : cfg->loops[loop->parent].depth + 1;
+        for (size_t k = 0; k < loop->blocks.len; k++) {
+            CFGBlock *blk = &cfg->blocks[loop->blocks.items[k]];
+            blk->loop = (int)l;
+            blk->loop_depth = loop->depth;
+        }
+    }
+}
+
+int cfg_loop_contains(const CFG *cfg, int loop, int block) {
+    for (int l = cfg->blocks[block].loop; l >= 0; l = cfg->loops[l].parent) {
+        if (l == loop) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void dump_edges(FILE *out, const char *what, const CFGEdgeArray *edges) {
+    fprintf(out, " %s:", what);
+    if (edges->len == 0) {
+        fprintf(out, " -");
+    }
+    for (size_t i = 0; i < edges->len; i++) {
+        fprintf(out, " B%d", edges->items[i]);
+    }
+}
+
+void cfg_dump_function(FILE *out, const IRFunction *fn, const CFG *cfg) {
+    fprintf(out, "glyph %s: %zu blocks, %zu loops\n", fn->name, cfg->len, cfg->loop_count);
+    for (size_t b = 0; b < cfg->len; b++) {
+        const CFGBlock *blk = &cfg->blocks[b];
+        fprintf(out, "  B%zu", b);
+        if (blk->label >= 0) {
+            fprintf(out, " (L%d)", blk->label);
+        }
+        fprintf(out, " instrs %zu..%zu", blk->start, blk->end - 1);
+        if (!blk->reachable) {
+            fprintf(out, " unreachable\n");
+            continue;
+        }
+        dump_edges(out, "preds", &blk->preds);
+        dump_edges(out, "succs", &blk->succs);
+        if (blk->idom >= 0) {
+            fprintf(out, " idom: B%d", blk->idom);
+        }
+        if (blk->loop >= 0) {
+            fprintf(out, " loop: %d depth: %d", blk->loop, blk->loop_depth);
+        }
+        fputc('\n', out);
+    }
+    for (size_t l = 0; l < cfg->loop_count; l++) {
+        const CFGLoop *loop = &cfg->loops[l];
+        fprintf(out, "  loop %zu: header B%d depth %d", l, loop->header, loop->depth);
+        if (loop->parent >= 0) {
+            fprintf(out, " parent %d", loop->parent);
+        }
+        dump_edges(out, "latches", &loop->latches);
+        dump_edges(out, "blocks", &loop->blocks);
+        fputc('\n', out);
+    }
+}
+
+void cfg_dump_program(FILE *out, const IRProgram *ir) {
+    for (size_t i = 0; i < ir->functions.len; i++) {
+        const IRFunction *fn = &ir->functions.items[i];
+        CFG cfg;
+        cfg_build(fn, &cfg);
+        cfg_compute_dominators(&cfg);
+        cfg_find_loops(&cfg);
+        cfg_dump_function(out, fn, &cfg);
+        fputc('\n', out);
+        free_cfg(&cfg);
+    }
+}
+
+/* Backward liveness of variable slots. Returns a cfg->len x vars.len matrix
+   of live-in flags owned by the caller. */
+unsigned char *cfg_var_live_in(const IRFunction *fn, const CFG *cfg) {
+    size_t nvars = fn->vars.len;
+    unsigned char *live_in = xcalloc((cfg->len > 0 ? cfg->len : 1) * (nvars > 0 ? nvars : 1), 1);
+    unsigned char *live = xmalloc(nvars > 0 ? nvars : 1);
+    if (nvars == 0) {
+        free(live);
+        return live_in;
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (size_t b = cfg->len; b > 0; b--) {
+            const CFGBlock *blk = &cfg->blocks[b - 1];
+            memset(live, 0, nvars);
+            for (size_t s = 0; s < blk->succs.len; s++) {
+                const unsigned char *in = &live_in[(size_t)blk->succs.items[s] * nvars];
+                for (size_t v = 0; v < nvars; v++) {
+                    live[v] |= in[v];
+                }
+            }
+            for (size_t i = blk->end; i > blk->start; i--) {
+                const IRInstr *in = &fn->code.items[i - 1];
+                if (in->op == IROP_STORE_VAR) {
+                    live[in->var_index] = 0;
+                } else if (in->op == IROP_LOAD_VAR) {
+                    live[in->var_index] = 1;
+                }
+            }
+            unsigned char *dst = &live_in[(b - 1) * nvars];
+            if (memcmp(dst, live, nvars) != 0) {
+                memcpy(dst, live, nvars);
+                changed = 1;
+            }
+        }
+    }
+
+    free(live);
+    return live_in;
+}
+
+void free_cfg(CFG *cfg) {
+    if (!cfg) {
+        return;
+    }
+    for (size_t i = 0; i < cfg->len; i++) {
+        free(cfg->blocks[i].succs.items);
+        free(cfg->blocks[i].preds.items);
+        free(cfg->blocks[i].dom_children.items);
+        free(cfg->blocks[i].frontier.items);
+    }
+    for (size_t l = 0; l < cfg->loop_count; l++) {
+        free(cfg->loops[l].latches.items);
+        free(cfg->loops[l].blocks.items);
+    }
+    free(cfg->loops);
+    free(cfg->blocks);
+    free(cfg->label_block);
+    free(cfg->rpo);
+    memset(cfg, 0, sizeof(*cfg));
+}
@@ -0,0 +1,76 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include "ir.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct CFGEdgeArray {
+    int *items;
+    size_t len;
+    size_t cap;
+} CFGEdgeArray;
+
+typedef struct CFGBlock {
+    size_t start;
+    size_t end;
+    int label;
+    CFGEdgeArray succs;
+    CFGEdgeArray preds;
+    int reachable;
+
+    int idom;
+    int rpo_index;
+    CFGEdgeArray dom_children;
+    CFGEdgeArray frontier;
+
+    int loop;       /* innermost natural loop containing the block, or -1 */
+    int loop_depth;
+} CFGBlock;
+
+/* A natural loop: the header plus every block that reaches a back edge into
+   it without passing through the header. Back edges sharing a header form
+   one loop. */
+typedef struct CFGLoop {
+    int header;
+    CFGEdgeArray latches;
+    CFGEdgeArray blocks;
+    int parent;
+    int depth;
+} CFGLoop;
+
+typedef struct CFG {
+    CFGBlock *blocks;
+    size_t len;
+    size_t cap;
+
+    int *label_block;
+    int label_count;
+
+    int *rpo;
+    size_t rpo_len;
+
+    CFGLoop *loops;
+    size_t loop_count;
+    size_t loop_cap;
+} CFG;
+
+void cfg_build(const IRFunction *fn, CFG *out_cfg);
+void free_cfg(CFG *cfg);
+
+int cfg_block_of_label(const CFG *cfg, int label);
+
+void cfg_compute_dominators(CFG *cfg);
+void cfg_compute_frontiers(CFG *cfg);
+int cfg_dominates(const CFG *cfg, int a, int b);
+
+void cfg_find_loops(CFG *cfg);
+int cfg_loop_contains(const CFG *cfg, int loop, int block);
+
+void cfg_dump_function(FILE *out, const IRFunction *fn, const CFG *cfg);
+void cfg_dump_program(FILE *out, const IRProgram *ir);
+
+unsigned char *cfg_var_live_in(const IRFunction *fn, const CFG *cfg);
+
+#endif
@@ -1,15 +1,70 @@
 #include "codegen.h"
 
+#include "cfg.h"
+#include "mcode.h"
+#include "peephole.h"
 #include "utils.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-static const char *printf_symbol(void) {
+static const char *write_symbol(void) {
 #ifdef _WIN32
-    return "printf";
+    return "_write";
 #else
-    return "printf@PLT";
+    return "write@PLT";
+#endif
+}
+
+static const char *atexit_symbol(void) {
+#ifdef _WIN32
+    return "atexit";
+#else
+    return "atexit@PLT";
+#endif
+}
+
+static const char *isatty_symbol(void) {
+#ifdef _WIN32
+    return "_isatty";
+#else
+    return "isatty@PLT";
+#endif
+}
+
+static const char *malloc_symbol(void) {
+#ifdef _WIN32
+    return "malloc";
+#else
+    return "malloc@PLT";
+#endif
+}
+
+static const char *exit_symbol(void) {
+#ifdef _WIN32
+    return "exit";
+#else
+    return "exit@PLT";
+#endif
+}
+
+/* Marks the stack of ELF programs non-executable; without the note the
+   linker falls back to an executable stack. */
+static void emit_stack_note(MCode *out) {
+#ifdef _WIN32
+    (void)out;
+#else
+    mcode_emit(out, ".section .note.GNU-stack,\"\",@progbits\n");
+#endif
+}
+
+/* Section for code that rarely runs, kept away from the hot path. */
+static const char *cold_section(void) {
+#ifdef _WIN32
+    return ".section .text.unlikely,\"xr\"";
+#else
+    return ".section .text.unlikely,\"ax\",@progbits";
 #endif
 }
 
@@ -30,6 +85,35 @@ static int max_call_args(void) {
 #endif
 }
 
+/* Callee scratch area the caller reserves above the return address. It is
+   part of the caller's frame, so call sites do not adjust %rsp. */
+static int shadow_space(void) {
+#ifdef _WIN32
+    return 32;
+#else
+    return 0;
+#endif
+}
+
+/* Bytes below %rsp that leaf code may use without allocating them. */
+static int red_zone(void) {
+#ifdef _WIN32
+    return 0;
+#else
+    return 128;
+#endif
+}
+
+/* Frames this large must touch their pages in order because Windows grows
+   the stack one guard page at a time; 0 where no probing is needed. */
+static int stack_probe_size(void) {
+#ifdef _WIN32
+    return 4096;
+#else
+    return 0;
+#endif
+}
+
 static const char *label_for_fn(const char *name) {
     if (strcmp(name, "main") == 0) {
         return "main";
@@ -47,206 +131,1898 @@ static int temp_slot(const IRFunction *fn, int temp_id) {
     return (int)fn->vars.len + temp_id;
 }
 
-static void emit_escape_cstr(FILE *out, const char *s) {
-    fputc('"', out);
-    for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
-        unsigned char c = *p;
+static int in_frame(const IRVar *v) {
+    return v->array_len > 0 && v->rodata < 0;
+}
+
+/* Arrays sit below the scalar slots, each a run of 8-byte elements with
+   element 0 at the lowest address. Returns the %rbp offset of element 0. */
+static int array_offset(const IRFunction *fn, int var) {
+    long slot = (long)fn->vars.len + fn->temp_count;
+    for (int v = 0; v <= var; v++) {
+        if (in_frame(&fn->vars.items[v])) {
+            slot += fn->vars.items[v].array_len;
+        }
+    }
+    return (int)(-8 * slot);
+}
+
+static long array_slots(const IRFunction *fn) {
+    long n = 0;
+    for (size_t v = 0; v < fn->vars.len; v++) {
+        if (in_frame(&fn->vars.items[v])) {
+            n += fn->vars.items[v].array_len;
+        }
+    }
+    return n;
+}
+
+/* Runtime helpers a program needs, emitted once after the glyphs. */
+typedef struct RuntimeUse {
+    int index_fail;
+    int zero;
+    int vadd;
+    int vsub;
+    int vsum;
+    int chant;
+    int concat;    /* texts are joined, so inline texts and the arena exist */
+    int text_same; /* texts are compared by contents */
+    unsigned char *strings; /* per string id, whether code still refers to it */
+    int line_buffered; /* chants flush the output buffer after every line, even off a terminal */
+    int libc_free;     /* own _start and Linux system calls instead of libc */
+    const char *profile_path; /* where an instrumented program writes its counters, or NULL */
+    int profile_counters;
+} RuntimeUse;
+
+/* Arrays up to this many elements are cleared inline. */
+#define INLINE_ZERO_LIMIT 8
+
+/* Chant output collects in a buffer of this many bytes, written out when
+   the next line does not fit and at exit, or after every line when
+   standard output is a terminal. */
+#define OUT_BUFFER_SIZE 65536
+
+/* Longest chanted ember: a sign, 19 digits and the newline. */
+#define INT_TEXT_MAX 21
+
+/* Most ember chants sharing one room check. */
+#define CHANT_BATCH_MAX 64
+
+/* The hash of a text is the sum of its byte k times this base raised to
+   len - 1 - k, modulo 2^64, so the hash of a joined text follows from
+   those of its parts: hash(a) * base^len(b) + hash(b). */
+#define TEXT_HASH_BASE 1099511628211ULL
+
+/* Longest text held in the value itself instead of the arena. */
+#define INLINE_TEXT_MAX 7
+
+/* Joined texts are carved from arena chunks of this many bytes; longer
+   ones get a block of their own. Nothing is ever freed. */
+#define ARENA_CHUNK_SIZE (1 << 20)
+
+static void emit_escape_bytes(MCode *out, const char *s, size_t len) {
+    mcode_emit(out, "\"");
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
         switch (c) {
-            case '\n': fputs("\\n", out); break;
-            case '\t': fputs("\\t", out); break;
-            case '\r': fputs("\\r", out); break;
-            case '\\': fputs("\\\\", out); break;
-            case '"': fputs("\\\"", out); break;
+            case '\n': mcode_emit(out, "\\n"); break;
+            case '\t': mcode_emit(out, "\\t"); break;
+            case '\r': mcode_emit(out, "\\r"); break;
+            case '\\': mcode_emit(out, "\\\\"); break;
+            case '"': mcode_emit(out, "\\\""); break;
             default:
                 if (c < 32 || c > 126) {
-                    fprintf(out, "\\x%02x", c);
+                    mcode_emit(out, "\\%03o", c);
                 } else {
-                    fputc((int)c, out);
+                    mcode_emit(out, "%c", c);
                 }
                 break;
         }
     }
-    fputc('"', out);
+    mcode_emit(out, "\"");
+}
+
+static void emit_escape_cstr(MCode *out, const char *s) {
+    emit_escape_bytes(out, s, strlen(s));
+}
+
+/* The ember formatter serves chant and, without libc, index reports. */
+static int uses_put_int(const RuntimeUse *rt) {
+    return rt->chant || (rt->index_fail && rt->libc_free);
+}
+
+/* A text is the address of its characters, which follow three quads: the
+   hash base raised to its length, its hash and its length. Texts of up to
+   INLINE_TEXT_MAX bytes made at run time are held in the value instead,
+   marked by bit 0, with the length in bits 1-3 and the characters in bytes
+   1-7. Literals are always addresses, so interned ones still compare by
+   address, and chant copies them without scanning for the terminator, so
+   they may hold NUL bytes. */
+static void emit_text_bytes(MCode *out, const char *label, const char *s, size_t len) {
+    unsigned long long hash = 0;
+    unsigned long long power = 1;
+    for (size_t i = 0; i < len; i++) {
+        hash = hash * TEXT_HASH_BASE + (unsigned char)s[i];
+        power *= TEXT_HASH_BASE;
+    }
+    mcode_emit(out, "  .balign 8\n  .quad %llu\n  .quad %llu\n  .quad %zu\n.%s:\n  .string ", power, hash, len,
+               label);
+    emit_escape_bytes(out, s, len);
+    mcode_emit(out, "\n");
+}
+
+static void emit_text(MCode *out, const char *label, const char *s) {
+    emit_text_bytes(out, label, s, strlen(s));
 }
 
-static void emit_rodata(FILE *out, const IRProgram *ir) {
-    fprintf(out, ".section .rodata\n");
-    fprintf(out, ".LC_fmt_int:\n  .string \"%%ld\\n\"\n");
-    fprintf(out, ".LC_fmt_str:\n  .string \"%%s\\n\"\n");
-    fprintf(out, ".LC_bool_yes:\n  .string \"yes\"\n");
-    fprintf(out, ".LC_bool_no:\n  .string \"no\"\n");
+static void emit_rodata(MCode *out, const IRProgram *ir, const RuntimeUse *rt) {
+    mcode_emit(out, ".section .rodata\n");
+    emit_text(out, "LC_bool_yes", "yes");
+    emit_text(out, "LC_bool_no", "no");
 
     for (size_t i = 0; i < ir->strings.len; i++) {
-        fprintf(out, ".LC_str_%d:\n  .string ", ir->strings.items[i].id);
-        emit_escape_cstr(out, ir->strings.items[i].value);
-        fputc('\n', out);
+        if (!rt->strings[ir->strings.items[i].id]) {
+            continue;
+        }
+        char label[32];
+        snprintf(label, sizeof(label), "LC_str_%d", ir->strings.items[i].id);
+        emit_text_bytes(out, label, ir->strings.items[i].value, ir->strings.items[i].len);
+    }
+    if (rt->concat) {
+        emit_text(out, "LC_text_oom", "error: out of memory\n");
+    }
+    if (rt->index_fail && rt->libc_free) {
+        emit_text(out, "LC_index_prefix", "error: index out of range at line ");
+    } else if (rt->index_fail) {
+        mcode_emit(out, ".LC_index_fail:\n  .string \"error: index out of range at line %%ld\\n\"\n");
+    }
+    if (uses_put_int(rt)) {
+        mcode_emit(out, "  .balign 8\n.LC_pow10:\n");
+        unsigned long p = 1;
+        for (int k = 0; k < 20; k++, p *= 10) {
+            mcode_emit(out, "  .quad %lu\n", p);
+        }
+        mcode_emit(out, ".LC_digit_pairs:\n  .ascii \"");
+        for (int k = 0; k < 100; k++) {
+            mcode_emit(out, "%02d", k);
+        }
+        mcode_emit(out, "\"\n");
     }
-    fputc('\n', out);
+    for (size_t i = 0; i < ir->arrays.len; i++) {
+        const IRArrayData *data = &ir->arrays.items[i];
+        mcode_emit(out, "  .balign 8\n.LC_arr_%d:\n", data->id);
+        for (long k = 0; k < data->len; k++) {
+            mcode_emit(out, "  .quad %ld\n", data->values[k]);
+        }
+    }
+    if (rt->profile_path) {
+        mcode_emit(out, ".LC_profile_path:\n  .string ");
+        emit_escape_cstr(out, rt->profile_path);
+        mcode_emit(out, "\n.LC_profile_mode:\n  .string \"wb\"\n");
+
+        /* The counters follow the profile file header, so the whole block is
+           written out in one go. */
+        mcode_emit(out, ".data\n  .balign 8\n.Lprof_data:\n  .ascii \"ANMPROF1\"\n");
+        mcode_emit(out, "  .quad %d\n  .quad %lu\n", rt->profile_counters, ir->profile_hash);
+        mcode_emit(out, ".Lprof_counts:\n  .zero %d\n", 8 * rt->profile_counters);
+    }
+    mcode_emit(out, "\n");
 }
 
-static void load_slot(FILE *out, int offset, const char *reg) {
-    fprintf(out, "  movq %d(%%rbp), %s\n", offset, reg);
+static void load_slot(MCode *out, int offset, const char *reg) {
+    mcode_emit(out, "  movq %d(%%rbp), %s\n", offset, reg);
 }
 
-static void store_slot(FILE *out, int offset, const char *reg) {
-    fprintf(out, "  movq %s, %d(%%rbp)\n", reg, offset);
+static void store_slot(MCode *out, int offset, const char *reg) {
+    mcode_emit(out, "  movq %s, %d(%%rbp)\n", reg, offset);
 }
 
-static void load_temp(FILE *out, const IRFunction *fn, int temp, const char *reg) {
+static void load_temp(MCode *out, const IRFunction *fn, int temp, const char *reg) {
     int off = stack_slot_offset(temp_slot(fn, temp));
     load_slot(out, off, reg);
 }
 
-static void store_temp(FILE *out, const IRFunction *fn, int temp, const char *reg) {
+static void store_temp(MCode *out, const IRFunction *fn, int temp, const char *reg) {
     int off = stack_slot_offset(temp_slot(fn, temp));
     store_slot(out, off, reg);
 }
 
-static void emit_binop(FILE *out, const IRFunction *fn, const IRInstr *in) {
+/* Per-temp facts for instruction selection: whether the temp is defined by
+   an integer immediate (temps are assigned once, so the value holds at every
+   use) and how many instructions read it. */
+typedef struct TempInfo {
+    unsigned char *known;
+    long *value;
+    int *uses;
+} TempInfo;
+
+static void collect_temp_info(const IRFunction *fn, TempInfo *info) {
+    size_t n = fn->temp_count > 0 ? (size_t)fn->temp_count : 1;
+    info->known = xcalloc(n, 1);
+    info->value = xcalloc(n, sizeof(long));
+    info->uses = xcalloc(n, sizeof(int));
+    for (size_t i = 0; i < fn->code.len; i++) {
+        const IRInstr *in = &fn->code.items[i];
+        if (in->op == IROP_IMM_INT) {
+            info->known[in->dst] = 1;
+            info->value[in->dst] = in->imm;
+        }
+        int ops[IR_MAX_USES];
+        int nuses = ir_instr_uses(in, ops);
+        for (int k = 0; k < nuses; k++) {
+            info->uses[ops[k]]++;
+        }
+    }
+}
+
+static void free_temp_info(TempInfo *info) {
+    free(info->known);
+    free(info->value);
+    free(info->uses);
+}
+
+static int log2_exact(unsigned long v) {
+    if (v == 0 || (v & (v - 1)) != 0) {
+        return -1;
+    }
+    int k = 0;
+    while ((v >> k) != 1) {
+        k++;
+    }
+    return k;
+}
+
+/* Multiplies %rax by a positive constant with shifts and lea when that takes
+   at most two simple instructions. Returns 0 if no such sequence exists. */
+static int emit_mul_shift_lea(MCode *out, unsigned long c) {
+    static const int lea_scales[] = {3, 5, 9};
+    int k = log2_exact(c);
+    if (k >= 0) {
+        if (k > 0) {
+            mcode_emit(out, "  shlq $%d, %%rax\n", k);
+        }
+        return 1;
+    }
+    for (int i = 0; i < 3; i++) {
+        unsigned long m = (unsigned long)lea_scales[i];
+        if (c % m != 0 || (k = log2_exact(c / m)) < 0) {
+            continue;
+        }
+        mcode_emit(out, "  leaq (%%rax,%%rax,%lu), %%rax\n", m - 1);
+        if (k > 0) {
+            mcode_emit(out, "  shlq $%d, %%rax\n", k);
+        }
+        return 1;
+    }
+    if ((k = log2_exact(c - 1)) > 0) {
+        mcode_emit(out, "  movq %%rax, %%rcx\n");
+        mcode_emit(out, "  shlq $%d, %%rax\n", k);
+        mcode_emit(out, "  addq %%rcx, %%rax\n");
+        return 1;
+    }
+    if ((k = log2_exact(c + 1)) > 0) {
+        mcode_emit(out, "  movq %%rax, %%rcx\n");
+        mcode_emit(out, "  shlq $%d, %%rax\n", k);
+        mcode_emit(out, "  subq %%rcx, %%rax\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* %rax *= c. Products wrap modulo 2^64 exactly like imulq. */
+static void emit_mul_const(MCode *out, long c) {
+    unsigned long u = (unsigned long)c;
+    if (c == 0) {
+        mcode_emit(out, "  xorl %%eax, %%eax\n");
+        return;
+    }
+    if (emit_mul_shift_lea(out, u)) {
+        return;
+    }
+    if (c < 0 && emit_mul_shift_lea(out, 0UL - u)) {
+        mcode_emit(out, "  negq %%rax\n");
+    } else if (c >= -2147483648L && c <= 2147483647L) {
+        mcode_emit(out, "  imulq $%ld, %%rax, %%rax\n", c);
+    } else {
+        mcode_emit(out, "  movabsq $%ld, %%rcx\n", c);
+        mcode_emit(out, "  imulq %%rcx, %%rax\n");
+    }
+}
+
+/* Magic multiplier and shift for signed division by d (|d| >= 2), after
+   Hacker's Delight, section 10-4. */
+static void signed_div_magic(long d, long *magic, int *shift) {
+    const unsigned long two63 = 1UL << 63;
+    unsigned long ad = d < 0 ? 0UL - (unsigned long)d : (unsigned long)d;
+    unsigned long t = two63 + ((unsigned long)d >> 63);
+    unsigned long anc = t - 1 - t % ad;
+    unsigned long q1 = two63 / anc;
+    unsigned long r1 = two63 - q1 * anc;
+    unsigned long q2 = two63 / ad;
+    unsigned long r2 = two63 - q2 * ad;
+    unsigned long delta;
+    int p = 63;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    *magic = (long)(q2 + 1);
+    if (d < 0) {
+        *magic = (long)(0UL - (unsigned long)*magic);
+    }
+    *shift = p - 64;
+}
+
+/* %rax /= d for d other than 0 and -1, rounding toward zero like idivq. */
+static void emit_div_const(MCode *out, long d) {
+    if (d == 1) {
+        return;
+    }
+    unsigned long ad = d < 0 ? 0UL - (unsigned long)d : (unsigned long)d;
+    int k = log2_exact(ad);
+    if (k > 0) {
+        /* Bias negative dividends by |d| - 1 so the arithmetic shift truncates. */
+        mcode_emit(out, "  movq %%rax, %%rdx\n");
+        mcode_emit(out, "  sarq $63, %%rdx\n");
+        mcode_emit(out, "  shrq $%d, %%rdx\n", 64 - k);
+        mcode_emit(out, "  addq %%rdx, %%rax\n");
+        mcode_emit(out, "  sarq $%d, %%rax\n", k);
+        if (d < 0) {
+            mcode_emit(out, "  negq %%rax\n");
+        }
+        return;
+    }
+
+    long magic;
+    int shift;
+    signed_div_magic(d, &magic, &shift);
+    mcode_emit(out, "  movq %%rax, %%rcx\n");
+    mcode_emit(out, "  movabsq $%ld, %%rax\n", magic);
+    mcode_emit(out, "  imulq %%rcx\n");
+    if (d > 0 && magic < 0) {
+        mcode_emit(out, "  addq %%rcx, %%rdx\n");
+    } else if (d < 0 && magic > 0) {
+        mcode_emit(out, "  subq %%rcx, %%rdx\n");
+    }
+    if (shift > 0) {
+        mcode_emit(out, "  sarq $%d, %%rdx\n", shift);
+    }
+    /* Add one when the quotient is negative to round toward zero. */
+    mcode_emit(out, "  movq %%rdx, %%rax\n");
+    mcode_emit(out, "  shrq $63, %%rax\n");
+    mcode_emit(out, "  addq %%rdx, %%rax\n");
+}
+
+/* Multiplication and division by a constant operand avoid imulq/idivq where
+   a cheaper sequence gives the same result. Divisors 0 and -1 keep idivq so
+   they still trap. Returns 0 when not applicable. */
+static int emit_binop_const(MCode *out, const IRFunction *fn, const IRInstr *in, const TempInfo *info) {
+    if (in->binop == IRBIN_MUL && (info->known[in->src1] || info->known[in->src2])) {
+        int c = info->known[in->src2] ? in->src2 : in->src1;
+        load_temp(out, fn, c == in->src2 ? in->src1 : in->src2, "%rax");
+        emit_mul_const(out, info->value[c]);
+        store_temp(out, fn, in->dst, "%rax");
+        return 1;
+    }
+    if (in->binop == IRBIN_DIV && info->known[in->src2] && info->value[in->src2] != 0 &&
+        info->value[in->src2] != -1) {
+        load_temp(out, fn, in->src1, "%rax");
+        emit_div_const(out, info->value[in->src2]);
+        store_temp(out, fn, in->dst, "%rax");
+        return 1;
+    }
+    return 0;
+}
+
+static void emit_binop(MCode *out, const IRFunction *fn, const IRInstr *in, const TempInfo *info) {
+    if (emit_binop_const(out, fn, in, info)) {
+        return;
+    }
     load_temp(out, fn, in->src1, "%rax");
-    load_temp(out, fn, in->src2, "%rbx");
+    load_temp(out, fn, in->src2, "%rcx");
 
     switch (in->binop) {
         case IRBIN_ADD:
-            fprintf(out, "  addq %%rbx, %%rax\n");
+            mcode_emit(out, "  addq %%rcx, %%rax\n");
             break;
         case IRBIN_SUB:
-            fprintf(out, "  subq %%rbx, %%rax\n");
+            mcode_emit(out, "  subq %%rcx, %%rax\n");
             break;
         case IRBIN_MUL:
-            fprintf(out, "  imulq %%rbx, %%rax\n");
+            mcode_emit(out, "  imulq %%rcx, %%rax\n");
             break;
         case IRBIN_DIV:
-            fprintf(out, "  cqto\n");
-            fprintf(out, "  idivq %%rbx\n");
+            mcode_emit(out, "  cqto\n");
+            mcode_emit(out, "  idivq %%rcx\n");
             break;
         case IRBIN_BOTH:
-            fprintf(out, "  andq %%rbx, %%rax\n");
-            fprintf(out, "  cmpq $0, %%rax\n");
-            fprintf(out, "  setne %%al\n");
-            fprintf(out, "  movzbq %%al, %%rax\n");
+            mcode_emit(out, "  andq %%rcx, %%rax\n");
+            mcode_emit(out, "  cmpq $0, %%rax\n");
+            mcode_emit(out, "  setne %%al\n");
+            mcode_emit(out, "  movzbq %%al, %%rax\n");
             break;
         case IRBIN_EITHER:
-            fprintf(out, "  orq %%rbx, %%rax\n");
-            fprintf(out, "  cmpq $0, %%rax\n");
-            fprintf(out, "  setne %%al\n");
-            fprintf(out, "  movzbq %%al, %%rax\n");
+            mcode_emit(out, "  orq %%rcx, %%rax\n");
+            mcode_emit(out, "  cmpq $0, %%rax\n");
+            mcode_emit(out, "  setne %%al\n");
+            mcode_emit(out, "  movzbq %%al, %%rax\n");
             break;
         case IRBIN_SAME:
-            fprintf(out, "  cmpq %%rbx, %%rax\n");
-            fprintf(out, "  sete %%al\n");
-            fprintf(out, "  movzbq %%al, %%rax\n");
+            mcode_emit(out, "  cmpq %%rcx, %%rax\n");
+            mcode_emit(out, "  sete %%al\n");
+            mcode_emit(out, "  movzbq %%al, %%rax\n");
             break;
         case IRBIN_DIFF:
-            fprintf(out, "  cmpq %%rbx, %%rax\n");
-            fprintf(out, "  setne %%al\n");
-            fprintf(out, "  movzbq %%al, %%rax\n");
+            mcode_emit(out, "  cmpq %%rcx, %%rax\n");
+            mcode_emit(out, "  setne %%al\n");
+            mcode_emit(out, "  movzbq %%al, %%rax\n");
             break;
         case IRBIN_LESS:
-            fprintf(out, "  cmpq %%rbx, %%rax\n");
-            fprintf(out, "  setl %%al\n");
-            fprintf(out, "  movzbq %%al, %%rax\n");
+            mcode_emit(out, "  cmpq %%rcx, %%rax\n");
+            mcode_emit(out, "  setl %%al\n");
+            mcode_emit(out, "  movzbq %%al, %%rax\n");
             break;
         case IRBIN_MORE:
-            fprintf(out, "  cmpq %%rbx, %%rax\n");
-            fprintf(out, "  setg %%al\n");
-            fprintf(out, "  movzbq %%al, %%rax\n");
+            mcode_emit(out, "  cmpq %%rcx, %%rax\n");
+            mcode_emit(out, "  setg %%al\n");
+            mcode_emit(out, "  movzbq %%al, %%rax\n");
             break;
         case IRBIN_ATMOST:
-            fprintf(out, "  cmpq %%rbx, %%rax\n");
-            fprintf(out, "  setle %%al\n");
-            fprintf(out, "  movzbq %%al, %%rax\n");
+            mcode_emit(out, "  cmpq %%rcx, %%rax\n");
+            mcode_emit(out, "  setle %%al\n");
+            mcode_emit(out, "  movzbq %%al, %%rax\n");
             break;
         case IRBIN_ATLEAST:
-            fprintf(out, "  cmpq %%rbx, %%rax\n");
-            fprintf(out, "  setge %%al\n");
-            fprintf(out, "  movzbq %%al, %%rax\n");
+            mcode_emit(out, "  cmpq %%rcx, %%rax\n");
+            mcode_emit(out, "  setge %%al\n");
+            mcode_emit(out, "  movzbq %%al, %%rax\n");
+            break;
+        case IRBIN_CONCAT:
+        case IRBIN_TEXT_SAME:
+            mcode_emit(out, "  movq %%rcx, %s\n", arg_reg64(1));
+            mcode_emit(out, "  movq %%rax, %s\n", arg_reg64(0));
+            mcode_emit(out, "  call .Lrt_text_%s\n", in->binop == IRBIN_CONCAT ? "concat" : "same");
             break;
     }
 
     store_temp(out, fn, in->dst, "%rax");
 }
 
-static void emit_unop(FILE *out, const IRFunction *fn, const IRInstr *in) {
+/* Condition code that holds when a comparison is true, or NULL for
+   operators that are not comparisons. */
+static const char *compare_cc(IRBinOp op) {
+    switch (op) {
+        case IRBIN_SAME: return "e";
+        case IRBIN_DIFF: return "ne";
+        case IRBIN_LESS: return "l";
+        case IRBIN_MORE: return "g";
+        case IRBIN_ATMOST: return "le";
+        case IRBIN_ATLEAST: return "ge";
+        default: return NULL;
+    }
+}
+
+static const char *negate_cc(const char *cc) {
+    static const char *pairs[][2] = {{"e", "ne"}, {"l", "ge"}, {"g", "le"}};
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+        if (strcmp(cc, pairs[i][0]) == 0) {
+            return pairs[i][1];
+        }
+        if (strcmp(cc, pairs[i][1]) == 0) {
+            return pairs[i][0];
+        }
+    }
+    return cc;
+}
+
+/* Lowers a comparison (optionally under flip) whose only reader is the
+   conditional branch right after it to one cmp and jcc, without
+   materialising the boolean. Returns how many IR instructions it consumed,
+   or 0 if the pattern does not apply at code[i]. */
+static size_t emit_fused_branch(MCode *out, const IRFunction *fn, size_t i, const TempInfo *info) {
+    const IRInstr *cmp = &fn->code.items[i];
+    if (cmp->op == IROP_UN && cmp->unop == IRUN_FLIP && info->uses[cmp->dst] == 1 && i + 1 < fn->code.len &&
+        fn->code.items[i + 1].op == IROP_JMP_FALSE && fn->code.items[i + 1].src1 == cmp->dst) {
+        load_temp(out, fn, cmp->src1, "%rax");
+        mcode_emit(out, "  cmpq $0, %%rax\n");
+        mcode_emit(out, "  jne .L_%s_%d\n", fn->name, fn->code.items[i + 1].label);
+        return 2;
+    }
+    const char *cc = cmp->op == IROP_BIN ? compare_cc(cmp->binop) : NULL;
+    if (!cc || info->uses[cmp->dst] != 1) {
+        return 0;
+    }
+    size_t next = i + 1;
+    int cond = cmp->dst;
+    int flipped = 0;
+    if (next < fn->code.len && fn->code.items[next].op == IROP_UN && fn->code.items[next].unop == IRUN_FLIP &&
+        fn->code.items[next].src1 == cond && info->uses[fn->code.items[next].dst] == 1) {
+        cond = fn->code.items[next].dst;
+        flipped = 1;
+        next++;
+    }
+    if (next >= fn->code.len || fn->code.items[next].op != IROP_JMP_FALSE || fn->code.items[next].src1 != cond) {
+        return 0;
+    }
+
+    load_temp(out, fn, cmp->src1, "%rax");
+    if (info->known[cmp->src2] && info->value[cmp->src2] >= -2147483648L && info->value[cmp->src2] <= 2147483647L) {
+        mcode_emit(out, "  cmpq $%ld, %%rax\n", info->value[cmp->src2]);
+    } else {
+        load_temp(out, fn, cmp->src2, "%rcx");
+        mcode_emit(out, "  cmpq %%rcx, %%rax\n");
+    }
+    /* jmp_false leaves when the condition is false; under flip, when the
+       comparison is true. */
+    mcode_emit(out, "  j%s .L_%s_%d\n", flipped ? cc : negate_cc(cc), fn->name, fn->code.items[next].label);
+    return next - i + 1;
+}
+
+static void emit_unop(MCode *out, const IRFunction *fn, const IRInstr *in, size_t at) {
     load_temp(out, fn, in->src1, "%rax");
     if (in->unop == IRUN_NEG) {
-        fprintf(out, "  negq %%rax\n");
+        mcode_emit(out, "  negq %%rax\n");
+    } else if (in->unop == IRUN_SPAN) {
+        mcode_emit(out, "  testq $1, %%rax\n");
+        mcode_emit(out, "  jnz .L_%s_span_inline_%zu\n", fn->name, at);
+        mcode_emit(out, "  movq -8(%%rax), %%rax\n");
+        mcode_emit(out, "  jmp .L_%s_span_done_%zu\n", fn->name, at);
+        mcode_emit(out, ".L_%s_span_inline_%zu:\n", fn->name, at);
+        mcode_emit(out, "  shrl $1, %%eax\n");
+        mcode_emit(out, "  andl $7, %%eax\n");
+        mcode_emit(out, ".L_%s_span_done_%zu:\n", fn->name, at);
     } else {
-        fprintf(out, "  cmpq $0, %%rax\n");
-        fprintf(out, "  sete %%al\n");
-        fprintf(out, "  movzbq %%al, %%rax\n");
+        mcode_emit(out, "  cmpq $0, %%rax\n");
+        mcode_emit(out, "  sete %%al\n");
+        mcode_emit(out, "  movzbq %%al, %%rax\n");
     }
     store_temp(out, fn, in->dst, "%rax");
 }
 
-static void emit_chant(FILE *out, const IRFunction *fn, const IRInstr *in) {
+/* Chants go through the buffered runtime; pulses chant the text of
+   yes or no. */
+static void emit_chant(MCode *out, const IRFunction *fn, const IRInstr *in) {
+    const char *arg = arg_reg64(0);
+    load_temp(out, fn, in->src1, arg);
+    if (in->type == TYPE_INT) {
+        mcode_emit(out, "  call .Lrt_chant_int\n");
+        return;
+    }
+    if (in->type != TYPE_STRING) {
+        mcode_emit(out, "  testq %s, %s\n", arg, arg);
+        mcode_emit(out, "  leaq .LC_bool_no(%%rip), %s\n", arg);
+        mcode_emit(out, "  leaq .LC_bool_yes(%%rip), %%r11\n");
+        mcode_emit(out, "  cmovne %%r11, %s\n", arg);
+    }
+    mcode_emit(out, "  call .Lrt_chant_str\n");
+}
+
+/* Joining and comparing texts call into the runtime. */
+static int calls_text_runtime(const IRInstr *in) {
+    return in->op == IROP_BIN && (in->binop == IRBIN_CONCAT || in->binop == IRBIN_TEXT_SAME);
+}
+
+/* Index of the last ember chant in the run starting at the one at i, where
+   only straight-line code that keeps away from %r9 and never leaves the
+   glyph runs between them; *count gets the number of chants. */
+static size_t chant_batch_end(const IRFunction *fn, size_t i, int *count) {
+    size_t last = i;
+    *count = 1;
+    for (size_t j = i + 1; j < fn->code.len && *count < CHANT_BATCH_MAX; j++) {
+        const IRInstr *in = &fn->code.items[j];
+        if (in->op == IROP_CHANT && in->type == TYPE_INT) {
+            last = j;
+            (*count)++;
+        } else if (calls_text_runtime(in) || (in->op == IROP_UN && in->unop == IRUN_SPAN) ||
+                   (in->op != IROP_IMM_INT && in->op != IROP_IMM_BOOL && in->op != IROP_IMM_STR &&
+                    in->op != IROP_LOAD_VAR && in->op != IROP_STORE_VAR && in->op != IROP_BIN &&
+                    in->op != IROP_UN && in->op != IROP_ARRAY_LOAD && in->op != IROP_COUNT)) {
+            break;
+        }
+    }
+    return last;
+}
+
+/* Address of element 0 of an array, in the frame or in rodata. */
+static void array_address(MCode *out, const IRFunction *fn, int var, const char *reg) {
+    const IRVar *v = &fn->vars.items[var];
+    if (v->rodata >= 0) {
+        mcode_emit(out, "  leaq .LC_arr_%d(%%rip), %s\n", v->rodata, reg);
+    } else {
+        mcode_emit(out, "  leaq %d(%%rbp), %s\n", array_offset(fn, var), reg);
+    }
+}
+
+/* Address of element %rax of an array. Uses %r11 for rodata arrays. */
+static void element_address(MCode *out, const IRFunction *fn, int var, const char *reg) {
+    const IRVar *v = &fn->vars.items[var];
+    if (v->rodata >= 0) {
+        mcode_emit(out, "  leaq .LC_arr_%d(%%rip), %%r11\n", v->rodata);
+        mcode_emit(out, "  leaq (%%r11,%%rax,8), %s\n", reg);
+    } else {
+        mcode_emit(out, "  leaq %d(%%rbp,%%rax,8), %s\n", array_offset(fn, var), reg);
+    }
+}
+
+/* Array elements are always addressed through a register so the peephole
+   pass never mistakes them for scalar slots. */
+static void emit_array_op(MCode *out, const IRFunction *fn, const IRInstr *in, int end_label, size_t at) {
+    const IRVar *v = in->op == IROP_CHECK_INDEX ? NULL : &fn->vars.items[in->var_index];
+    switch (in->op) {
+        case IROP_ARRAY_ZERO:
+            if (v->array_len <= INLINE_ZERO_LIMIT) {
+                array_address(out, fn, in->var_index, "%rcx");
+                for (long k = 0; k < v->array_len; k++) {
+                    mcode_emit(out, "  movq $0, %ld(%%rcx)\n", k * 8);
+                }
+            } else {
+                array_address(out, fn, in->var_index, arg_reg64(0));
+                mcode_emit(out, "  movq $%ld, %s\n", v->array_len, arg_reg64(1));
+                mcode_emit(out, "  call .Lrt_zero\n");
+            }
+            break;
+        case IROP_ARRAY_LOAD:
+            load_temp(out, fn, in->src1, "%rax");
+            if (v->rodata >= 0) {
+                mcode_emit(out, "  leaq .LC_arr_%d(%%rip), %%rcx\n", v->rodata);
+                mcode_emit(out, "  movq (%%rcx,%%rax,8), %%rax\n");
+            } else {
+                mcode_emit(out, "  movq %d(%%rbp,%%rax,8), %%rax\n", array_offset(fn, in->var_index));
+            }
+            store_temp(out, fn, in->dst, "%rax");
+            break;
+        case IROP_ARRAY_STORE:
+            load_temp(out, fn, in->src1, "%rax");
+            load_temp(out, fn, in->src2, "%rcx");
+            mcode_emit(out, "  movq %%rcx, %d(%%rbp,%%rax,8)\n", array_offset(fn, in->var_index));
+            break;
+        case IROP_CHECK_INDEX:
+            /* Unsigned compare also sends negative indices to the stub. */
+            load_temp(out, fn, in->src1, "%rax");
+            mcode_emit(out, "  cmpq $%ld, %%rax\n", in->imm);
+            mcode_emit(out, "  jae .L_%s_%d\n", fn->name, end_label + 1 + (int)at);
+            break;
+        default:
+            break;
+    }
+}
+
+static const char *simd_name(SimdLevel simd) {
+    switch (simd) {
+        case SIMD_OFF: return "scalar code";
+        case SIMD_SSE2: return "sse2";
+        case SIMD_AVX2: return "avx2";
+    }
+    return "?";
+}
+
+/* Passes element pointers for [src1, src2) and the element count to the
+   runtime vector helpers. */
+static void emit_vector_op(MCode *out, const IRFunction *fn, const IRInstr *in, const CodegenOptions *opts) {
+    int arg = 0;
     load_temp(out, fn, in->src1, "%rax");
+    if (in->op == IROP_VEC_MAP) {
+        element_address(out, fn, in->var_index, arg_reg64(arg++));
+        element_address(out, fn, in->arrays[0], arg_reg64(arg++));
+        element_address(out, fn, in->arrays[1], arg_reg64(arg++));
+    } else {
+        element_address(out, fn, in->arrays[0], arg_reg64(arg++));
+    }
+    load_temp(out, fn, in->src2, arg_reg64(arg));
+    mcode_emit(out, "  subq %%rax, %s\n", arg_reg64(arg));
+    if (in->op == IROP_VEC_SUM) {
+        mcode_emit(out, "  call .Lrt_vsum\n");
+        store_temp(out, fn, in->dst, "%rax");
+    } else {
+        mcode_emit(out, "  call .Lrt_%s\n", in->binop == IRBIN_ADD ? "vadd" : "vsub");
+    }
+    if (opts->report) {
+        printf("simd: %s:%d: %s loop lowered to %s\n", fn->name, in->line,
+               in->op == IROP_VEC_SUM ? "sum" : in->binop == IRBIN_ADD ? "elementwise add" : "elementwise sub",
+               simd_name(opts->simd));
+    }
+}
+
+/* Moves helper arguments into r8..r11, which are free to clobber under
+   both ABIs. Last argument first, so Win64's %r8/%r9 are read before they
+   are overwritten. */
+static void helper_args(MCode *out, const char *const *regs, int count) {
+    for (int k = count - 1; k >= 0; k--) {
+        mcode_emit(out, "  movq %s, %s\n", arg_reg64(k), regs[k]);
+    }
+}
 
+/* Vector width in elements and the mnemonics for it. */
+typedef struct SimdOps {
+    int width;
+    const char *load;  /* unaligned load/store */
+    const char *reg0;
+    const char *reg1;
+} SimdOps;
+
+static SimdOps simd_ops(SimdLevel simd) {
+    SimdOps ops;
+    ops.width = simd == SIMD_AVX2 ? 4 : simd == SIMD_SSE2 ? 2 : 1;
+    ops.load = simd == SIMD_AVX2 ? "vmovdqu" : "movdqu";
+    ops.reg0 = simd == SIMD_AVX2 ? "%ymm0" : "%xmm0";
+    ops.reg1 = simd == SIMD_AVX2 ? "%ymm1" : "%xmm1";
+    return ops;
+}
+
+/* dst[k] = a[k] op b[k] for k < n, in r8 = dst, r9 = a, r10 = b, r11 = n.
+   The vector loop covers n rounded down to the width, the scalar loop the
+   rest. */
+static void emit_rt_map(MCode *out, const char *name, const char *scalar_op, const char *vector_op,
+                        SimdLevel simd) {
+    static const char *const regs[] = {"%r8", "%r9", "%r10", "%r11"};
+    SimdOps v = simd_ops(simd);
+    mcode_emit(out, ".Lrt_%s:\n", name);
+    helper_args(out, regs, 4);
+    mcode_emit(out, "  xorl %%ecx, %%ecx\n");
+    if (v.width > 1) {
+        mcode_emit(out, "  movq %%r11, %%rdx\n");
+        mcode_emit(out, "  andq $-%d, %%rdx\n", v.width);
+        mcode_emit(out, "  jz .Lrt_%s_tail\n", name);
+        mcode_emit(out, ".Lrt_%s_vec:\n", name);
+        mcode_emit(out, "  %s (%%r9,%%rcx,8), %s\n", v.load, v.reg0);
+        mcode_emit(out, "  %s (%%r10,%%rcx,8), %s\n", v.load, v.reg1);
+        if (simd == SIMD_AVX2) {
+            mcode_emit(out, "  v%s %s, %s, %s\n", vector_op, v.reg1, v.reg0, v.reg0);
+        } else {
+            mcode_emit(out, "  %s %s, %s\n", vector_op, v.reg1, v.reg0);
+        }
+        mcode_emit(out, "  %s %s, (%%r8,%%rcx,8)\n", v.load, v.reg0);
+        mcode_emit(out, "  addq $%d, %%rcx\n", v.width);
+        mcode_emit(out, "  cmpq %%rdx, %%rcx\n");
+        mcode_emit(out, "  jb .Lrt_%s_vec\n", name);
+        if (simd == SIMD_AVX2) {
+            mcode_emit(out, "  vzeroupper\n");
+        }
+    }
+    mcode_emit(out, ".Lrt_%s_tail:\n", name);
+    mcode_emit(out, "  cmpq %%r11, %%rcx\n");
+    mcode_emit(out, "  jae .Lrt_%s_done\n", name);
+    mcode_emit(out, "  movq (%%r9,%%rcx,8), %%rax\n");
+    mcode_emit(out, "  %s (%%r10,%%rcx,8), %%rax\n", scalar_op);
+    mcode_emit(out, "  movq %%rax, (%%r8,%%rcx,8)\n");
+    mcode_emit(out, "  incq %%rcx\n");
+    mcode_emit(out, "  jmp .Lrt_%s_tail\n", name);
+    mcode_emit(out, ".Lrt_%s_done:\n", name);
+    mcode_emit(out, "  ret\n");
+}
+
+/* %rax = sum of a[k] for k < n, in r9 = a, r11 = n. */
+static void emit_rt_sum(MCode *out, SimdLevel simd) {
+    static const char *const regs[] = {"%r9", "%r11"};
+    SimdOps v = simd_ops(simd);
+    mcode_emit(out, ".Lrt_vsum:\n");
+    helper_args(out, regs, 2);
+    mcode_emit(out, "  xorl %%eax, %%eax\n");
+    mcode_emit(out, "  xorl %%ecx, %%ecx\n");
+    if (v.width > 1) {
+        mcode_emit(out, "  movq %%r11, %%rdx\n");
+        mcode_emit(out, "  andq $-%d, %%rdx\n", v.width);
+        mcode_emit(out, "  jz .Lrt_vsum_tail\n");
+        if (simd == SIMD_AVX2) {
+            mcode_emit(out, "  vpxor %%ymm0, %%ymm0, %%ymm0\n");
+        } else {
+            mcode_emit(out, "  pxor %%xmm0, %%xmm0\n");
+        }
+        mcode_emit(out, ".Lrt_vsum_vec:\n");
+        if (simd == SIMD_AVX2) {
+            mcode_emit(out, "  vpaddq (%%r9,%%rcx,8), %%ymm0, %%ymm0\n");
+        } else {
+            mcode_emit(out, "  movdqu (%%r9,%%rcx,8), %%xmm1\n");
+            mcode_emit(out, "  paddq %%xmm1, %%xmm0\n");
+        }
+        mcode_emit(out, "  addq $%d, %%rcx\n", v.width);
+        mcode_emit(out, "  cmpq %%rdx, %%rcx\n");
+        mcode_emit(out, "  jb .Lrt_vsum_vec\n");
+        if (simd == SIMD_AVX2) {
+            mcode_emit(out, "  vextracti128 $1, %%ymm0, %%xmm1\n");
+            mcode_emit(out, "  vpaddq %%xmm1, %%xmm0, %%xmm0\n");
+            mcode_emit(out, "  vzeroupper\n");
+        }
+        mcode_emit(out, "  pshufd $0x4e, %%xmm0, %%xmm1\n");
+        mcode_emit(out, "  paddq %%xmm1, %%xmm0\n");
+        mcode_emit(out, "  movq %%xmm0, %%rax\n");
+    }
+    mcode_emit(out, ".Lrt_vsum_tail:\n");
+    mcode_emit(out, "  cmpq %%r11, %%rcx\n");
+    mcode_emit(out, "  jae .Lrt_vsum_done\n");
+    mcode_emit(out, "  addq (%%r9,%%rcx,8), %%rax\n");
+    mcode_emit(out, "  incq %%rcx\n");
+    mcode_emit(out, "  jmp .Lrt_vsum_tail\n");
+    mcode_emit(out, ".Lrt_vsum_done:\n");
+    mcode_emit(out, "  ret\n");
+}
+
+/* dst[k] = 0 for k < n, in r8 = dst, r11 = n. */
+static void emit_rt_zero(MCode *out, SimdLevel simd) {
+    static const char *const regs[] = {"%r8", "%r11"};
+    SimdOps v = simd_ops(simd == SIMD_AVX2 ? SIMD_SSE2 : simd);
+    mcode_emit(out, ".Lrt_zero:\n");
+    helper_args(out, regs, 2);
+    mcode_emit(out, "  xorl %%ecx, %%ecx\n");
+    if (v.width > 1) {
+        mcode_emit(out, "  movq %%r11, %%rdx\n");
+        mcode_emit(out, "  andq $-%d, %%rdx\n", v.width);
+        mcode_emit(out, "  jz .Lrt_zero_tail\n");
+        mcode_emit(out, "  pxor %%xmm0, %%xmm0\n");
+        mcode_emit(out, ".Lrt_zero_vec:\n");
+        mcode_emit(out, "  movdqu %%xmm0, (%%r8,%%rcx,8)\n");
+        mcode_emit(out, "  addq $%d, %%rcx\n", v.width);
+        mcode_emit(out, "  cmpq %%rdx, %%rcx\n");
+        mcode_emit(out, "  jb .Lrt_zero_vec\n");
+    }
+    mcode_emit(out, ".Lrt_zero_tail:\n");
+    mcode_emit(out, "  cmpq %%r11, %%rcx\n");
+    mcode_emit(out, "  jae .Lrt_zero_done\n");
+    mcode_emit(out, "  movq $0, (%%r8,%%rcx,8)\n");
+    mcode_emit(out, "  incq %%rcx\n");
+    mcode_emit(out, "  jmp .Lrt_zero_tail\n");
+    mcode_emit(out, ".Lrt_zero_done:\n");
+    mcode_emit(out, "  ret\n");
+}
+
+/* Linux x86-64 system call numbers and open(2) flags the runtime uses
+   when it runs without libc. */
+#define SYS_WRITE 1
+#define SYS_OPEN 2
+#define SYS_CLOSE 3
+#define SYS_IOCTL 16
+#define SYS_EXIT_GROUP 231
+#define OPEN_WRITE_CREATE_TRUNCATE 0x241
+#define TCGETS 0x5401
+
+/* Writes %r9 bytes from %r8 to file descriptor fd through the write system
+   call, retrying after interruptions and partial writes and giving up on
+   errors. Clobbers %rax, %rcx, %rdx, %rsi, %rdi and %r11. */
+static void emit_sys_write(MCode *out, const char *name, const char *fd) {
+    mcode_emit(out, ".Lrt_%s_loop:\n", name);
+    mcode_emit(out, "  testq %%r9, %%r9\n");
+    mcode_emit(out, "  jle .Lrt_%s_done\n", name);
+    mcode_emit(out, "  movl $%d, %%eax\n", SYS_WRITE);
+    mcode_emit(out, "  movq %s, %%rdi\n", fd);
+    mcode_emit(out, "  movq %%r8, %%rsi\n");
+    mcode_emit(out, "  movq %%r9, %%rdx\n");
+    mcode_emit(out, "  syscall\n");
+    mcode_emit(out, "  cmpq $-4, %%rax\n");
+    mcode_emit(out, "  je .Lrt_%s_loop\n", name);
+    mcode_emit(out, "  testq %%rax, %%rax\n");
+    mcode_emit(out, "  jle .Lrt_%s_done\n", name);
+    mcode_emit(out, "  addq %%rax, %%r8\n");
+    mcode_emit(out, "  subq %%rax, %%r9\n");
+    mcode_emit(out, "  jmp .Lrt_%s_loop\n", name);
+    mcode_emit(out, ".Lrt_%s_done:\n", name);
+}
+
+/* Reports a failed index check for the line in the first argument register
+   and exits with status 1. Reached by a jump from any stack depth, so it
+   realigns %rsp before calling into libc. Chants buffered so far go out
+   first, so the report follows them. */
+static void emit_rt_index_fail(MCode *out, int flush, int libc_free) {
+    mcode_emit(out, ".Lrt_index_fail:\n");
+    mcode_emit(out, "  andq $-16, %%rsp\n");
+    if (flush) {
+        mcode_emit(out, "  pushq %s\n", arg_reg64(0));
+        mcode_emit(out, "  subq $8, %%rsp\n");
+        mcode_emit(out, "  call .Lrt_flush\n");
+        mcode_emit(out, "  addq $8, %%rsp\n");
+        mcode_emit(out, "  popq %s\n", arg_reg64(0));
+    }
+    if (libc_free) {
+        mcode_emit(out, "  subq $32, %%rsp\n");
+        mcode_emit(out, "  movq %%rdi, %%r8\n");
+        mcode_emit(out, "  movq %%rsp, %%r9\n");
+        mcode_emit(out, "  call .Lrt_put_int\n");
+        mcode_emit(out, "  movq %%r9, %%rbx\n");
+        mcode_emit(out, "  leaq .LC_index_prefix(%%rip), %%r8\n");
+        mcode_emit(out, "  movq -8(%%r8), %%r9\n");
+        emit_sys_write(out, "index_prefix", "$2");
+        mcode_emit(out, "  movq %%rsp, %%r8\n");
+        mcode_emit(out, "  movq %%rbx, %%r9\n");
+        mcode_emit(out, "  subq %%rsp, %%r9\n");
+        emit_sys_write(out, "index_line", "$2");
+        mcode_emit(out, "  movl $1, %%edi\n");
+        mcode_emit(out, "  movl $%d, %%eax\n", SYS_EXIT_GROUP);
+        mcode_emit(out, "  syscall\n");
+        return;
+    }
 #ifdef _WIN32
-    if (in->type == TYPE_INT) {
-        fprintf(out, "  movq %%rax, %%rdx\n");
-        fprintf(out, "  leaq .LC_fmt_int(%%rip), %%rcx\n");
-        fprintf(out, "  xor %%eax, %%eax\n");
-        fprintf(out, "  subq $32, %%rsp\n");
-        fprintf(out, "  call %s\n", printf_symbol());
-        fprintf(out, "  addq $32, %%rsp\n");
-    } else if (in->type == TYPE_STRING) {
-        fprintf(out, "  movq %%rax, %%rdx\n");
-        fprintf(out, "  leaq .LC_fmt_str(%%rip), %%rcx\n");
-        fprintf(out, "  xor %%eax, %%eax\n");
-        fprintf(out, "  subq $32, %%rsp\n");
-        fprintf(out, "  call %s\n", printf_symbol());
-        fprintf(out, "  addq $32, %%rsp\n");
+    mcode_emit(out, "  subq $32, %%rsp\n");
+    mcode_emit(out, "  movq %%rcx, %%rdx\n");
+    mcode_emit(out, "  leaq .LC_index_fail(%%rip), %%rcx\n");
+    mcode_emit(out, "  xorl %%eax, %%eax\n");
+    mcode_emit(out, "  call printf\n");
+    mcode_emit(out, "  movl $1, %%ecx\n");
+    mcode_emit(out, "  call exit\n");
+#else
+    mcode_emit(out, "  movq %%rdi, %%rdx\n");
+    mcode_emit(out, "  movq stderr(%%rip), %%rdi\n");
+    mcode_emit(out, "  leaq .LC_index_fail(%%rip), %%rsi\n");
+    mcode_emit(out, "  xorl %%eax, %%eax\n");
+    mcode_emit(out, "  call fprintf@PLT\n");
+    mcode_emit(out, "  movl $1, %%edi\n");
+    mcode_emit(out, "  call exit@PLT\n");
+#endif
+}
+
+/* Writes %r9 bytes from %r8 to standard output, going on after partial
+   writes and giving up on errors. */
+static void emit_rt_write(MCode *out, int libc_free) {
+    mcode_emit(out, ".Lrt_write:\n");
+    if (libc_free) {
+        emit_sys_write(out, "write", "$1");
+        mcode_emit(out, "  ret\n");
+        return;
+    }
+    mcode_emit(out, "  pushq %%rbx\n");
+    mcode_emit(out, "  pushq %%r12\n");
+    mcode_emit(out, "  subq $%d, %%rsp\n", 8 + shadow_space());
+    mcode_emit(out, "  movq %%r8, %%rbx\n");
+    mcode_emit(out, "  movq %%r9, %%r12\n");
+    mcode_emit(out, ".Lrt_write_loop:\n");
+    mcode_emit(out, "  testq %%r12, %%r12\n");
+    mcode_emit(out, "  jle .Lrt_write_done\n");
+    mcode_emit(out, "  movq %%rbx, %s\n", arg_reg64(1));
+    mcode_emit(out, "  movq %%r12, %s\n", arg_reg64(2));
+    mcode_emit(out, "  movq $1, %s\n", arg_reg64(0));
+    mcode_emit(out, "  call %s\n", write_symbol());
+    mcode_emit(out, "  cltq\n");
+    mcode_emit(out, "  testq %%rax, %%rax\n");
+    mcode_emit(out, "  jle .Lrt_write_done\n");
+    mcode_emit(out, "  addq %%rax, %%rbx\n");
+    mcode_emit(out, "  subq %%rax, %%r12\n");
+    mcode_emit(out, "  jmp .Lrt_write_loop\n");
+    mcode_emit(out, ".Lrt_write_done:\n");
+    mcode_emit(out, "  addq $%d, %%rsp\n", 8 + shadow_space());
+    mcode_emit(out, "  popq %%r12\n");
+    mcode_emit(out, "  popq %%rbx\n");
+    mcode_emit(out, "  ret\n");
+}
+
+/* Empties the output buffer. Registered with atexit by main, or called by
+   _start without libc. */
+static void emit_rt_flush(MCode *out) {
+    mcode_emit(out, ".Lrt_flush:\n");
+    mcode_emit(out, "  leaq .Lrt_out_buf(%%rip), %%r8\n");
+    mcode_emit(out, "  movq .Lrt_out_len(%%rip), %%r9\n");
+    mcode_emit(out, "  movq $0, .Lrt_out_len(%%rip)\n");
+    mcode_emit(out, "  jmp .Lrt_write\n");
+}
+
+/* Sets .Lrt_out_tty when standard output is a terminal, so a program
+   watched interactively shows each line as it is chanted and keeps them
+   if it crashes later. Without libc the TCGETS ioctl, which only succeeds
+   on a terminal, stands in for isatty. Called once before main runs. */
+static void emit_rt_out_init(MCode *out, int libc_free) {
+    mcode_emit(out, ".Lrt_out_init:\n");
+    if (libc_free) {
+        mcode_emit(out, "  subq $72, %%rsp\n");
+        mcode_emit(out, "  movl $%d, %%eax\n", SYS_IOCTL);
+        mcode_emit(out, "  movl $1, %%edi\n");
+        mcode_emit(out, "  movl $%d, %%esi\n", TCGETS);
+        mcode_emit(out, "  movq %%rsp, %%rdx\n");
+        mcode_emit(out, "  syscall\n");
+        mcode_emit(out, "  addq $72, %%rsp\n");
+        mcode_emit(out, "  testq %%rax, %%rax\n");
+        mcode_emit(out, "  sete .Lrt_out_tty(%%rip)\n");
+        mcode_emit(out, "  ret\n");
+        return;
+    }
+    mcode_emit(out, "  subq $%d, %%rsp\n", 8 + shadow_space());
+    mcode_emit(out, "  movq $1, %s\n", arg_reg64(0));
+    mcode_emit(out, "  call %s\n", isatty_symbol());
+    mcode_emit(out, "  addq $%d, %%rsp\n", 8 + shadow_space());
+    mcode_emit(out, "  testl %%eax, %%eax\n");
+    mcode_emit(out, "  setne .Lrt_out_tty(%%rip)\n");
+    mcode_emit(out, "  ret\n");
+}
+
+/* Stores the buffer end in %r9 as the new length and returns, or flushes
+   in line buffered mode and when writing to a terminal. */
+static void emit_rt_chant_end(MCode *out, int line_buffered) {
+    mcode_emit(out, "  leaq .Lrt_out_buf(%%rip), %%rax\n");
+    mcode_emit(out, "  subq %%rax, %%r9\n");
+    mcode_emit(out, "  movq %%r9, .Lrt_out_len(%%rip)\n");
+    if (line_buffered) {
+        mcode_emit(out, "  jmp .Lrt_flush\n");
+        return;
+    }
+    mcode_emit(out, "  cmpb $0, .Lrt_out_tty(%%rip)\n");
+    mcode_emit(out, "  jne .Lrt_flush\n");
+    mcode_emit(out, "  ret\n");
+}
+
+/* Writes the ember in %r8 and a newline at %r9 and leaves %r9 past them.
+   The digit count comes from the highest set bit and a table of powers of
+   ten, so the digits go straight to their place, two at a time from the
+   right through a table of the pairs 00 to 99. Dividing by 100 is a
+   multiply by its reciprocal; negating the most negative ember leaves its
+   magnitude as an unsigned value. */
+static void emit_rt_put_int(MCode *out) {
+    mcode_emit(out, ".Lrt_put_int:\n");
+    mcode_emit(out, "  movq %%r8, %%rax\n");
+    mcode_emit(out, "  testq %%rax, %%rax\n");
+    mcode_emit(out, "  jns .Lrt_put_int_abs\n");
+    mcode_emit(out, "  movb $45, (%%r9)\n");
+    mcode_emit(out, "  incq %%r9\n");
+    mcode_emit(out, "  negq %%rax\n");
+    mcode_emit(out, ".Lrt_put_int_abs:\n");
+    mcode_emit(out, "  movq %%rax, %%r11\n");
+    mcode_emit(out, "  orq $1, %%r11\n");
+    mcode_emit(out, "  bsrq %%r11, %%rcx\n");
+    mcode_emit(out, "  incl %%ecx\n");
+    mcode_emit(out, "  imull $1233, %%ecx, %%ecx\n");
+    mcode_emit(out, "  shrl $12, %%ecx\n");
+    mcode_emit(out, "  leaq .LC_pow10(%%rip), %%r10\n");
+    mcode_emit(out, "  cmpq (%%r10,%%rcx,8), %%r11\n");
+    mcode_emit(out, "  sbbq $-1, %%rcx\n");
+    mcode_emit(out, "  addq %%rcx, %%r9\n");
+    mcode_emit(out, "  movq %%r9, %%r10\n");
+    mcode_emit(out, "  movb $10, (%%r9)\n");
+    mcode_emit(out, "  incq %%r9\n");
+    mcode_emit(out, "  leaq .LC_digit_pairs(%%rip), %%r11\n");
+    mcode_emit(out, "  cmpq $100, %%rax\n");
+    mcode_emit(out, "  jb .Lrt_put_int_last\n");
+    mcode_emit(out, ".Lrt_put_int_pair:\n");
+    mcode_emit(out, "  movq %%rax, %%rcx\n");
+    mcode_emit(out, "  shrq $2, %%rax\n");
+    mcode_emit(out, "  movabsq $2951479051793528259, %%rdx\n");
+    mcode_emit(out, "  mulq %%rdx\n");
+    mcode_emit(out, "  shrq $2, %%rdx\n");
+    mcode_emit(out, "  imulq $100, %%rdx, %%rax\n");
+    mcode_emit(out, "  subq %%rax, %%rcx\n");
+    mcode_emit(out, "  movzwl (%%r11,%%rcx,2), %%ecx\n");
+    mcode_emit(out, "  subq $2, %%r10\n");
+    mcode_emit(out, "  movw %%cx, (%%r10)\n");
+    mcode_emit(out, "  movq %%rdx, %%rax\n");
+    mcode_emit(out, "  cmpq $100, %%rax\n");
+    mcode_emit(out, "  jae .Lrt_put_int_pair\n");
+    mcode_emit(out, ".Lrt_put_int_last:\n");
+    mcode_emit(out, "  cmpq $10, %%rax\n");
+    mcode_emit(out, "  jb .Lrt_put_int_one\n");
+    mcode_emit(out, "  movzwl (%%r11,%%rax,2), %%ecx\n");
+    mcode_emit(out, "  movw %%cx, -2(%%r10)\n");
+    mcode_emit(out, "  ret\n");
+    mcode_emit(out, ".Lrt_put_int_one:\n");
+    mcode_emit(out, "  addb $48, %%al\n");
+    mcode_emit(out, "  movb %%al, -1(%%r10)\n");
+    mcode_emit(out, "  ret\n");
+}
+
+/* Appends the ember in the first argument register and a newline to the
+   buffer. */
+static void emit_rt_chant_int(MCode *out, int line_buffered) {
+    static const char *const regs[] = {"%r8"};
+    mcode_emit(out, ".Lrt_chant_int:\n");
+    helper_args(out, regs, 1);
+    mcode_emit(out, "  cmpq $%d, .Lrt_out_len(%%rip)\n", OUT_BUFFER_SIZE - INT_TEXT_MAX);
+    mcode_emit(out, "  jbe .Lrt_chant_int_room\n");
+    mcode_emit(out, "  pushq %%r8\n");
+    mcode_emit(out, "  call .Lrt_flush\n");
+    mcode_emit(out, "  popq %%r8\n");
+    mcode_emit(out, ".Lrt_chant_int_room:\n");
+    mcode_emit(out, "  leaq .Lrt_out_buf(%%rip), %%r9\n");
+    mcode_emit(out, "  addq .Lrt_out_len(%%rip), %%r9\n");
+    mcode_emit(out, "  call .Lrt_put_int\n");
+    emit_rt_chant_end(out, line_buffered);
+}
+
+/* A run of ember chants makes room for all of them once: begin takes the
+   bytes needed in the first argument register and returns the buffer end
+   in %r9, next appends one ember there and end stores the new length.
+   Only straight-line code that leaves %r9 alone runs in between. */
+static void emit_rt_chant_batch(MCode *out, int line_buffered) {
+    mcode_emit(out, ".Lrt_chant_begin:\n");
+    mcode_emit(out, "  movq %s, %%rax\n", arg_reg64(0));
+    mcode_emit(out, "  addq .Lrt_out_len(%%rip), %%rax\n");
+    mcode_emit(out, "  cmpq $%d, %%rax\n", OUT_BUFFER_SIZE);
+    mcode_emit(out, "  jbe .Lrt_chant_begin_room\n");
+    mcode_emit(out, "  subq $8, %%rsp\n");
+    mcode_emit(out, "  call .Lrt_flush\n");
+    mcode_emit(out, "  addq $8, %%rsp\n");
+    mcode_emit(out, ".Lrt_chant_begin_room:\n");
+    mcode_emit(out, "  leaq .Lrt_out_buf(%%rip), %%r9\n");
+    mcode_emit(out, "  addq .Lrt_out_len(%%rip), %%r9\n");
+    mcode_emit(out, "  ret\n");
+    mcode_emit(out, ".Lrt_chant_next:\n");
+    mcode_emit(out, "  movq %s, %%r8\n", arg_reg64(0));
+    mcode_emit(out, "  jmp .Lrt_put_int\n");
+    mcode_emit(out, ".Lrt_chant_end:\n");
+    emit_rt_chant_end(out, line_buffered);
+}
+
+/* Appends the text in the first argument register and a newline to the
+   buffer. Text longer than the buffer is written straight through after
+   flushing what came before it. An inline text is stored with a single
+   quad, which the room check leaves space for. */
+static void emit_rt_chant_str(MCode *out, int line_buffered, int inline_texts) {
+    static const char *const regs[] = {"%r8"};
+    mcode_emit(out, ".Lrt_chant_str:\n");
+    helper_args(out, regs, 1);
+    if (inline_texts) {
+        mcode_emit(out, "  testq $1, %%r8\n");
+        mcode_emit(out, "  jnz .Lrt_chant_str_inline\n");
+    }
+    mcode_emit(out, "  movq -8(%%r8), %%r10\n");
+    mcode_emit(out, "  movq .Lrt_out_len(%%rip), %%rax\n");
+    mcode_emit(out, "  leaq 1(%%rax,%%r10), %%rax\n");
+    mcode_emit(out, "  cmpq $%d, %%rax\n", OUT_BUFFER_SIZE);
+    mcode_emit(out, "  jbe .Lrt_chant_str_room\n");
+    mcode_emit(out, "  pushq %%r8\n");
+    mcode_emit(out, "  pushq %%r10\n");
+    mcode_emit(out, "  subq $8, %%rsp\n");
+    mcode_emit(out, "  call .Lrt_flush\n");
+    mcode_emit(out, "  movq 8(%%rsp), %%r9\n");
+    mcode_emit(out, "  movq 16(%%rsp), %%r8\n");
+    mcode_emit(out, "  cmpq $%d, %%r9\n", OUT_BUFFER_SIZE);
+    mcode_emit(out, "  jb .Lrt_chant_str_flushed\n");
+    mcode_emit(out, "  call .Lrt_write\n");
+    mcode_emit(out, "  movq $0, 8(%%rsp)\n");
+    mcode_emit(out, ".Lrt_chant_str_flushed:\n");
+    mcode_emit(out, "  movq 8(%%rsp), %%r10\n");
+    mcode_emit(out, "  movq 16(%%rsp), %%r8\n");
+    mcode_emit(out, "  addq $24, %%rsp\n");
+    mcode_emit(out, ".Lrt_chant_str_room:\n");
+    mcode_emit(out, "  leaq .Lrt_out_buf(%%rip), %%r9\n");
+    mcode_emit(out, "  addq .Lrt_out_len(%%rip), %%r9\n");
+    mcode_emit(out, "  xorl %%ecx, %%ecx\n");
+    mcode_emit(out, "  jmp .Lrt_chant_str_test\n");
+    mcode_emit(out, ".Lrt_chant_str_copy:\n");
+    mcode_emit(out, "  movb (%%r8,%%rcx), %%al\n");
+    mcode_emit(out, "  movb %%al, (%%r9,%%rcx)\n");
+    mcode_emit(out, "  incq %%rcx\n");
+    mcode_emit(out, ".Lrt_chant_str_test:\n");
+    mcode_emit(out, "  cmpq %%r10, %%rcx\n");
+    mcode_emit(out, "  jb .Lrt_chant_str_copy\n");
+    mcode_emit(out, "  addq %%r10, %%r9\n");
+    mcode_emit(out, "  movb $10, (%%r9)\n");
+    mcode_emit(out, "  incq %%r9\n");
+    emit_rt_chant_end(out, line_buffered);
+    if (!inline_texts) {
+        return;
+    }
+    mcode_emit(out, ".Lrt_chant_str_inline:\n");
+    mcode_emit(out, "  cmpq $%d, .Lrt_out_len(%%rip)\n", OUT_BUFFER_SIZE - 8);
+    mcode_emit(out, "  jbe .Lrt_chant_str_inline_room\n");
+    mcode_emit(out, "  pushq %%r8\n");
+    mcode_emit(out, "  call .Lrt_flush\n");
+    mcode_emit(out, "  popq %%r8\n");
+    mcode_emit(out, ".Lrt_chant_str_inline_room:\n");
+    mcode_emit(out, "  leaq .Lrt_out_buf(%%rip), %%r9\n");
+    mcode_emit(out, "  addq .Lrt_out_len(%%rip), %%r9\n");
+    mcode_emit(out, "  movq %%r8, %%rax\n");
+    mcode_emit(out, "  shrq $8, %%rax\n");
+    mcode_emit(out, "  movq %%rax, (%%r9)\n");
+    mcode_emit(out, "  shrl $1, %%r8d\n");
+    mcode_emit(out, "  andl $7, %%r8d\n");
+    mcode_emit(out, "  addq %%r8, %%r9\n");
+    mcode_emit(out, "  movb $10, (%%r9)\n");
+    mcode_emit(out, "  incq %%r9\n");
+    emit_rt_chant_end(out, line_buffered);
+}
+
+/* Linux mmap(2) arguments for fresh zeroed read-write memory. */
+#define SYS_MMAP 9
+#define PROT_READ_WRITE 3
+#define MAP_PRIVATE_ANONYMOUS 0x22
+
+/* Reports that no memory is left for a text and exits with status 1,
+   after the chants buffered so far. */
+static void emit_rt_text_oom(MCode *out, int flush, int libc_free) {
+    mcode_emit(out, ".Lrt_text_oom:\n");
+    mcode_emit(out, "  andq $-16, %%rsp\n");
+    if (flush) {
+        mcode_emit(out, "  call .Lrt_flush\n");
+    }
+    if (libc_free) {
+        mcode_emit(out, "  leaq .LC_text_oom(%%rip), %%r8\n");
+        mcode_emit(out, "  movq -8(%%r8), %%r9\n");
+        emit_sys_write(out, "text_oom", "$2");
+        mcode_emit(out, "  movl $1, %%edi\n");
+        mcode_emit(out, "  movl $%d, %%eax\n", SYS_EXIT_GROUP);
+        mcode_emit(out, "  syscall\n");
+        return;
+    }
+    mcode_emit(out, "  subq $%d, %%rsp\n", 16 + shadow_space());
+    mcode_emit(out, "  leaq .LC_text_oom(%%rip), %s\n", arg_reg64(1));
+    mcode_emit(out, "  movq -8(%s), %s\n", arg_reg64(1), arg_reg64(2));
+    mcode_emit(out, "  movl $2, %%eax\n");
+    mcode_emit(out, "  movq %%rax, %s\n", arg_reg64(0));
+    mcode_emit(out, "  call %s\n", write_symbol());
+    mcode_emit(out, "  movl $1, %%eax\n");
+    mcode_emit(out, "  movq %%rax, %s\n", arg_reg64(0));
+    mcode_emit(out, "  call %s\n", exit_symbol());
+}
+
+/* Returns in %rax the address of %rax bytes, a multiple of 8, from the
+   arena. When the current chunk is used up a new one replaces it; a
+   request larger than a chunk gets a block of its own. */
+static void emit_rt_text_alloc(MCode *out, int libc_free) {
+    mcode_emit(out, ".Lrt_text_alloc:\n");
+    mcode_emit(out, "  movq .Lrt_arena_next(%%rip), %%rdx\n");
+    mcode_emit(out, "  movq .Lrt_arena_end(%%rip), %%rcx\n");
+    mcode_emit(out, "  subq %%rdx, %%rcx\n");
+    mcode_emit(out, "  cmpq %%rax, %%rcx\n");
+    mcode_emit(out, "  jb .Lrt_text_alloc_chunk\n");
+    mcode_emit(out, "  addq %%rdx, %%rax\n");
+    mcode_emit(out, "  movq %%rax, .Lrt_arena_next(%%rip)\n");
+    mcode_emit(out, "  movq %%rdx, %%rax\n");
+    mcode_emit(out, "  ret\n");
+    mcode_emit(out, ".Lrt_text_alloc_chunk:\n");
+    mcode_emit(out, "  pushq %%rbx\n");
+    mcode_emit(out, "  pushq %%r12\n");
+    mcode_emit(out, "  subq $%d, %%rsp\n", 8 + shadow_space());
+    mcode_emit(out, "  movq %%rax, %%rbx\n");
+    mcode_emit(out, "  movq $%d, %%r12\n", ARENA_CHUNK_SIZE);
+    mcode_emit(out, "  cmpq %%r12, %%rbx\n");
+    mcode_emit(out, "  cmova %%rbx, %%r12\n");
+    if (libc_free) {
+        mcode_emit(out, "  movl $%d, %%eax\n", SYS_MMAP);
+        mcode_emit(out, "  xorl %%edi, %%edi\n");
+        mcode_emit(out, "  movq %%r12, %%rsi\n");
+        mcode_emit(out, "  movl $%d, %%edx\n", PROT_READ_WRITE);
+        mcode_emit(out, "  movl $%d, %%r10d\n", MAP_PRIVATE_ANONYMOUS);
+        mcode_emit(out, "  movq $-1, %%r8\n");
+        mcode_emit(out, "  xorl %%r9d, %%r9d\n");
+        mcode_emit(out, "  syscall\n");
+        mcode_emit(out, "  cmpq $-4096, %%rax\n");
+        mcode_emit(out, "  ja .Lrt_text_oom\n");
     } else {
-        fprintf(out, "  cmpq $0, %%rax\n");
-        fprintf(out, "  leaq .LC_bool_no(%%rip), %%rdx\n");
-        fprintf(out, "  leaq .LC_bool_yes(%%rip), %%r8\n");
-        fprintf(out, "  cmovne %%r8, %%rdx\n");
-        fprintf(out, "  leaq .LC_fmt_str(%%rip), %%rcx\n");
-        fprintf(out, "  xor %%eax, %%eax\n");
-        fprintf(out, "  subq $32, %%rsp\n");
-        fprintf(out, "  call %s\n", printf_symbol());
-        fprintf(out, "  addq $32, %%rsp\n");
+        mcode_emit(out, "  movq %%r12, %s\n", arg_reg64(0));
+        mcode_emit(out, "  call %s\n", malloc_symbol());
+        mcode_emit(out, "  testq %%rax, %%rax\n");
+        mcode_emit(out, "  jz .Lrt_text_oom\n");
+    }
+    mcode_emit(out, "  cmpq $%d, %%rbx\n", ARENA_CHUNK_SIZE);
+    mcode_emit(out, "  ja .Lrt_text_alloc_done\n");
+    mcode_emit(out, "  leaq (%%rax,%%r12), %%rcx\n");
+    mcode_emit(out, "  movq %%rcx, .Lrt_arena_end(%%rip)\n");
+    mcode_emit(out, "  leaq (%%rax,%%rbx), %%rcx\n");
+    mcode_emit(out, "  movq %%rcx, .Lrt_arena_next(%%rip)\n");
+    mcode_emit(out, ".Lrt_text_alloc_done:\n");
+    mcode_emit(out, "  addq $%d, %%rsp\n", 8 + shadow_space());
+    mcode_emit(out, "  popq %%r12\n");
+    mcode_emit(out, "  popq %%rbx\n");
+    mcode_emit(out, "  ret\n");
+}
+
+/* Copies %r10 bytes from %r9 to %r8 and leaves %r8 past them. */
+static void emit_rt_text_copy(MCode *out) {
+    mcode_emit(out, ".Lrt_text_copy:\n");
+    mcode_emit(out, "  xorl %%ecx, %%ecx\n");
+    mcode_emit(out, "  movq %%r10, %%rdx\n");
+    mcode_emit(out, "  andq $-8, %%rdx\n");
+    mcode_emit(out, "  jmp .Lrt_text_copy_quads\n");
+    mcode_emit(out, ".Lrt_text_copy_quad:\n");
+    mcode_emit(out, "  movq (%%r9,%%rcx), %%rax\n");
+    mcode_emit(out, "  movq %%rax, (%%r8,%%rcx)\n");
+    mcode_emit(out, "  addq $8, %%rcx\n");
+    mcode_emit(out, ".Lrt_text_copy_quads:\n");
+    mcode_emit(out, "  cmpq %%rdx, %%rcx\n");
+    mcode_emit(out, "  jb .Lrt_text_copy_quad\n");
+    mcode_emit(out, "  jmp .Lrt_text_copy_bytes\n");
+    mcode_emit(out, ".Lrt_text_copy_byte:\n");
+    mcode_emit(out, "  movb (%%r9,%%rcx), %%al\n");
+    mcode_emit(out, "  movb %%al, (%%r8,%%rcx)\n");
+    mcode_emit(out, "  incq %%rcx\n");
+    mcode_emit(out, ".Lrt_text_copy_bytes:\n");
+    mcode_emit(out, "  cmpq %%r10, %%rcx\n");
+    mcode_emit(out, "  jb .Lrt_text_copy_byte\n");
+    mcode_emit(out, "  addq %%r10, %%r8\n");
+    mcode_emit(out, "  ret\n");
+}
+
+/* Stack slots of .Lrt_text_concat: for each operand the value, the address
+   of its characters, its length and room to unpack an inline text, then
+   the result. */
+enum {
+    CONCAT_A = 0,
+    CONCAT_B = 32,
+    CONCAT_VALUE = 0,
+    CONCAT_CHARS = 8,
+    CONCAT_LEN = 16,
+    CONCAT_UNPACKED = 24,
+    CONCAT_RESULT = 64,
+    CONCAT_FRAME = 72
+};
+
+/* Fills the concat slots of the operand in reg. */
+static void emit_text_parts(MCode *out, const char *name, const char *reg, int base) {
+    mcode_emit(out, "  movq %s, %d(%%rsp)\n", reg, base + CONCAT_VALUE);
+    mcode_emit(out, "  testq $1, %s\n", reg);
+    mcode_emit(out, "  jnz .Lrt_%s_inline\n", name);
+    mcode_emit(out, "  movq %s, %d(%%rsp)\n", reg, base + CONCAT_CHARS);
+    mcode_emit(out, "  movq -8(%s), %%rax\n", reg);
+    mcode_emit(out, "  movq %%rax, %d(%%rsp)\n", base + CONCAT_LEN);
+    mcode_emit(out, "  jmp .Lrt_%s_done\n", name);
+    mcode_emit(out, ".Lrt_%s_inline:\n", name);
+    mcode_emit(out, "  movq %s, %%rax\n", reg);
+    mcode_emit(out, "  shrq $8, %%rax\n");
+    mcode_emit(out, "  movq %%rax, %d(%%rsp)\n", base + CONCAT_UNPACKED);
+    mcode_emit(out, "  leaq %d(%%rsp), %%rax\n", base + CONCAT_UNPACKED);
+    mcode_emit(out, "  movq %%rax, %d(%%rsp)\n", base + CONCAT_CHARS);
+    mcode_emit(out, "  movq %s, %%rax\n", reg);
+    mcode_emit(out, "  shrl $1, %%eax\n");
+    mcode_emit(out, "  andl $7, %%eax\n");
+    mcode_emit(out, "  movq %%rax, %d(%%rsp)\n", base + CONCAT_LEN);
+    mcode_emit(out, ".Lrt_%s_done:\n", name);
+}
+
+/* Puts the hash of a concat operand in %rdx and the base raised to its
+   length in %rax. An inline text has no header, so they are computed from
+   its few characters. */
+static void emit_text_hash(MCode *out, const char *name, int base) {
+    mcode_emit(out, "  movq %d(%%rsp), %%r10\n", base + CONCAT_CHARS);
+    mcode_emit(out, "  testq $1, %d(%%rsp)\n", base + CONCAT_VALUE);
+    mcode_emit(out, "  jnz .Lrt_%s_inline\n", name);
+    mcode_emit(out, "  movq -16(%%r10), %%rdx\n");
+    mcode_emit(out, "  movq -24(%%r10), %%rax\n");
+    mcode_emit(out, "  jmp .Lrt_%s_done\n", name);
+    mcode_emit(out, ".Lrt_%s_inline:\n", name);
+    mcode_emit(out, "  xorl %%edx, %%edx\n");
+    mcode_emit(out, "  movl $1, %%eax\n");
+    mcode_emit(out, "  movq %d(%%rsp), %%r11\n", base + CONCAT_LEN);
+    mcode_emit(out, "  addq %%r10, %%r11\n");
+    mcode_emit(out, "  movabsq $%llu, %%rcx\n", TEXT_HASH_BASE);
+    mcode_emit(out, "  jmp .Lrt_%s_test\n", name);
+    mcode_emit(out, ".Lrt_%s_step:\n", name);
+    mcode_emit(out, "  imulq %%rcx, %%rdx\n");
+    mcode_emit(out, "  imulq %%rcx, %%rax\n");
+    mcode_emit(out, "  movzbl (%%r10), %%r9d\n");
+    mcode_emit(out, "  addq %%r9, %%rdx\n");
+    mcode_emit(out, "  incq %%r10\n");
+    mcode_emit(out, ".Lrt_%s_test:\n", name);
+    mcode_emit(out, "  cmpq %%r11, %%r10\n");
+    mcode_emit(out, "  jb .Lrt_%s_step\n", name);
+    mcode_emit(out, ".Lrt_%s_done:\n", name);
+}
+
+/* Returns in %rax the text of the first argument followed by the second.
+   A short result is packed into the value without touching memory; a
+   longer one goes to the arena with a header combined from the operands'
+   hashes, so only the characters are copied. */
+static void emit_rt_text_concat(MCode *out) {
+    static const char *const regs[] = {"%r8", "%r9"};
+    mcode_emit(out, ".Lrt_text_concat:\n");
+    helper_args(out, regs, 2);
+    mcode_emit(out, "  subq $%d, %%rsp\n", CONCAT_FRAME);
+    emit_text_parts(out, "text_concat_a", "%r8", CONCAT_A);
+    emit_text_parts(out, "text_concat_b", "%r9", CONCAT_B);
+    mcode_emit(out, "  movq %d(%%rsp), %%r8\n", CONCAT_A + CONCAT_LEN);
+    mcode_emit(out, "  movq %d(%%rsp), %%r9\n", CONCAT_B + CONCAT_LEN);
+    mcode_emit(out, "  leaq (%%r8,%%r9), %%rdx\n");
+    mcode_emit(out, "  cmpq $%d, %%rdx\n", INLINE_TEXT_MAX);
+    mcode_emit(out, "  ja .Lrt_text_concat_long\n");
+    /* Characters of b above those of a, each masked to its length. */
+    mcode_emit(out, "  leal (,%%r9,8), %%ecx\n");
+    mcode_emit(out, "  movl $1, %%eax\n");
+    mcode_emit(out, "  shlq %%cl, %%rax\n");
+    mcode_emit(out, "  decq %%rax\n");
+    mcode_emit(out, "  movq %d(%%rsp), %%r10\n", CONCAT_B + CONCAT_CHARS);
+    mcode_emit(out, "  andq (%%r10), %%rax\n");
+    mcode_emit(out, "  leal (,%%r8,8), %%ecx\n");
+    mcode_emit(out, "  shlq %%cl, %%rax\n");
+    mcode_emit(out, "  movq %%rax, %%r11\n");
+    mcode_emit(out, "  movl $1, %%eax\n");
+    mcode_emit(out, "  shlq %%cl, %%rax\n");
+    mcode_emit(out, "  decq %%rax\n");
+    mcode_emit(out, "  movq %d(%%rsp), %%r10\n", CONCAT_A + CONCAT_CHARS);
+    mcode_emit(out, "  andq (%%r10), %%rax\n");
+    mcode_emit(out, "  orq %%r11, %%rax\n");
+    mcode_emit(out, "  shlq $8, %%rax\n");
+    mcode_emit(out, "  leaq 1(%%rax,%%rdx,2), %%rax\n");
+    mcode_emit(out, "  addq $%d, %%rsp\n", CONCAT_FRAME);
+    mcode_emit(out, "  ret\n");
+
+    mcode_emit(out, ".Lrt_text_concat_long:\n");
+    mcode_emit(out, "  leaq 31(%%rdx), %%rax\n");
+    mcode_emit(out, "  andq $-8, %%rax\n");
+    mcode_emit(out, "  call .Lrt_text_alloc\n");
+    mcode_emit(out, "  leaq 24(%%rax), %%r8\n");
+    mcode_emit(out, "  movq %%r8, %d(%%rsp)\n", CONCAT_RESULT);
+    emit_text_hash(out, "text_concat_hash_a", CONCAT_A);
+    mcode_emit(out, "  movq %%rdx, -16(%%r8)\n");
+    mcode_emit(out, "  movq %%rax, -24(%%r8)\n");
+    emit_text_hash(out, "text_concat_hash_b", CONCAT_B);
+    mcode_emit(out, "  movq -16(%%r8), %%rcx\n");
+    mcode_emit(out, "  imulq %%rax, %%rcx\n");
+    mcode_emit(out, "  addq %%rdx, %%rcx\n");
+    mcode_emit(out, "  movq %%rcx, -16(%%r8)\n");
+    mcode_emit(out, "  imulq -24(%%r8), %%rax\n");
+    mcode_emit(out, "  movq %%rax, -24(%%r8)\n");
+    mcode_emit(out, "  movq %d(%%rsp), %%rax\n", CONCAT_A + CONCAT_LEN);
+    mcode_emit(out, "  addq %d(%%rsp), %%rax\n", CONCAT_B + CONCAT_LEN);
+    mcode_emit(out, "  movq %%rax, -8(%%r8)\n");
+    mcode_emit(out, "  movq %d(%%rsp), %%r9\n", CONCAT_A + CONCAT_CHARS);
+    mcode_emit(out, "  movq %d(%%rsp), %%r10\n", CONCAT_A + CONCAT_LEN);
+    mcode_emit(out, "  call .Lrt_text_copy\n");
+    mcode_emit(out, "  movq %d(%%rsp), %%r9\n", CONCAT_B + CONCAT_CHARS);
+    mcode_emit(out, "  movq %d(%%rsp), %%r10\n", CONCAT_B + CONCAT_LEN);
+    mcode_emit(out, "  call .Lrt_text_copy\n");
+    mcode_emit(out, "  movq %d(%%rsp), %%rax\n", CONCAT_RESULT);
+    mcode_emit(out, "  addq $%d, %%rsp\n", CONCAT_FRAME);
+    mcode_emit(out, "  ret\n");
+}
+
+/* Returns in %rax whether the two argument texts have the same characters.
+   Equal values always do and two different inline texts never do. An
+   inline text equals a stored one of its length only if packing the stored
+   characters gives the same value. Two stored texts need equal lengths and
+   hashes before their characters are compared, so most unequal pairs are
+   told apart without reading them. */
+static void emit_rt_text_same(MCode *out) {
+    static const char *const regs[] = {"%r8", "%r9"};
+    mcode_emit(out, ".Lrt_text_same:\n");
+    helper_args(out, regs, 2);
+    mcode_emit(out, "  cmpq %%r9, %%r8\n");
+    mcode_emit(out, "  je .Lrt_text_same_yes\n");
+    mcode_emit(out, "  movq %%r8, %%rax\n");
+    mcode_emit(out, "  orq %%r9, %%rax\n");
+    mcode_emit(out, "  testq $1, %%rax\n");
+    mcode_emit(out, "  jz .Lrt_text_same_stored\n");
+    mcode_emit(out, "  movq %%r8, %%rax\n");
+    mcode_emit(out, "  andq %%r9, %%rax\n");
+    mcode_emit(out, "  testq $1, %%rax\n");
+    mcode_emit(out, "  jnz .Lrt_text_same_no\n");
+    mcode_emit(out, "  testq $1, %%r8\n");
+    mcode_emit(out, "  jz .Lrt_text_same_mixed\n");
+    mcode_emit(out, "  xchgq %%r8, %%r9\n");
+    mcode_emit(out, ".Lrt_text_same_mixed:\n");
+    mcode_emit(out, "  movq -8(%%r8), %%rdx\n");
+    mcode_emit(out, "  cmpq $%d, %%rdx\n", INLINE_TEXT_MAX);
+    mcode_emit(out, "  ja .Lrt_text_same_no\n");
+    mcode_emit(out, "  leal (,%%rdx,8), %%ecx\n");
+    mcode_emit(out, "  movl $1, %%eax\n");
+    mcode_emit(out, "  shlq %%cl, %%rax\n");
+    mcode_emit(out, "  decq %%rax\n");
+    mcode_emit(out, "  andq (%%r8), %%rax\n");
+    mcode_emit(out, "  shlq $8, %%rax\n");
+    mcode_emit(out, "  leaq 1(%%rax,%%rdx,2), %%rax\n");
+    mcode_emit(out, "  cmpq %%r9, %%rax\n");
+    mcode_emit(out, "  sete %%al\n");
+    mcode_emit(out, "  movzbl %%al, %%eax\n");
+    mcode_emit(out, "  ret\n");
+    mcode_emit(out, ".Lrt_text_same_stored:\n");
+    mcode_emit(out, "  movq -8(%%r8), %%rcx\n");
+    mcode_emit(out, "  cmpq -8(%%r9), %%rcx\n");
+    mcode_emit(out, "  jne .Lrt_text_same_no\n");
+    mcode_emit(out, "  movq -16(%%r8), %%rax\n");
+    mcode_emit(out, "  cmpq -16(%%r9), %%rax\n");
+    mcode_emit(out, "  jne .Lrt_text_same_no\n");
+    mcode_emit(out, "  xorl %%edx, %%edx\n");
+    mcode_emit(out, "  movq %%rcx, %%r10\n");
+    mcode_emit(out, "  andq $-8, %%r10\n");
+    mcode_emit(out, "  jmp .Lrt_text_same_quads\n");
+    mcode_emit(out, ".Lrt_text_same_quad:\n");
+    mcode_emit(out, "  movq (%%r8,%%rdx), %%rax\n");
+    mcode_emit(out, "  cmpq (%%r9,%%rdx), %%rax\n");
+    mcode_emit(out, "  jne .Lrt_text_same_no\n");
+    mcode_emit(out, "  addq $8, %%rdx\n");
+    mcode_emit(out, ".Lrt_text_same_quads:\n");
+    mcode_emit(out, "  cmpq %%r10, %%rdx\n");
+    mcode_emit(out, "  jb .Lrt_text_same_quad\n");
+    mcode_emit(out, "  jmp .Lrt_text_same_bytes\n");
+    mcode_emit(out, ".Lrt_text_same_byte:\n");
+    mcode_emit(out, "  movb (%%r8,%%rdx), %%al\n");
+    mcode_emit(out, "  cmpb (%%r9,%%rdx), %%al\n");
+    mcode_emit(out, "  jne .Lrt_text_same_no\n");
+    mcode_emit(out, "  incq %%rdx\n");
+    mcode_emit(out, ".Lrt_text_same_bytes:\n");
+    mcode_emit(out, "  cmpq %%rcx, %%rdx\n");
+    mcode_emit(out, "  jb .Lrt_text_same_byte\n");
+    mcode_emit(out, ".Lrt_text_same_yes:\n");
+    mcode_emit(out, "  movl $1, %%eax\n");
+    mcode_emit(out, "  ret\n");
+    mcode_emit(out, ".Lrt_text_same_no:\n");
+    mcode_emit(out, "  xorl %%eax, %%eax\n");
+    mcode_emit(out, "  ret\n");
+}
+
+/* Registered with atexit by an instrumented main, or called by _start
+   without libc: writes the profile header and counters to the profile
+   path. */
+static void emit_rt_profile_write(MCode *out, int counters, int libc_free) {
+    mcode_emit(out, ".Lrt_profile_write:\n");
+    mcode_emit(out, "  pushq %%rbx\n");
+    if (libc_free) {
+        mcode_emit(out, "  movl $%d, %%eax\n", SYS_OPEN);
+        mcode_emit(out, "  leaq .LC_profile_path(%%rip), %%rdi\n");
+        mcode_emit(out, "  movl $%d, %%esi\n", OPEN_WRITE_CREATE_TRUNCATE);
+        mcode_emit(out, "  movl $420, %%edx\n");
+        mcode_emit(out, "  syscall\n");
+        mcode_emit(out, "  testq %%rax, %%rax\n");
+        mcode_emit(out, "  js .Lrt_profile_done\n");
+        mcode_emit(out, "  movq %%rax, %%rbx\n");
+        mcode_emit(out, "  leaq .Lprof_data(%%rip), %%r8\n");
+        mcode_emit(out, "  movq $%d, %%r9\n", 8 * (counters + 3));
+        emit_sys_write(out, "profile_out", "%rbx");
+        mcode_emit(out, "  movl $%d, %%eax\n", SYS_CLOSE);
+        mcode_emit(out, "  movq %%rbx, %%rdi\n");
+        mcode_emit(out, "  syscall\n");
+        mcode_emit(out, ".Lrt_profile_done:\n");
+        mcode_emit(out, "  popq %%rbx\n");
+        mcode_emit(out, "  ret\n");
+        return;
     }
+#ifdef _WIN32
+    mcode_emit(out, "  subq $32, %%rsp\n");
+    mcode_emit(out, "  leaq .LC_profile_path(%%rip), %%rcx\n");
+    mcode_emit(out, "  leaq .LC_profile_mode(%%rip), %%rdx\n");
+    mcode_emit(out, "  call fopen\n");
+    mcode_emit(out, "  testq %%rax, %%rax\n");
+    mcode_emit(out, "  je .Lrt_profile_done\n");
+    mcode_emit(out, "  movq %%rax, %%rbx\n");
+    mcode_emit(out, "  leaq .Lprof_data(%%rip), %%rcx\n");
+    mcode_emit(out, "  movl $8, %%edx\n");
+    mcode_emit(out, "  movl $%d, %%r8d\n", counters + 3);
+    mcode_emit(out, "  movq %%rbx, %%r9\n");
+    mcode_emit(out, "  call fwrite\n");
+    mcode_emit(out, "  movq %%rbx, %%rcx\n");
+    mcode_emit(out, "  call fclose\n");
+    mcode_emit(out, ".Lrt_profile_done:\n");
+    mcode_emit(out, "  addq $32, %%rsp\n");
 #else
-    if (in->type == TYPE_INT) {
-        fprintf(out, "  movq %%rax, %%rsi\n");
-        fprintf(out, "  leaq .LC_fmt_int(%%rip), %%rdi\n");
-        fprintf(out, "  xor %%eax, %%eax\n");
-        fprintf(out, "  call %s\n", printf_symbol());
-    } else if (in->type == TYPE_STRING) {
-        fprintf(out, "  movq %%rax, %%rsi\n");
-        fprintf(out, "  leaq .LC_fmt_str(%%rip), %%rdi\n");
-        fprintf(out, "  xor %%eax, %%eax\n");
-        fprintf(out, "  call %s\n", printf_symbol());
+    mcode_emit(out, "  leaq .LC_profile_path(%%rip), %%rdi\n");
+    mcode_emit(out, "  leaq .LC_profile_mode(%%rip), %%rsi\n");
+    mcode_emit(out, "  call fopen@PLT\n");
+    mcode_emit(out, "  testq %%rax, %%rax\n");
+    mcode_emit(out, "  je .Lrt_profile_done\n");
+    mcode_emit(out, "  movq %%rax, %%rbx\n");
+    mcode_emit(out, "  leaq .Lprof_data(%%rip), %%rdi\n");
+    mcode_emit(out, "  movl $8, %%esi\n");
+    mcode_emit(out, "  movl $%d, %%edx\n", counters + 3);
+    mcode_emit(out, "  movq %%rbx, %%rcx\n");
+    mcode_emit(out, "  call fwrite@PLT\n");
+    mcode_emit(out, "  movq %%rbx, %%rdi\n");
+    mcode_emit(out, "  call fclose@PLT\n");
+    mcode_emit(out, ".Lrt_profile_done:\n");
+#endif
+    mcode_emit(out, "  popq %%rbx\n");
+    mcode_emit(out, "  ret\n");
+}
+
+/* Process entry without libc: runs main, then what libc would run at exit,
+   and exits with main's result. */
+static void emit_rt_start(MCode *out, const RuntimeUse *rt) {
+    mcode_emit(out, ".globl _start\n");
+    mcode_emit(out, "_start:\n");
+    mcode_emit(out, "  xorl %%ebp, %%ebp\n");
+    mcode_emit(out, "  andq $-16, %%rsp\n");
+    if (rt->chant && !rt->line_buffered) {
+        mcode_emit(out, "  call .Lrt_out_init\n");
+    }
+    mcode_emit(out, "  call main\n");
+    mcode_emit(out, "  movq %%rax, %%rbx\n");
+    if (rt->profile_path) {
+        mcode_emit(out, "  call .Lrt_profile_write\n");
+    }
+    if (rt->chant) {
+        mcode_emit(out, "  call .Lrt_flush\n");
+    }
+    mcode_emit(out, "  movl %%ebx, %%edi\n");
+    mcode_emit(out, "  movl $%d, %%eax\n", SYS_EXIT_GROUP);
+    mcode_emit(out, "  syscall\n");
+}
+
+static void emit_runtime(MCode *out, const RuntimeUse *rt, SimdLevel simd) {
+    if (!rt->chant && !rt->index_fail && !rt->zero && !rt->vadd && !rt->vsub && !rt->vsum && !rt->profile_path &&
+        !rt->libc_free && !rt->concat && !rt->text_same) {
+        return;
+    }
+    mcode_emit(out, ".text\n");
+    if (rt->libc_free) {
+        emit_rt_start(out, rt);
+    }
+    if (uses_put_int(rt)) {
+        emit_rt_put_int(out);
+    }
+    if (rt->chant) {
+        emit_rt_chant_int(out, rt->line_buffered);
+        emit_rt_chant_batch(out, rt->line_buffered);
+        emit_rt_chant_str(out, rt->line_buffered, rt->concat);
+        emit_rt_flush(out);
+        emit_rt_write(out, rt->libc_free);
+        if (!rt->line_buffered) {
+            emit_rt_out_init(out, rt->libc_free);
+        }
+    }
+    if (rt->index_fail) {
+        emit_rt_index_fail(out, rt->chant, rt->libc_free);
+    }
+    if (rt->concat) {
+        emit_rt_text_concat(out);
+        emit_rt_text_alloc(out, rt->libc_free);
+        emit_rt_text_copy(out);
+        emit_rt_text_oom(out, rt->chant, rt->libc_free);
+    }
+    if (rt->text_same) {
+        emit_rt_text_same(out);
+    }
+    if (rt->zero) {
+        emit_rt_zero(out, simd);
+    }
+    if (rt->vadd) {
+        emit_rt_map(out, "vadd", "addq", "paddq", simd);
+    }
+    if (rt->vsub) {
+        emit_rt_map(out, "vsub", "subq", "psubq", simd);
+    }
+    if (rt->vsum) {
+        emit_rt_sum(out, simd);
+    }
+    if (rt->profile_path) {
+        emit_rt_profile_write(out, rt->profile_counters, rt->libc_free);
+    }
+    if (rt->chant) {
+        mcode_emit(out, ".bss\n  .balign 64\n.Lrt_out_buf:\n  .zero %d\n", OUT_BUFFER_SIZE);
+        mcode_emit(out, "  .balign 8\n.Lrt_out_len:\n  .zero 8\n");
+        if (!rt->line_buffered) {
+            mcode_emit(out, ".Lrt_out_tty:\n  .zero 1\n");
+        }
+    }
+    if (rt->concat) {
+        mcode_emit(out, ".bss\n  .balign 8\n.Lrt_arena_next:\n  .zero 8\n.Lrt_arena_end:\n  .zero 8\n");
+    }
+    mcode_emit(out, "\n");
+}
+
+static void collect_runtime_use(const IRProgram *ir, RuntimeUse *rt) {
+    memset(rt, 0, sizeof(*rt));
+    rt->strings = xcalloc(ir->strings.len + 1, 1);
+    for (size_t f = 0; f < ir->functions.len; f++) {
+        const IRFunction *fn = &ir->functions.items[f];
+        for (size_t i = 0; i < fn->code.len; i++) {
+            const IRInstr *in = &fn->code.items[i];
+            switch (in->op) {
+                case IROP_CHANT:
+                    rt->chant = 1;
+                    break;
+                case IROP_BIN:
+                    rt->concat |= in->binop == IRBIN_CONCAT;
+                    rt->text_same |= in->binop == IRBIN_TEXT_SAME;
+                    break;
+                case IROP_IMM_STR:
+                    if (in->imm >= 0 && (size_t)in->imm < ir->strings.len) {
+                        rt->strings[in->imm] = 1;
+                    }
+                    break;
+                case IROP_CHECK_INDEX:
+                    rt->index_fail = 1;
+                    break;
+                case IROP_ARRAY_ZERO:
+                    rt->zero |= fn->vars.items[in->var_index].array_len > INLINE_ZERO_LIMIT;
+                    break;
+                case IROP_VEC_MAP:
+                    rt->vadd |= in->binop == IRBIN_ADD;
+                    rt->vsub |= in->binop == IRBIN_SUB;
+                    break;
+                case IROP_VEC_SUM:
+                    rt->vsum = 1;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+static int makes_calls(const IRFunction *fn) {
+    for (size_t i = 0; i < fn->code.len; i++) {
+        const IRInstr *in = &fn->code.items[i];
+        if (in->op == IROP_CALL || in->op == IROP_CHANT || in->op == IROP_VEC_MAP || in->op == IROP_VEC_SUM ||
+            calls_text_runtime(in) ||
+            (in->op == IROP_ARRAY_ZERO && fn->vars.items[in->var_index].array_len > INLINE_ZERO_LIMIT)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void kill_minstr(MCode *code, size_t i) {
+    if (code->items[i].kind == MINSTR_OP) {
+        code->items[i].kind = MINSTR_DEAD;
+    }
+}
+
+/* Once the body of a leaf glyph is final, drops the frame when nothing
+   addresses %rbp any more, or else on SysV the stack adjustment when all
+   slots fit in the red zone. code[start] is the glyph label followed by the
+   prologue. Returns how many instructions were removed. */
+static int shrink_frame(MCode *code, size_t start, int stack_size, const char *name, int report) {
+    size_t body = start + 3 + (stack_size > 0 ? 1 : 0);
+    size_t leave = 0;
+    int uses_frame = 0;
+    for (size_t i = body; i < code->len; i++) {
+        const MInstr *mi = &code->items[i];
+        if (mi->kind != MINSTR_OP) {
+            continue;
+        }
+        if (strcmp(mi->op, "call") == 0) {
+            return 0;
+        }
+        if (strcmp(mi->op, "leave") == 0) {
+            leave = i;
+            continue;
+        }
+        for (int a = 0; a < mi->argc; a++) {
+            if (strstr(mi->args[a], "%rsp")) {
+                return 0;
+            }
+            if (strstr(mi->args[a], "%rbp")) {
+                uses_frame = 1;
+            }
+        }
+    }
+    if (!uses_frame && leave > 0) {
+        for (size_t i = start + 1; i < body; i++) {
+            kill_minstr(code, i);
+        }
+        kill_minstr(code, leave);
+        mcode_compact(code);
+        if (report) {
+            printf("frame: %s: leaf frame omitted\n", name);
+        }
+        return (int)(body - start - 1) + 1;
+    }
+    if (stack_size > 0 && stack_size <= red_zone()) {
+        kill_minstr(code, start + 3);
+        mcode_compact(code);
+        if (report) {
+            printf("frame: %s: slots kept in the red zone\n", name);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* Memo glyphs keep their results in a .bss table of 2^MEMO_SLOTS_LOG2
+   entries followed by MEMO_PROBES - 1 spill entries, so probing never wraps
+   around. An entry holds a filled flag, the arguments and the result. */
+#define MEMO_SLOTS_LOG2 16
+#define MEMO_PROBES 4
+
+static int memo_entry_log2(const IRFunction *fn) {
+    return fn->param_count + 2 <= 4 ? 5 : 6;
+}
+
+/* Looks the arguments up in the glyph's table. A hit leaves through the
+   epilogue with the cached result; a miss records the entry to fill, the
+   first free one or else the home entry, in the slot at memo_base and
+   copies the arguments to the slots after it, as the body may reassign
+   parameters once tail calls became loops. */
+static void emit_memo_lookup(MCode *out, const IRFunction *fn, int memo_base, int end_label) {
+    int size = 1 << memo_entry_log2(fn);
+    int argc = fn->param_count;
+    int entry = stack_slot_offset(memo_base);
+    for (int i = 0; i < argc; i++) {
+        mcode_emit(out, "  movq %s, %d(%%rbp)\n", arg_reg64(i), stack_slot_offset(memo_base + 1 + i));
+    }
+    if (argc == 0) {
+        mcode_emit(out, "  xorl %%eax, %%eax\n");
     } else {
-        fprintf(out, "  cmpq $0, %%rax\n");
-        fprintf(out, "  leaq .LC_bool_no(%%rip), %%rsi\n");
-        fprintf(out, "  leaq .LC_bool_yes(%%rip), %%rdx\n");
-        fprintf(out, "  cmovne %%rdx, %%rsi\n");
-        fprintf(out, "  leaq .LC_fmt_str(%%rip), %%rdi\n");
-        fprintf(out, "  xor %%eax, %%eax\n");
-        fprintf(out, "  call %s\n", printf_symbol());
+        /* Fibonacci hashing: the top bits of the product pick the entry. */
+        mcode_emit(out, "  movabsq $-7046029254386353131, %%rcx\n");
+        for (int i = 0; i < argc; i++) {
+            mcode_emit(out, "  %s %d(%%rbp), %%rax\n", i == 0 ? "movq" : "xorq", stack_slot_offset(memo_base + 1 + i));
+            mcode_emit(out, "  imulq %%rcx, %%rax\n");
+        }
+        mcode_emit(out, "  shrq $%d, %%rax\n", 64 - MEMO_SLOTS_LOG2);
     }
-#endif
+    mcode_emit(out, "  shlq $%d, %%rax\n", memo_entry_log2(fn));
+    mcode_emit(out, "  leaq .Lmemo_%s(%%rip), %%rcx\n", fn->name);
+    mcode_emit(out, "  addq %%rcx, %%rax\n");
+    mcode_emit(out, "  movq %%rax, %d(%%rbp)\n", entry);
+    for (int k = 0; k < MEMO_PROBES; k++) {
+        int off = k * size;
+        int last = k == MEMO_PROBES - 1;
+        mcode_emit(out, "  cmpq $0, %d(%%rax)\n", off);
+        if (k == 0) {
+            mcode_emit(out, "  je .L_%s_memo_body\n", fn->name);
+        } else {
+            mcode_emit(out, "  je .L_%s_memo_free_%d\n", fn->name, k);
+        }
+        for (int i = 0; i < argc; i++) {
+            mcode_emit(out, "  movq %d(%%rbp), %%rcx\n", stack_slot_offset(memo_base + 1 + i));
+            mcode_emit(out, "  cmpq %%rcx, %d(%%rax)\n", off + 8 * (i + 1));
+            if (last) {
+                mcode_emit(out, "  jne .L_%s_memo_body\n", fn->name);
+            } else {
+                mcode_emit(out, "  jne .L_%s_memo_next_%d\n", fn->name, k);
+            }
+        }
+        mcode_emit(out, "  movq %d(%%rax), %%rax\n", off + 8 * (argc + 1));
+        mcode_emit(out, "  jmp .L_%s_%d\n", fn->name, end_label);
+        if (!last) {
+            mcode_emit(out, ".L_%s_memo_next_%d:\n", fn->name, k);
+        }
+    }
+    for (int k = 1; k < MEMO_PROBES; k++) {
+        mcode_emit(out, ".L_%s_memo_free_%d:\n", fn->name, k);
+        mcode_emit(out, "  addq $%d, %%rax\n", k * size);
+        mcode_emit(out, "  movq %%rax, %d(%%rbp)\n", entry);
+        mcode_emit(out, "  jmp .L_%s_memo_body\n", fn->name);
+    }
+    mcode_emit(out, ".L_%s_memo_body:\n", fn->name);
+}
+
+/* Fills the entry the lookup picked with the arguments and the result in
+   %rax. Returns go through here; cache hits skip it. */
+static void emit_memo_insert(MCode *out, const IRFunction *fn, int memo_base) {
+    mcode_emit(out, ".L_%s_memo_insert:\n", fn->name);
+    mcode_emit(out, "  movq %d(%%rbp), %%rdx\n", stack_slot_offset(memo_base));
+    for (int i = 0; i < fn->param_count; i++) {
+        mcode_emit(out, "  movq %d(%%rbp), %%rcx\n", stack_slot_offset(memo_base + 1 + i));
+        mcode_emit(out, "  movq %%rcx, %d(%%rdx)\n", 8 * (i + 1));
+    }
+    mcode_emit(out, "  movq %%rax, %d(%%rdx)\n", 8 * (fn->param_count + 1));
+    mcode_emit(out, "  movq $1, (%%rdx)\n");
+}
+
+static void emit_memo_table(MCode *out, const IRFunction *fn) {
+    long entries = (1L << MEMO_SLOTS_LOG2) + MEMO_PROBES - 1;
+    mcode_emit(out, ".bss\n  .balign 64\n.Lmemo_%s:\n", fn->name);
+    mcode_emit(out, "  .zero %ld\n", entries << memo_entry_log2(fn));
 }
 
-static void emit_function(FILE *out, const IRFunction *fn) {
+static void emit_epilogue(MCode *out, const IRFunction *fn, int end_label, int memo_base) {
+    if (fn->memo) {
+        emit_memo_insert(out, fn, memo_base);
+    }
+    mcode_emit(out, ".L_%s_%d:\n", fn->name, end_label);
+    mcode_emit(out, "  leave\n");
+    mcode_emit(out, "  ret\n");
+}
+
+static void emit_function(MCode *out, const IRFunction *fn, const CodegenOptions *opts, const RuntimeUse *rt,
+                          int *saved) {
     const char *fname = label_for_fn(fn->name);
-    fprintf(out, ".text\n");
-    fprintf(out, ".globl %s\n", fname);
-    fprintf(out, "%s:\n", fname);
+    mcode_emit(out, ".text\n");
+    mcode_emit(out, ".globl %s\n", fname);
+    size_t body_start = out->len;
+    mcode_emit(out, "%s:\n", fname);
 
-    int slots = (int)fn->vars.len + fn->temp_count;
-    int stack_size = slots * 8;
+    /* Slots sit right below %rbp, outgoing shadow space at the bottom. With
+       the frame a multiple of 16, %rsp stays aligned at every call. */
+    int slots = (int)fn->vars.len + fn->temp_count + (int)array_slots(fn);
+    int memo_base = slots;
+    if (fn->memo) {
+        slots += 1 + fn->param_count;
+    }
+    int is_main = strcmp(fn->name, "main") == 0;
+    int writes_profile = rt->profile_path && is_main && !rt->libc_free;
+    int flushes_output = rt->chant && is_main && !rt->libc_free;
+    int calls = makes_calls(fn) || writes_profile || flushes_output;
+    int stack_size = slots * 8 + (calls ? shadow_space() : 0);
     if (stack_size % 16 != 0) {
         stack_size += 8;
     }
+    if (calls && slots == 0 && shadow_space() > 0) {
+        (*saved)--;
+    }
 
-    fprintf(out, "  pushq %%rbp\n");
-    fprintf(out, "  movq %%rsp, %%rbp\n");
-    if (stack_size > 0) {
-        fprintf(out, "  subq $%d, %%rsp\n", stack_size);
+    mcode_emit(out, "  pushq %%rbp\n");
+    mcode_emit(out, "  movq %%rsp, %%rbp\n");
+    if (stack_probe_size() > 0 && stack_size >= stack_probe_size()) {
+        mcode_emit(out, "  movq $%d, %%rax\n", stack_size);
+        mcode_emit(out, "  call ___chkstk_ms\n");
+        mcode_emit(out, "  subq %%rax, %%rsp\n");
+    } else if (stack_size > 0) {
+        mcode_emit(out, "  subq $%d, %%rsp\n", stack_size);
     }
 
     if (fn->param_count > max_call_args()) {
@@ -254,32 +2030,83 @@ static void emit_function(FILE *out, const IRFunction *fn) {
     }
     for (int i = 0; i < fn->param_count; i++) {
         int off = stack_slot_offset(i);
-        fprintf(out, "  movq %s, %d(%%rbp)\n", arg_reg64(i), off);
+        mcode_emit(out, "  movq %s, %d(%%rbp)\n", arg_reg64(i), off);
+    }
+    if (writes_profile) {
+        mcode_emit(out, "  leaq .Lrt_profile_write(%%rip), %s\n", arg_reg64(0));
+        mcode_emit(out, "  call %s\n", atexit_symbol());
+    }
+    if (flushes_output) {
+        mcode_emit(out, "  leaq .Lrt_flush(%%rip), %s\n", arg_reg64(0));
+        mcode_emit(out, "  call %s\n", atexit_symbol());
+        if (!rt->line_buffered) {
+            mcode_emit(out, "  call .Lrt_out_init\n");
+        }
     }
 
     int end_label = 900000;
+    if (fn->memo) {
+        emit_memo_lookup(out, fn, memo_base, end_label);
+    }
+    TempInfo info;
+    collect_temp_info(fn, &info);
+
+    unsigned char *loop_head = xcalloc((size_t)fn->label_count + 1, 1);
+    if (opts->align_loops && fn->code.len > 0) {
+        CFG cfg;
+        cfg_build(fn, &cfg);
+        cfg_compute_dominators(&cfg);
+        cfg_find_loops(&cfg);
+        for (size_t l = 0; l < cfg.loop_count; l++) {
+            int label = cfg.blocks[cfg.loops[l].header].label;
+            if (label >= 0) {
+                loop_head[label] = 1;
+            }
+        }
+        free_cfg(&cfg);
+    }
 
+    int cold = 0;
+    int batching = 0;
+    size_t batch_end = 0;
     for (size_t i = 0; i < fn->code.len; i++) {
         IRInstr *in = &fn->code.items[i];
+        if (in->op == IROP_LABEL && opts->split_cold && in->label == fn->cold_label && !cold) {
+            IROp prev = i > 0 ? fn->code.items[i - 1].op : IROP_LABEL;
+            if (prev != IROP_JMP && prev != IROP_RET) {
+                mcode_emit(out, "  jmp .L_%s_%d\n", fn->name, in->label);
+            }
+            emit_epilogue(out, fn, end_label, memo_base);
+            mcode_emit(out, "%s\n", cold_section());
+            cold = 1;
+        }
+        size_t fused = emit_fused_branch(out, fn, i, &info);
+        if (fused > 0) {
+            i += fused - 1;
+            continue;
+        }
         switch (in->op) {
             case IROP_LABEL:
-                fprintf(out, ".L_%s_%d:\n", fn->name, in->label);
+                if (loop_head[in->label]) {
+                    mcode_emit(out, "  .p2align 4,,10\n");
+                }
+                mcode_emit(out, ".L_%s_%d:\n", fn->name, in->label);
                 break;
             case IROP_JMP:
-                fprintf(out, "  jmp .L_%s_%d\n", fn->name, in->label);
+                mcode_emit(out, "  jmp .L_%s_%d\n", fn->name, in->label);
                 break;
             case IROP_JMP_FALSE:
                 load_temp(out, fn, in->src1, "%rax");
-                fprintf(out, "  cmpq $0, %%rax\n");
-                fprintf(out, "  je .L_%s_%d\n", fn->name, in->label);
+                mcode_emit(out, "  cmpq $0, %%rax\n");
+                mcode_emit(out, "  je .L_%s_%d\n", fn->name, in->label);
                 break;
             case IROP_IMM_INT:
             case IROP_IMM_BOOL:
-                fprintf(out, "  movq $%ld, %%rax\n", in->imm);
+                mcode_emit(out, "  movq $%ld, %%rax\n", in->imm);
                 store_temp(out, fn, in->dst, "%rax");
                 break;
             case IROP_IMM_STR:
-                fprintf(out, "  leaq .LC_str_%ld(%%rip), %%rax\n", in->imm);
+                mcode_emit(out, "  leaq .LC_str_%ld(%%rip), %%rax\n", in->imm);
                 store_temp(out, fn, in->dst, "%rax");
                 break;
             case IROP_LOAD_VAR: {
@@ -295,10 +2122,10 @@ static void emit_function(FILE *out, const IRFunction *fn) {
                 break;
             }
             case IROP_BIN:
-                emit_binop(out, fn, in);
+                emit_binop(out, fn, in, &info);
                 break;
             case IROP_UN:
-                emit_unop(out, fn, in);
+                emit_unop(out, fn, in, i);
                 break;
             case IROP_CALL: {
                 if (in->argc > max_call_args()) {
@@ -307,44 +2134,135 @@ static void emit_function(FILE *out, const IRFunction *fn) {
                 for (int a = 0; a < in->argc; a++) {
                     load_temp(out, fn, in->args[a], arg_reg64(a));
                 }
-                fprintf(out, "  subq $32, %%rsp\n");
-                fprintf(out, "  call %s\n", label_for_fn(in->name));
-                fprintf(out, "  addq $32, %%rsp\n");
+                mcode_emit(out, "  call %s\n", label_for_fn(in->name));
+                *saved += 2;
                 if (in->dst >= 0) {
                     store_temp(out, fn, in->dst, "%rax");
                 }
                 break;
             }
             case IROP_CHANT:
-                emit_chant(out, fn, in);
+                if (in->type == TYPE_INT && !batching) {
+                    int count = 0;
+                    batch_end = chant_batch_end(fn, i, &count);
+                    batching = batch_end > i;
+                    if (batching) {
+                        mcode_emit(out, "  movq $%d, %s\n", count * INT_TEXT_MAX, arg_reg64(0));
+                        mcode_emit(out, "  call .Lrt_chant_begin\n");
+                    }
+                }
+                if (batching) {
+                    load_temp(out, fn, in->src1, arg_reg64(0));
+                    mcode_emit(out, "  call .Lrt_chant_next\n");
+                    if (i == batch_end) {
+                        mcode_emit(out, "  call .Lrt_chant_end\n");
+                        batching = 0;
+                    }
+                } else {
+                    emit_chant(out, fn, in);
+                }
+                *saved += 2;
                 break;
             case IROP_RET:
                 if (in->has_value) {
                     load_temp(out, fn, in->src1, "%rax");
                 } else {
-                    fprintf(out, "  movq $0, %%rax\n");
+                    mcode_emit(out, "  movq $0, %%rax\n");
+                }
+                if (fn->memo) {
+                    mcode_emit(out, "  jmp .L_%s_memo_insert\n", fn->name);
+                } else {
+                    mcode_emit(out, "  jmp .L_%s_%d\n", fn->name, end_label);
                 }
-                fprintf(out, "  jmp .L_%s_%d\n", fn->name, end_label);
+                break;
+            case IROP_PHI:
+                fatal("internal error: phi reached code generation in glyph '%s'", fn->name);
+                break;
+            case IROP_ARRAY_ZERO:
+            case IROP_ARRAY_LOAD:
+            case IROP_ARRAY_STORE:
+            case IROP_CHECK_INDEX:
+                emit_array_op(out, fn, in, end_label, i);
+                break;
+            case IROP_VEC_MAP:
+            case IROP_VEC_SUM:
+                emit_vector_op(out, fn, in, opts);
+                break;
+            case IROP_COUNT:
+                mcode_emit(out, "  incq .Lprof_counts+%ld(%%rip)\n", 8 * in->imm);
                 break;
         }
     }
 
-    fprintf(out, ".L_%s_%d:\n", fn->name, end_label);
-    fprintf(out, "  leave\n");
-    fprintf(out, "  ret\n\n");
-}
+    free_temp_info(&info);
+    free(loop_head);
 
-void codegen_emit_assembly(const IRProgram *ir, const char *asm_path) {
-    FILE *out = fopen(asm_path, "wb");
-    if (!out) {
-        fatal("cannot open assembly output '%s'", asm_path);
+    if (!cold) {
+        emit_epilogue(out, fn, end_label, memo_base);
     }
 
-    fprintf(out, ".extern printf\n\n");
-    emit_rodata(out, ir);
+    /* Failed index checks leave through here, out of the hot path. */
+    for (size_t i = 0; i < fn->code.len; i++) {
+        const IRInstr *in = &fn->code.items[i];
+        if (in->op == IROP_CHECK_INDEX) {
+            if (opts->split_cold && !cold) {
+                mcode_emit(out, "%s\n", cold_section());
+                cold = 1;
+            }
+            mcode_emit(out, ".L_%s_%d:\n", fn->name, end_label + 1 + (int)i);
+            mcode_emit(out, "  movq $%d, %s\n", in->line, arg_reg64(0));
+            mcode_emit(out, "  jmp .Lrt_index_fail\n");
+        }
+    }
+
+    if (opts->peephole) {
+        PeepholeStats stats;
+        memset(&stats, 0, sizeof(stats));
+        peephole_optimize(out, body_start, out->len, &stats);
+        mcode_compact(out);
+        if (opts->report && (stats.removed > 0 || stats.rewritten > 0)) {
+            printf("peephole: %s: %d instructions removed, %d rewritten\n", fn->name, stats.removed,
+                   stats.rewritten);
+        }
+    }
+    if (opts->omit_frames && !calls) {
+        *saved += shrink_frame(out, body_start, stack_size, fn->name, opts->report);
+    }
+    if (fn->memo) {
+        emit_memo_table(out, fn);
+    }
+    mcode_emit(out, "\n");
+}
+
+void codegen_emit_assembly(const IRProgram *ir, const char *asm_path, const CodegenOptions *opts) {
+    MCode code;
+    mcode_init(&code);
+    mcode_emit(&code, ".extern printf\n\n");
+    RuntimeUse rt;
+    collect_runtime_use(ir, &rt);
+    rt.line_buffered = opts->line_buffered;
+    rt.libc_free = opts->libc_free;
+    if (opts->profile_path) {
+        rt.profile_path = opts->profile_path;
+        rt.profile_counters = ir->profile_counters;
+    }
+    emit_rodata(&code, ir, &rt);
+    int saved = 0;
     for (size_t i = 0; i < ir->functions.len; i++) {
-        emit_function(out, &ir->functions.items[i]);
+        emit_function(&code, &ir->functions.items[i], opts, &rt, &saved);
+    }
+    emit_runtime(&code, &rt, opts->simd);
+    emit_stack_note(&code);
+    if (opts->report) {
+        printf("frame: %d instructions saved by call sequences and leaf frames\n", saved);
     }
 
+    FILE *out = fopen(asm_path, "wb");
+    if (!out) {
+        fatal("cannot open assembly output '%s'", asm_path);
+    }
+    mcode_write(out, &code);
     fclose(out);
+    free_mcode(&code);
+    free(rt.strings);
 }
@@ -3,6 +3,24 @@
 
 #include "ir.h"
 
-void codegen_emit_assembly(const IRProgram *ir, const char *asm_path);
+typedef enum SimdLevel {
+    SIMD_OFF,  /* array loops run one element at a time */
+    SIMD_SSE2, /* two elements per step, baseline on x86-64 */
+    SIMD_AVX2  /* four elements per step, needs a CPU with AVX2 */
+} SimdLevel;
+
+typedef struct CodegenOptions {
+    int peephole;    /* clean up the emitted instructions before writing them */
+    int omit_frames; /* drop unneeded frames of leaf glyphs */
+    int split_cold;  /* emit cold blocks and failed index checks to .text.unlikely */
+    int align_loops; /* align the targets of backward jumps */
+    SimdLevel simd;  /* instruction set for vector array loops */
+    int line_buffered; /* write chant output after every line instead of when the buffer fills */
+    int libc_free;     /* start with an own _start and use Linux system calls instead of libc */
+    int report;      /* print what the peephole pass and frame layout changed */
+    const char *profile_path; /* instrumented programs write their counters here at exit */
+} CodegenOptions;
+
+void codegen_emit_assembly(const IRProgram *ir, const char *asm_path, const CodegenOptions *opts);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,275 @@
+#include "gvn.h"
+
+#include "cfg.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* What an instruction computes, with operands already replaced by their
+   value numbers. Loads of variables that are stored somewhere in the glyph
+   also carry the block and a store counter, so they only match within one
+   block and never across a store. */
+typedef struct ValueKey {
+    IROp op;
+    int kind;
+    int a;
+    int b;
+    long imm;
+    const char *name;
+    int argc;
+    int args[6];
+    int version;
+    int block;
+} ValueKey;
+
+typedef struct ValueTable {
+    ValueKey *keys;
+    int *values;
+    unsigned char *used;
+    size_t cap;
+    size_t *undo;
+    size_t undo_len;
+} ValueTable;
+
+typedef struct GVN {
+    IRFunction *fn;
+    const IRProgram *ir;
+    CFG *cfg;
+    ValueTable table;
+    int *rename;
+    unsigned char *dead;
+    unsigned char *stored;
+    int *version;
+    int changed;
+} GVN;
+
+static unsigned long hash_key(const ValueKey *k) {
+    unsigned long h = (unsigned long)k->op * 31u + (unsigned long)k->kind;
+    h = h * 1000003u ^ (unsigned long)k->a;
+    h = h * 1000003u ^ (unsigned long)k->b;
+    h = h * 1000003u ^ (unsigned long)k->imm;
+    h = h * 1000003u ^ (unsigned long)k->version;
+    h = h * 1000003u ^ (unsigned long)k->block;
+    for (int i = 0; i < k->argc; i++) {
+        h = h * 1000003u ^ (unsigned long)k->args[i];
+    }
+    if (k->name) {
+        for (const char *c = k->name; *c; c++) {
+            h = h * 31u + (unsigned char)*c;
+        }
+    }
+    return h;
+}
+
+static int same_key(const ValueKey *x, const ValueKey *y) {
+    if (x->op != y->op || x->kind != y->kind || x->a != y->a || x->b != y->b || x->imm != y->imm ||
+        x->version != y->version || x->block != y->block || x->argc != y->argc) {
+        return 0;
+    }
+    for (int i = 0; i < x->argc; i++) {
+        if (x->args[i] != y->args[i]) {
+            return 0;
+        }
+    }
+    return (!x->name && !y->name) || (x->name && y->name && strcmp(x->name, y->name) == 0);
+}
+
+static size_t find_slot(const ValueTable *t, const ValueKey *k) {
+    size_t i = hash_key(k) & (t->cap - 1);
+    while (t->used[i] && !same_key(&t->keys[i], k)) {
+        i = (i + 1) & (t->cap - 1);
+    }
+    return i;
+}
+
+/* Puts commutative operands in a fixed order and rewrites mirrored
+   comparisons (more, atleast) as their less/atmost counterparts. */
+static void normalize_binop(IRBinOp *op, int *a, int *b) {
+    int swap = 0;
+    switch (*op) {
+        case IRBIN_ADD:
+        case IRBIN_MUL:
+        case IRBIN_BOTH:
+        case IRBIN_EITHER:
+        case IRBIN_SAME:
+        case IRBIN_DIFF:
+        case IRBIN_TEXT_SAME:
+            swap = *a > *b;
+            break;
+        case IRBIN_MORE:
+            *op = IRBIN_LESS;
+            swap = 1;
+            break;
+        case IRBIN_ATLEAST:
+            *op = IRBIN_ATMOST;
+            swap = 1;
+            break;
+        default:
+            break;
+    }
+    if (swap) {
+        int tmp = *a;
+        *a = *b;
+        *b = tmp;
+    }
+}
+
+static int resolve(const GVN *g, int t) {
+    return t >= 0 && g->rename[t] >= 0 ? g->rename[t] : t;
+}
+
+/* Fills *key for instructions whose result depends only on their operands.
+   Returns 0 for anything with side effects or a location-dependent result. */
+static int make_key(const GVN *g, const IRInstr *in, int block, ValueKey *key) {
+    memset(key, 0, sizeof(*key));
+    key->op = in->op;
+    key->block = -1;
+    switch (in->op) {
+        case IROP_IMM_INT:
+        case IROP_IMM_BOOL:
+        case IROP_IMM_STR:
+            key->imm = in->imm;
+            return 1;
+        case IROP_LOAD_VAR:
+            key->kind = in->var_index;
+            if (g->stored[in->var_index]) {
+                key->version = g->version[in->var_index];
+                key->block = block;
+            }
+            return 1;
+        case IROP_UN:
+            key->kind = (int)in->unop;
+            key->a = resolve(g, in->src1);
+            return 1;
+        case IROP_BIN: {
+            IRBinOp op = in->binop;
+            int a = resolve(g, in->src1);
+            int b = resolve(g, in->src2);
+            normalize_binop(&op, &a, &b);
+            key->kind = (int)op;
+            key->a = a;
+            key->b = b;
+            return 1;
+        }
+        case IROP_CALL: {
+            if (in->dst < 0) {
+                return 0;
+            }
+            const IRFunction *callee = ir_find_function(g->ir, in->name);
+            if (!callee || !callee->pure) {
+                return 0;
+            }
+            key->name = in->name;
+            key->argc = in->argc;
+            for (int i = 0; i < in->argc; i++) {
+                key->args[i] = resolve(g, in->args[i]);
+            }
+            return 1;
+        }
+        default:
+            return 0;
+    }
+}
+
+static void number_block(GVN *g, int b) {
+    IRFunction *fn = g->fn;
+    ValueTable *t = &g->table;
+    const CFGBlock *blk = &g->cfg->blocks[b];
+    size_t mark = t->undo_len;
+
+    for (size_t i = blk->start; i < blk->end; i++) {
+        IRInstr *in = &fn->code.items[i];
+        if (in->op == IROP_STORE_VAR) {
+            g->version[in->var_index]++;
+            continue;
+        }
+        ValueKey key;
+        if (!make_key(g, in, b, &key)) {
+            continue;
+        }
+        size_t slot = find_slot(t, &key);
+        if (t->used[slot]) {
+            g->rename[in->dst] = t->values[slot];
+            g->dead[i] = 1;
+            g->changed = 1;
+            continue;
+        }
+        t->used[slot] = 1;
+        t->keys[slot] = key;
+        t->values[slot] = in->dst;
+        t->undo[t->undo_len++] = slot;
+    }
+
+    for (size_t c = 0; c < blk->dom_children.len; c++) {
+        number_block(g, blk->dom_children.items[c]);
+    }
+
+    /* Linear probing tolerates deletion in reverse insertion order. */
+    while (t->undo_len > mark) {
+        t->used[t->undo[--t->undo_len]] = 0;
+    }
+}
+
+/* Dominator-scoped value numbering: an instruction that recomputes a value
+   already available in a dominating block reuses the earlier temp. Temps are
+   defined once, so this is sound with or without phis; calls take part only
+   when the callee is pure. */
+int gvn_function(IRFunction *fn, const IRProgram *ir) {
+    if (fn->code.len == 0) {
+        return 0;
+    }
+    CFG cfg;
+    cfg_build(fn, &cfg);
+    cfg_compute_dominators(&cfg);
+
+    GVN g;
+    memset(&g, 0, sizeof(g));
+    g.fn = fn;
+    g.ir = ir;
+    g.cfg = &cfg;
+    g.table.cap = 16;
+    while (g.table.cap < fn->code.len * 2) {
+        g.table.cap *= 2;
+    }
+    g.table.keys = xmalloc(g.table.cap * sizeof(ValueKey));
+    g.table.values = xmalloc(g.table.cap * sizeof(int));
+    g.table.used = xcalloc(g.table.cap, 1);
+    g.table.undo = xmalloc(fn->code.len * sizeof(size_t));
+    g.rename = xmalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1) * sizeof(int));
+    g.dead = xcalloc(fn->code.len + 1, 1);
+    g.stored = xcalloc(fn->vars.len + 1, 1);
+    g.version = xcalloc(fn->vars.len + 1, sizeof(int));
+    for (int t = 0; t < fn->temp_count; t++) {
+        g.rename[t] = -1;
+    }
+    for (size_t i = 0; i < fn->code.len; i++) {
+        if (fn->code.items[i].op == IROP_STORE_VAR) {
+            g.stored[fn->code.items[i].var_index] = 1;
+        }
+    }
+
+    number_block(&g, 0);
+
+    if (g.changed) {
+        for (size_t i = 0; i < fn->code.len; i++) {
+            int *refs[IR_MAX_USES];
+            int n = ir_instr_use_refs(&fn->code.items[i], refs);
+            for (int k = 0; k < n; k++) {
+                *refs[k] = resolve(&g, *refs[k]);
+            }
+        }
+        ir_remove_instrs(fn, g.dead);
+    }
+
+    free(g.version);
+    free(g.stored);
+    free(g.dead);
+    free(g.rename);
+    free(g.table.undo);
+    free(g.table.used);
+    free(g.table.values);
+    free(g.table.keys);
+    free_cfg(&cfg);
+    return g.changed;
+}
@@ -0,0 +1,8 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include "ir.h"
+
+int gvn_function(IRFunction *fn, const IRProgram *ir);
+
+#endif
@@ -0,0 +1,332 @@
+#include "inline.h"
+
+#include "cfg.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Callers stop absorbing callees once they reach this many instructions. */
+#define INLINE_CALLER_LIMIT 4000
+
+static int function_index(const IRProgram *ir, const char *name) {
+    const IRFunction *fn = ir_find_function(ir, name);
+    return fn ? (int)(fn - ir->functions.items) : -1;
+}
+
+typedef struct Tarjan {
+    const IRProgram *ir;
+    CallGraph *graph;
+    int *index;
+    int *low;
+    unsigned char *on_stack;
+    int *stack;
+    size_t sp;
+    int next_index;
+} Tarjan;
+
+static void strong_connect(Tarjan *t, int v) {
+    t->index[v] = t->low[v] = t->next_index++;
+    t->stack[t->sp++] = v;
+    t->on_stack[v] = 1;
+
+    const IRFunction *fn = &t->ir->functions.items[v];
+    for (size_t i = 0; i < fn->code.len; i++) {
+        if (fn->code.items[i].op != IROP_CALL) {
+            continue;
+        }
+        int w = function_index(t->ir, fn->code.items[i].name);
+        if (w < 0) {
+            continue;
+        }
+        if (w == v) {
+            t->graph->recursive[v] = 1;
+        }
+        if (t->index[w] < 0) {
+            strong_connect(t, w);
+            if (t->low[w] < t->low[v]) {
+                t->low[v] = t->low[w];
+            }
+        } else if (t->on_stack[w] && t->index[w] < t->low[v]) {
+            t->low[v] = t->index[w];
+        }
+    }
+
+    if (t->low[v] != t->index[v]) {
+        return;
+    }
+    size_t first = t->sp;
+    do {
+        first--;
+    } while (t->stack[first] != v);
+    for (size_t k = first; k < t->sp; k++) {
+        int w = t->stack[k];
+        t->on_stack[w] = 0;
+        if (t->sp - first > 1) {
+            t->graph->recursive[w] = 1;
+        }
+        t->graph->order[t->graph->len++] = w;
+    }
+    t->sp = first;
+}
+
+/* Tarjan's strongly connected components over the static call graph. SCCs
+   complete callees-first, which is the order the inliner wants. */
+void call_graph_build(const IRProgram *ir, CallGraph *out_graph) {
+    size_t n = ir->functions.len > 0 ? ir->functions.len : 1;
+    CallGraph g;
+    g.order = xmalloc(n * sizeof(int));
+    g.recursive = xcalloc(n, 1);
+    g.len = 0;
+
+    Tarjan t;
+    memset(&t, 0, sizeof(t));
+    t.ir = ir;
+    t.graph = &g;
+    t.index = xmalloc(n * sizeof(int));
+    t.low = xmalloc(n * sizeof(int));
+    t.on_stack = xcalloc(n, 1);
+    t.stack = xmalloc(n * sizeof(int));
+    for (size_t i = 0; i < ir->functions.len; i++) {
+        t.index[i] = -1;
+    }
+    for (size_t i = 0; i < ir->functions.len; i++) {
+        if (t.index[i] < 0) {
+            strong_connect(&t, (int)i);
+        }
+    }
+
+    free(t.stack);
+    free(t.on_stack);
+    free(t.low);
+    free(t.index);
+    *out_graph = g;
+}
+
+void free_call_graph(CallGraph *graph) {
+    free(graph->order);
+    free(graph->recursive);
+    memset(graph, 0, sizeof(*graph));
+}
+
+/* Rough size of the code an inlined body adds: labels are free, calls and
+   chants cost more than plain moves. */
+static int inline_cost(const IRFunction *fn) {
+    int cost = 0;
+    for (size_t i = 0; i < fn->code.len; i++) {
+        switch (fn->code.items[i].op) {
+            case IROP_LABEL:
+                break;
+            case IROP_CALL:
+                cost += 4;
+                break;
+            case IROP_CHANT:
+                cost += 3;
+                break;
+            default:
+                cost++;
+                break;
+        }
+    }
+    return cost;
+}
+
+static int inline_threshold(int level) {
+    return level >= 2 ? 40 : level == 1 ? 12 : 0;
+}
+
+/* Copies callee's body in place of call, with its temps, labels and
+   variables renumbered into the caller. Parameters the callee never assigns
+   are replaced by the argument temps directly; assigned ones get a fresh
+   variable initialised from the argument. Returns go through a result
+   variable and a jump to the end of the inlined body, which the cleanup
+   passes fold away when there is only one. */
+static void splice_call(IRFunction *fn, const IRFunction *callee, const IRInstr *call, IRInstrArray *code) {
+    int temp_base = fn->temp_count;
+    int label_base = fn->label_count;
+    int end_label = label_base + callee->label_count;
+    int var_base = (int)fn->vars.len;
+    fn->temp_count += callee->temp_count;
+    fn->label_count += callee->label_count + 1;
+    for (size_t v = 0; v < callee->vars.len; v++) {
+        char name[256];
+        snprintf(name, sizeof(name), "%s.%s", callee->name, callee->vars.items[v].name);
+        int var = ir_add_var(fn, name, callee->vars.items[v].type, 1, 0);
+        fn->vars.items[var].array_len = callee->vars.items[v].array_len;
+        fn->vars.items[var].rodata = callee->vars.items[v].rodata;
+    }
+    int result_var = -1;
+    if (call->dst >= 0) {
+        char name[256];
+        snprintf(name, sizeof(name), "%s.result", callee->name);
+        result_var = ir_add_var(fn, name, callee->return_type, 1, 0);
+    }
+
+    unsigned char *param_stored = xcalloc((size_t)callee->param_count + 1, 1);
+    int *rename = xmalloc((size_t)(callee->temp_count > 0 ? callee->temp_count : 1) * sizeof(int));
+    for (int t = 0; t < callee->temp_count; t++) {
+        rename[t] = temp_base + t;
+    }
+    for (size_t i = 0; i < callee->code.len; i++) {
+        const IRInstr *in = &callee->code.items[i];
+        if (in->op == IROP_STORE_VAR && in->var_index < callee->param_count) {
+            param_stored[in->var_index] = 1;
+        }
+    }
+    for (size_t i = 0; i < callee->code.len; i++) {
+        const IRInstr *in = &callee->code.items[i];
+        if (in->op == IROP_LOAD_VAR && in->var_index < callee->param_count && !param_stored[in->var_index]) {
+            rename[in->dst] = call->args[in->var_index];
+        }
+    }
+
+    for (int p = 0; p < callee->param_count; p++) {
+        if (param_stored[p]) {
+            IRInstr st = ir_make_instr(IROP_STORE_VAR);
+            st.line = call->line;
+            st.col = call->col;
+            st.var_index = var_base + p;
+            st.src1 = call->args[p];
+            ir_push_instr(code, st);
+        }
+    }
+
+    for (size_t i = 0; i < callee->code.len; i++) {
+        const IRInstr *src = &callee->code.items[i];
+        if (src->op == IROP_LOAD_VAR && src->var_index < callee->param_count && !param_stored[src->var_index]) {
+            continue;
+        }
+        IRInstr in = *src;
+        in.name = src->name ? xstrdup(src->name) : NULL;
+        int *refs[IR_MAX_USES];
+        int n = ir_instr_use_refs(&in, refs);
+        for (int k = 0; k < n; k++) {
+            *refs[k] = rename[*refs[k]];
+        }
+        if (ir_instr_def(&in) >= 0) {
+            in.dst = temp_base + in.dst;
+        }
+        int *vars[3];
+        int nvars = ir_instr_var_refs(&in, vars);
+        for (int k = 0; k < nvars; k++) {
+            *vars[k] += var_base;
+        }
+        switch (in.op) {
+            case IROP_LABEL:
+            case IROP_JMP:
+            case IROP_JMP_FALSE:
+                in.label += label_base;
+                break;
+            case IROP_RET: {
+                if (in.has_value && result_var >= 0) {
+                    IRInstr st = ir_make_instr(IROP_STORE_VAR);
+                    st.line = in.line;
+                    st.col = in.col;
+                    st.var_index = result_var;
+                    st.src1 = in.src1;
+                    ir_push_instr(code, st);
+                }
+                in = ir_make_instr(IROP_JMP);
+                in.line = src->line;
+                in.col = src->col;
+                in.label = end_label;
+                break;
+            }
+            default:
+                break;
+        }
+        ir_push_instr(code, in);
+    }
+
+    IRInstr end = ir_make_instr(IROP_LABEL);
+    end.label = end_label;
+    ir_push_instr(code, end);
+    if (call->dst >= 0) {
+        IRInstr ld = ir_make_instr(IROP_LOAD_VAR);
+        ld.line = call->line;
+        ld.col = call->col;
+        ld.dst = call->dst;
+        ld.var_index = result_var;
+        ir_push_instr(code, ld);
+    }
+
+    free(rename);
+    free(param_stored);
+}
+
+/* Inlines the calls in fn whose callee is small enough for the configured
+   aggressiveness; call sites inside loops get half again the budget. With a
+   profile, call sites running more than twice per entry of fn get twice the
+   budget instead and ones that never ran are left alone. Callees on a call
+   cycle and memo glyphs, whose calls go through their cache, are never
+   inlined. Returns 1 if anything was inlined. */
+int inline_calls(const IRProgram *ir, const CallGraph *graph, IRFunction *fn, const OptOptions *opts) {
+    int threshold = inline_threshold(opts->inline_level);
+    if (threshold == 0 || fn->code.len == 0) {
+        return 0;
+    }
+
+    CFG cfg;
+    cfg_build(fn, &cfg);
+    cfg_compute_dominators(&cfg);
+    cfg_find_loops(&cfg);
+
+    IRInstrArray code;
+    memset(&code, 0, sizeof(code));
+    int inlined = 0;
+    size_t block = 0;
+    for (size_t i = 0; i < fn->code.len; i++) {
+        IRInstr *in = &fn->code.items[i];
+        while (i >= cfg.blocks[block].end) {
+            block++;
+        }
+        if (in->op != IROP_CALL) {
+            ir_push_instr(&code, *in);
+            continue;
+        }
+
+        int idx = function_index(ir, in->name);
+        const IRFunction *callee = idx >= 0 ? &ir->functions.items[idx] : NULL;
+        int cost = callee ? inline_cost(callee) : 0;
+        int limit = threshold + (cfg.blocks[block].loop_depth > 0 ? threshold / 2 : 0);
+        if (fn->profiled) {
+            limit = in->prof[0] > 2 * fn->entry_count ? threshold * 2 : threshold;
+        }
+        char reason[96];
+        reason[0] = '\0';
+        if (!callee) {
+            snprintf(reason, sizeof(reason), "unknown glyph");
+        } else if (graph->recursive[idx]) {
+            snprintf(reason, sizeof(reason), "recursive");
+        } else if (callee->memo) {
+            snprintf(reason, sizeof(reason), "memo glyph");
+        } else if (fn->profiled && in->prof[0] == 0) {
+            snprintf(reason, sizeof(reason), "never ran in the profile");
+        } else if (cost > limit) {
+            snprintf(reason, sizeof(reason), "cost %d exceeds limit %d", cost, limit);
+        } else if (code.len + (fn->code.len - i) + callee->code.len > INLINE_CALLER_LIMIT) {
+            snprintf(reason, sizeof(reason), "caller too large");
+        }
+
+        if (opts->report) {
+            if (reason[0]) {
+                printf("inline: %s:%d: call to %s rejected: %s\n", fn->name, in->line, in->name, reason);
+            } else {
+                printf("inline: %s:%d: call to %s inlined (cost %d)\n", fn->name, in->line, in->name, cost);
+            }
+        }
+        if (reason[0]) {
+            ir_push_instr(&code, *in);
+            continue;
+        }
+        splice_call(fn, callee, in, &code);
+        ir_free_instr(in);
+        inlined = 1;
+    }
+
+    free(fn->code.items);
+    fn->code = code;
+    free_cfg(&cfg);
+    return inlined;
+}
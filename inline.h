@@ -0,0 +1,18 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include "ir.h"
+#include "opt.h"
+
+typedef struct CallGraph {
+    int *order;               /* functions with callees before callers */
+    unsigned char *recursive; /* function sits on a call cycle */
+    size_t len;
+} CallGraph;
+
+void call_graph_build(const IRProgram *ir, CallGraph *out_graph);
+void free_call_graph(CallGraph *graph);
+
+int inline_calls(const IRProgram *ir, const CallGraph *graph, IRFunction *fn, const OptOptions *opts);
+
+#endif
@@ -2,6 +2,8 @@
 
 #include "utils.h"
 
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -46,14 +48,26 @@ static void grow(void **items, size_t *cap, size_t elem_size) {
     *cap = next;
 }
 
-static void push_instr(IRFunction *fn, IRInstr ins) {
-    if (fn->code.len == fn->code.cap) {
-        grow((void **)&fn->code.items, &fn->code.cap, sizeof(IRInstr));
+void ir_push_instr(IRInstrArray *arr, IRInstr ins) {
+    if (arr->len == arr->cap) {
+        grow((void **)&arr->items, &arr->cap, sizeof(IRInstr));
     }
-    fn->code.items[fn->code.len++] = ins;
+    arr->items[arr->len++] = ins;
+}
+
+IRInstr ir_make_instr(IROp op) {
+    IRInstr ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = op;
+    ins.dst = -1;
+    return ins;
+}
+
+static void push_instr(IRFunction *fn, IRInstr ins) {
+    ir_push_instr(&fn->code, ins);
 }
 
-static int add_var(IRFunction *fn, const char *name, TypeKind type, int mutable_flag, int is_param) {
+int ir_add_var(IRFunction *fn, const char *name, TypeKind type, int mutable_flag, int is_param) {
     if (fn->vars.len == fn->vars.cap) {
         grow((void **)&fn->vars.items, &fn->vars.cap, sizeof(IRVar));
     }
@@ -63,6 +77,8 @@ static int add_var(IRFunction *fn, const char *name, TypeKind type, int mutable_
     v.type = type;
     v.mutable_flag = mutable_flag;
     v.is_param = is_param;
+    v.array_len = 0;
+    v.rodata = -1;
     fn->vars.items[fn->vars.len++] = v;
     return idx;
 }
@@ -107,9 +123,9 @@ static int new_label(IRBuilder *b) {
     return b->next_label++;
 }
 
-static int intern_string(IRProgram *p, const char *value) {
+int ir_intern_string(IRProgram *p, const char *value, size_t len) {
     for (size_t i = 0; i < p->strings.len; i++) {
-        if (strcmp(p->strings.items[i].value, value) == 0) {
+        if (p->strings.items[i].len == len && memcmp(p->strings.items[i].value, value, len) == 0) {
             return p->strings.items[i].id;
         }
     }
@@ -119,7 +135,8 @@ static int intern_string(IRProgram *p, const char *value) {
     int id = (int)p->strings.len;
     IRString s;
     s.id = id;
-    s.value = xstrdup(value);
+    s.value = xmemdup(value, len);
+    s.len = len;
     p->strings.items[p->strings.len++] = s;
     return id;
 }
@@ -182,6 +199,203 @@ static int gen_call(IRBuilder *b, const Expr *e) {
     return t;
 }
 
+static void emit_label(IRBuilder *b, int label) {
+    IRInstr ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = IROP_LABEL;
+    ins.label = label;
+    push_instr(b->fn, ins);
+}
+
+static void emit_jmp(IRBuilder *b, int label) {
+    IRInstr ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = IROP_JMP;
+    ins.label = label;
+    push_instr(b->fn, ins);
+}
+
+static void emit_jmp_false(IRBuilder *b, int cond_temp, int label) {
+    IRInstr ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = IROP_JMP_FALSE;
+    ins.src1 = cond_temp;
+    ins.label = label;
+    push_instr(b->fn, ins);
+}
+
+static int emit_imm_int(IRBuilder *b, long value, int line, int col) {
+    IRInstr ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = IROP_IMM_INT;
+    ins.line = line;
+    ins.col = col;
+    ins.dst = new_temp(b);
+    ins.imm = value;
+    push_instr(b->fn, ins);
+    return ins.dst;
+}
+
+static int emit_bin(IRBuilder *b, IRBinOp op, int left, int right, int line, int col) {
+    IRInstr ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = IROP_BIN;
+    ins.line = line;
+    ins.col = col;
+    ins.dst = new_temp(b);
+    ins.src1 = left;
+    ins.src2 = right;
+    ins.binop = op;
+    push_instr(b->fn, ins);
+    return ins.dst;
+}
+
+static void emit_check_index(IRBuilder *b, int index, long len, int line, int col) {
+    IRInstr ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = IROP_CHECK_INDEX;
+    ins.line = line;
+    ins.col = col;
+    ins.src1 = index;
+    ins.imm = len;
+    push_instr(b->fn, ins);
+}
+
+static void emit_array_store(IRBuilder *b, int var, int index, int value, int line, int col) {
+    IRInstr ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = IROP_ARRAY_STORE;
+    ins.line = line;
+    ins.col = col;
+    ins.var_index = var;
+    ins.src1 = index;
+    ins.src2 = value;
+    push_instr(b->fn, ins);
+}
+
+/* An immutable array of literals becomes rodata and needs no code. Other
+   arrays live in the frame and are filled element by element, or cleared
+   when created with ember[len]. */
+static int gen_array(IRBuilder *b, const char *name, const Expr *e, int mutable_flag, int line, int col) {
+    const ExprArray *items = &e->as.array.items;
+    long *values = xmalloc(items->len > 0 ? items->len * sizeof(long) : 1);
+    int constant = !mutable_flag && items->len > 0;
+    for (size_t i = 0; i < items->len && constant; i++) {
+        constant = expr_literal_int(items->items[i], &values[i]);
+    }
+
+    int *elems = xmalloc((items->len > 0 ? items->len : 1) * sizeof(int));
+    for (size_t i = 0; i < items->len && !constant; i++) {
+        elems[i] = gen_expr(b, items->items[i]);
+    }
+
+    int var = ir_add_var(b->fn, name, TYPE_ARRAY, mutable_flag, 0);
+    b->fn->vars.items[var].array_len = e->as.array.len;
+    if (constant) {
+        IRArrayDataArray *arrays = &b->out->arrays;
+        if (arrays->len == arrays->cap) {
+            grow((void **)&arrays->items, &arrays->cap, sizeof(IRArrayData));
+        }
+        IRArrayData data;
+        data.id = (int)arrays->len;
+        data.values = values;
+        data.len = e->as.array.len;
+        arrays->items[arrays->len++] = data;
+        b->fn->vars.items[var].rodata = data.id;
+        free(elems);
+        return var;
+    }
+    free(values);
+
+    if (items->len == 0) {
+        IRInstr ins;
+        memset(&ins, 0, sizeof(ins));
+        ins.op = IROP_ARRAY_ZERO;
+        ins.line = line;
+        ins.col = col;
+        ins.var_index = var;
+        push_instr(b->fn, ins);
+    }
+    for (size_t i = 0; i < items->len; i++) {
+        int index = emit_imm_int(b, (long)i, line, col);
+        emit_array_store(b, var, index, elems[i], line, col);
+    }
+    free(elems);
+    return var;
+}
+
+static int gen_index(IRBuilder *b, const Expr *e) {
+    int var = scope_find(b, e->as.index.name);
+    if (var < 0) {
+        fatal_at("<internal>", e->line, e->col, "unknown array in IR gen: %s", e->as.index.name);
+    }
+    int index = gen_expr(b, e->as.index.index);
+    emit_check_index(b, index, b->fn->vars.items[var].array_len, e->line, e->col);
+
+    IRInstr ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.op = IROP_ARRAY_LOAD;
+    ins.line = e->line;
+    ins.col = e->col;
+    ins.dst = new_temp(b);
+    ins.var_index = var;
+    ins.src1 = index;
+    push_instr(b->fn, ins);
+    return ins.dst;
+}
+
+/* Small expressions without calls or divisions: evaluating them cannot
+   chant, trap or recurse, so `both`/`either` may compute them eagerly. */
+static int expr_is_cheap(const Expr *e, int *budget) {
+    if (--*budget < 0) {
+        return 0;
+    }
+    switch (e->kind) {
+        case EXPR_INT:
+        case EXPR_BOOL:
+        case EXPR_STRING:
+        case EXPR_VAR:
+            return 1;
+        case EXPR_UNARY:
+            return expr_is_cheap(e->as.unary.operand, budget);
+        case EXPR_BINARY:
+            return e->as.binary.op != BIN_DIV && expr_is_cheap(e->as.binary.left, budget) &&
+                   expr_is_cheap(e->as.binary.right, budget);
+        default:
+            return 0;
+    }
+}
+
+/* `both`/`either` evaluate their right operand only when the left one does
+   not decide the result. The value flows through a hidden variable so the
+   result is still a single temp. */
+static int gen_short_circuit(IRBuilder *b, const Expr *e) {
+    int is_both = e->as.binary.op == BIN_BOTH;
+    int result = ir_add_var(b->fn, is_both ? "$both" : "$either", TYPE_BOOL, 1, 0);
+    int done = new_label(b);
+
+    int left = gen_expr(b, e->as.binary.left);
+    emit_store_var(b, result, left, e->line, e->col);
+    int cond = left;
+    if (!is_both) {
+        IRInstr flip;
+        memset(&flip, 0, sizeof(flip));
+        flip.op = IROP_UN;
+        flip.line = e->line;
+        flip.col = e->col;
+        flip.dst = new_temp(b);
+        flip.src1 = left;
+        flip.unop = IRUN_FLIP;
+        push_instr(b->fn, flip);
+        cond = flip.dst;
+    }
+    emit_jmp_false(b, cond, done);
+    int right = gen_expr(b, e->as.binary.right);
+    emit_store_var(b, result, right, e->line, e->col);
+    emit_label(b, done);
+    return emit_load_var(b, result, e->line, e->col);
+}
+
 static int gen_expr(IRBuilder *b, const Expr *e) {
     IRInstr ins;
     memset(&ins, 0, sizeof(ins));
@@ -213,7 +427,7 @@ static int gen_expr(IRBuilder *b, const Expr *e) {
             ins.line = e->line;
             ins.col = e->col;
             ins.dst = t;
-            ins.imm = intern_string(b->out, e->as.string_value);
+            ins.imm = ir_intern_string(b->out, e->as.string.value, e->as.string.len);
             push_instr(b->fn, ins);
             return t;
         }
@@ -226,6 +440,11 @@ static int gen_expr(IRBuilder *b, const Expr *e) {
         }
         case EXPR_CALL:
             return gen_call(b, e);
+        case EXPR_INDEX:
+            return gen_index(b, e);
+        case EXPR_ARRAY:
+            fatal_at("<internal>", e->line, e->col, "array value outside bind or morph in IR gen");
+            break;
         case EXPR_UNARY: {
             int src = gen_expr(b, e->as.unary.operand);
             int t = new_temp(b);
@@ -234,11 +453,16 @@ static int gen_expr(IRBuilder *b, const Expr *e) {
             ins.col = e->col;
             ins.dst = t;
             ins.src1 = src;
-            ins.unop = (e->as.unary.op == UN_NEG) ? IRUN_NEG : IRUN_FLIP;
+            ins.unop = e->as.unary.op == UN_NEG ? IRUN_NEG : e->as.unary.op == UN_SPAN ? IRUN_SPAN : IRUN_FLIP;
             push_instr(b->fn, ins);
             return t;
         }
         case EXPR_BINARY: {
+            int budget = 16;
+            if ((e->as.binary.op == BIN_BOTH || e->as.binary.op == BIN_EITHER) &&
+                !(expr_is_cheap(e->as.binary.left, &budget) && expr_is_cheap(e->as.binary.right, &budget))) {
+                return gen_short_circuit(b, e);
+            }
             int left = gen_expr(b, e->as.binary.left);
             int right = gen_expr(b, e->as.binary.right);
             int t = new_temp(b);
@@ -262,7 +486,23 @@ static int gen_expr(IRBuilder *b, const Expr *e) {
                 case BIN_ATMOST: ins.binop = IRBIN_ATMOST; break;
                 case BIN_ATLEAST: ins.binop = IRBIN_ATLEAST; break;
             }
+            if (e->as.binary.left->inferred_type == TYPE_STRING) {
+                /* Texts compare by contents; diff is the flip of same. */
+                ins.binop = ins.binop == IRBIN_ADD ? IRBIN_CONCAT : IRBIN_TEXT_SAME;
+            }
             push_instr(b->fn, ins);
+            if (ins.binop == IRBIN_TEXT_SAME && e->as.binary.op == BIN_DIFF) {
+                IRInstr flip;
+                memset(&flip, 0, sizeof(flip));
+                flip.op = IROP_UN;
+                flip.line = e->line;
+                flip.col = e->col;
+                flip.dst = new_temp(b);
+                flip.src1 = t;
+                flip.unop = IRUN_FLIP;
+                push_instr(b->fn, flip);
+                return flip.dst;
+            }
             return t;
         }
     }
@@ -270,57 +510,168 @@ static int gen_expr(IRBuilder *b, const Expr *e) {
     return -1;
 }
 
-static void emit_label(IRBuilder *b, int label) {
-    IRInstr ins;
-    memset(&ins, 0, sizeof(ins));
-    ins.op = IROP_LABEL;
-    ins.label = label;
-    push_instr(b->fn, ins);
+static void gen_stmt(IRBuilder *b, const Stmt *s);
+
+static void gen_block(IRBuilder *b, const Block *block) {
+    for (size_t i = 0; i < block->stmts.len; i++) {
+        gen_stmt(b, block->stmts.items[i]);
+    }
 }
 
-static void emit_jmp(IRBuilder *b, int label) {
-    IRInstr ins;
-    memset(&ins, 0, sizeof(ins));
-    ins.op = IROP_JMP;
-    ins.label = label;
-    push_instr(b->fn, ins);
+/* Variable an expression names, or -1. */
+static int var_of(IRBuilder *b, const Expr *e) {
+    return e->kind == EXPR_VAR ? scope_find(b, e->as.var_name) : -1;
 }
 
-static void emit_jmp_false(IRBuilder *b, int cond_temp, int label) {
-    IRInstr ins;
-    memset(&ins, 0, sizeof(ins));
-    ins.op = IROP_JMP_FALSE;
-    ins.src1 = cond_temp;
-    ins.label = label;
-    push_instr(b->fn, ins);
+/* Array read as arr[i] for the given index variable, or -1. */
+static int indexed_by(IRBuilder *b, const Expr *e, int index_var) {
+    if (e->kind != EXPR_INDEX || var_of(b, e->as.index.index) != index_var) {
+        return -1;
+    }
+    return scope_find(b, e->as.index.name);
 }
 
-static void gen_stmt(IRBuilder *b, const Stmt *s);
+/* Recognises the counted cycles
+       cycle i less n                 cycle i less n
+           shift c[i] = a[i] + b[i]       shift s = s + a[i]
+           shift i = i + 1                shift i = i + 1
+       seal                           seal
+   (also with '-' in the elementwise form) and emits them as one vector
+   operation over [i, n) that codegen lowers to SIMD. The range is checked
+   against every array up front: a scalar loop would stop at the first bad
+   index with the same error, and the elements it wrote before that are
+   never observed. Returns 0 when the cycle has another shape. */
+static int gen_vector_cycle(IRBuilder *b, const Stmt *s) {
+    const Expr *cond = s->as.cycle.cond;
+    const StmtArray *body = &s->as.cycle.body->stmts;
+    if (cond->kind != EXPR_BINARY || cond->as.binary.op != BIN_LESS || body->len != 2) {
+        return 0;
+    }
+    int i = var_of(b, cond->as.binary.left);
+    const Expr *limit = cond->as.binary.right;
+    int n = var_of(b, limit);
+    if (i < 0 || n == i || b->fn->vars.items[i].type != TYPE_INT || (limit->kind != EXPR_INT && n < 0)) {
+        return 0;
+    }
+    const Stmt *step = body->items[1];
+    const Expr *next = step->kind == STMT_SHIFT ? step->as.shift.value : NULL;
+    if (!next || step->as.shift.index || scope_find(b, step->as.shift.name) != i || next->kind != EXPR_BINARY ||
+        next->as.binary.op != BIN_ADD || var_of(b, next->as.binary.left) != i ||
+        next->as.binary.right->kind != EXPR_INT || next->as.binary.right->as.int_value != 1) {
+        return 0;
+    }
 
-static void gen_block(IRBuilder *b, const Block *block) {
-    for (size_t i = 0; i < block->stmts.len; i++) {
-        gen_stmt(b, block->stmts.items[i]);
+    const Stmt *kernel = body->items[0];
+    const Expr *value = kernel->kind == STMT_SHIFT ? kernel->as.shift.value : NULL;
+    if (!value || value->kind != EXPR_BINARY) {
+        return 0;
+    }
+    int target = scope_find(b, kernel->as.shift.name);
+    int arrays[3] = {-1, -1, -1};
+    int sum = -1;
+    if (kernel->as.shift.index) {
+        if (var_of(b, kernel->as.shift.index) != i ||
+            (value->as.binary.op != BIN_ADD && value->as.binary.op != BIN_SUB)) {
+            return 0;
+        }
+        arrays[0] = target;
+        arrays[1] = indexed_by(b, value->as.binary.left, i);
+        arrays[2] = indexed_by(b, value->as.binary.right, i);
+        if (arrays[1] < 0 || arrays[2] < 0) {
+            return 0;
+        }
+    } else {
+        if (value->as.binary.op != BIN_ADD || target == i || target == n ||
+            b->fn->vars.items[target].type != TYPE_INT) {
+            return 0;
+        }
+        const Expr *other = var_of(b, value->as.binary.left) == target ? value->as.binary.right
+                          : var_of(b, value->as.binary.right) == target ? value->as.binary.left
+                                                                       : NULL;
+        arrays[1] = other ? indexed_by(b, other, i) : -1;
+        if (arrays[1] < 0) {
+            return 0;
+        }
+        sum = target;
     }
+
+    int line = kernel->line;
+    int col = kernel->col;
+    int skip = new_label(b);
+    int lo = emit_load_var(b, i, cond->line, cond->col);
+    int hi = gen_expr(b, limit);
+    emit_jmp_false(b, emit_bin(b, IRBIN_LESS, lo, hi, cond->line, cond->col), skip);
+    int last = emit_bin(b, IRBIN_SUB, hi, emit_imm_int(b, 1, line, col), line, col);
+    for (int k = 0; k < 3; k++) {
+        if (arrays[k] < 0 || (k > 0 && arrays[k] == arrays[0]) || (k > 1 && arrays[k] == arrays[1])) {
+            continue;
+        }
+        long len = b->fn->vars.items[arrays[k]].array_len;
+        emit_check_index(b, lo, len, line, col);
+        emit_check_index(b, last, len, line, col);
+    }
+
+    IRInstr ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.line = line;
+    ins.col = col;
+    ins.src1 = lo;
+    ins.src2 = hi;
+    ins.arrays[0] = arrays[1];
+    ins.arrays[1] = arrays[2];
+    if (sum < 0) {
+        ins.op = IROP_VEC_MAP;
+        ins.var_index = arrays[0];
+        ins.binop = value->as.binary.op == BIN_ADD ? IRBIN_ADD : IRBIN_SUB;
+        push_instr(b->fn, ins);
+    } else {
+        ins.op = IROP_VEC_SUM;
+        ins.dst = new_temp(b);
+        ins.arrays[1] = -1;
+        push_instr(b->fn, ins);
+        int acc = emit_load_var(b, sum, line, col);
+        emit_store_var(b, sum, emit_bin(b, IRBIN_ADD, acc, ins.dst, line, col), line, col);
+    }
+    emit_store_var(b, i, hi, step->line, step->col);
+    emit_label(b, skip);
+    return 1;
 }
 
 static void gen_stmt(IRBuilder *b, const Stmt *s) {
     switch (s->kind) {
         case STMT_BIND: {
+            if (s->as.bind.value->kind == EXPR_ARRAY) {
+                int var = gen_array(b, s->as.bind.name, s->as.bind.value, 0, s->line, s->col);
+                scope_push(b, s->as.bind.name, var);
+                break;
+            }
             int src = gen_expr(b, s->as.bind.value);
-            int var = add_var(b->fn, s->as.bind.name, s->as.bind.value->inferred_type, 0, 0);
+            int var = ir_add_var(b->fn, s->as.bind.name, s->as.bind.value->inferred_type, 0, 0);
             scope_push(b, s->as.bind.name, var);
             emit_store_var(b, var, src, s->line, s->col);
             break;
         }
         case STMT_MORPH: {
+            if (s->as.morph.value->kind == EXPR_ARRAY) {
+                int var = gen_array(b, s->as.morph.name, s->as.morph.value, 1, s->line, s->col);
+                scope_push(b, s->as.morph.name, var);
+                break;
+            }
             int src = gen_expr(b, s->as.morph.value);
-            int var = add_var(b->fn, s->as.morph.name, s->as.morph.value->inferred_type, 1, 0);
+            int var = ir_add_var(b->fn, s->as.morph.name, s->as.morph.value->inferred_type, 1, 0);
             scope_push(b, s->as.morph.name, var);
             emit_store_var(b, var, src, s->line, s->col);
             break;
         }
         case STMT_SHIFT: {
             int var = scope_find(b, s->as.shift.name);
+            if (s->as.shift.index) {
+                int index = gen_expr(b, s->as.shift.index);
+                emit_check_index(b, index, b->fn->vars.items[var].array_len, s->line, s->col);
+                int src = gen_expr(b, s->as.shift.value);
+                emit_array_store(b, var, index, src, s->line, s->col);
+                break;
+            }
             int src = gen_expr(b, s->as.shift.value);
             emit_store_var(b, var, src, s->line, s->col);
             break;
@@ -346,6 +697,9 @@ static void gen_stmt(IRBuilder *b, const Stmt *s) {
             break;
         }
         case STMT_CYCLE: {
+            if (gen_vector_cycle(b, s)) {
+                break;
+            }
             int l_head = new_label(b);
             int l_end = new_label(b);
             if (b->loop_depth >= 128) {
@@ -417,6 +771,8 @@ static void gen_function(IRBuilder *b, const Function *f) {
     memset(&fn, 0, sizeof(fn));
     fn.name = xstrdup(f->name);
     fn.return_type = f->return_type;
+    fn.cold_label = -1;
+    fn.memo = f->memo;
 
     b->fn = &fn;
     b->scope.len = 0;
@@ -428,7 +784,7 @@ static void gen_function(IRBuilder *b, const Function *f) {
     begin_scope(b);
     for (size_t i = 0; i < f->params.len; i++) {
         Param p = f->params.items[i];
-        int vi = add_var(&fn, p.name, p.type, 0, 1);
+        int vi = ir_add_var(&fn, p.name, p.type, 0, 1);
         scope_push(b, p.name, vi);
     }
     fn.param_count = (int)f->params.len;
@@ -445,6 +801,7 @@ static void gen_function(IRBuilder *b, const Function *f) {
     }
 
     fn.temp_count = b->next_temp;
+    fn.label_count = b->next_label;
 
     if (b->out->functions.len == b->out->functions.cap) {
         grow((void **)&b->out->functions.items, &b->out->functions.cap, sizeof(IRFunction));
@@ -477,7 +834,7 @@ void free_ir_program(IRProgram *ir) {
             free(fn->vars.items[v].name);
         }
         for (size_t j = 0; j < fn->code.len; j++) {
-            free(fn->code.items[j].name);
+            ir_free_instr(&fn->code.items[j]);
         }
         free(fn->vars.items);
         free(fn->code.items);
@@ -485,7 +842,362 @@ void free_ir_program(IRProgram *ir) {
     for (size_t i = 0; i < ir->strings.len; i++) {
         free(ir->strings.items[i].value);
     }
+    for (size_t i = 0; i < ir->arrays.len; i++) {
+        free(ir->arrays.items[i].values);
+    }
     free(ir->functions.items);
     free(ir->strings.items);
+    free(ir->arrays.items);
     memset(ir, 0, sizeof(*ir));
 }
+
+int ir_instr_def(const IRInstr *in) {
+    switch (in->op) {
+        case IROP_IMM_INT:
+        case IROP_IMM_BOOL:
+        case IROP_IMM_STR:
+        case IROP_LOAD_VAR:
+        case IROP_BIN:
+        case IROP_UN:
+            return in->dst;
+        case IROP_CALL:
+            return in->dst >= 0 ? in->dst : -1;
+        case IROP_PHI:
+        case IROP_ARRAY_LOAD:
+        case IROP_VEC_SUM:
+            return in->dst;
+        default:
+            return -1;
+    }
+}
+
+/* Maps each temp to the index of the instruction defining it, or -1. */
+int *ir_temp_defs(const IRFunction *fn) {
+    int *defs = xmalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1) * sizeof(int));
+    for (int t = 0; t < fn->temp_count; t++) {
+        defs[t] = -1;
+    }
+    for (size_t i = 0; i < fn->code.len; i++) {
+        int d = ir_instr_def(&fn->code.items[i]);
+        if (d >= 0) {
+            defs[d] = (int)i;
+        }
+    }
+    return defs;
+}
+
+/* Collects pointers to every temp operand read by an instruction so passes
+   can rewrite them in place. out_refs must have room for IR_MAX_USES
+   entries. */
+int ir_instr_use_refs(IRInstr *in, int **out_refs) {
+    int n = 0;
+    switch (in->op) {
+        case IROP_BIN:
+        case IROP_ARRAY_STORE:
+        case IROP_VEC_MAP:
+        case IROP_VEC_SUM:
+            out_refs[n++] = &in->src1;
+            out_refs[n++] = &in->src2;
+            break;
+        case IROP_UN:
+        case IROP_STORE_VAR:
+        case IROP_JMP_FALSE:
+        case IROP_CHANT:
+        case IROP_ARRAY_LOAD:
+        case IROP_CHECK_INDEX:
+            out_refs[n++] = &in->src1;
+            break;
+        case IROP_RET:
+            if (in->has_value) {
+                out_refs[n++] = &in->src1;
+            }
+            break;
+        case IROP_CALL:
+            for (int i = 0; i < in->argc; i++) {
+                out_refs[n++] = &in->args[i];
+            }
+            break;
+        case IROP_PHI:
+            for (int i = 0; i < in->phi_count; i++) {
+                if (in->phi_temps[i] >= 0) {
+                    out_refs[n++] = &in->phi_temps[i];
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    return n;
+}
+
+int ir_instr_uses(const IRInstr *in, int *out_temps) {
+    int *refs[IR_MAX_USES];
+    int n = ir_instr_use_refs((IRInstr *)in, refs);
+    for (int i = 0; i < n; i++) {
+        out_temps[i] = *refs[i];
+    }
+    return n;
+}
+
+/* Collects pointers to every variable index an instruction names, scalar
+   slots and arrays alike. out_refs must have room for 3 entries. */
+int ir_instr_var_refs(IRInstr *in, int **out_refs) {
+    int n = 0;
+    switch (in->op) {
+        case IROP_LOAD_VAR:
+        case IROP_STORE_VAR:
+        case IROP_PHI:
+        case IROP_ARRAY_ZERO:
+        case IROP_ARRAY_LOAD:
+        case IROP_ARRAY_STORE:
+            out_refs[n++] = &in->var_index;
+            break;
+        case IROP_VEC_MAP:
+            out_refs[n++] = &in->var_index;
+            out_refs[n++] = &in->arrays[0];
+            out_refs[n++] = &in->arrays[1];
+            break;
+        case IROP_VEC_SUM:
+            out_refs[n++] = &in->arrays[0];
+            break;
+        default:
+            break;
+    }
+    return n;
+}
+
+void ir_remove_instrs(IRFunction *fn, const unsigned char *dead) {
+    size_t w = 0;
+    for (size_t r = 0; r < fn->code.len; r++) {
+        if (dead[r]) {
+            ir_free_instr(&fn->code.items[r]);
+            continue;
+        }
+        fn->code.items[w++] = fn->code.items[r];
+    }
+    fn->code.len = w;
+}
+
+void ir_free_instr(IRInstr *in) {
+    free(in->name);
+    free(in->phi_temps);
+    free(in->phi_labels);
+    in->name = NULL;
+    in->phi_temps = NULL;
+    in->phi_labels = NULL;
+    in->phi_count = 0;
+}
+
+/* Folds a binary operation over two immediates. Returns 0 when the result
+   must be left to runtime (division by zero, overflowing division or
+   joining texts). */
+int ir_fold_binop(IRBinOp op, long a, long b, long *out) {
+    unsigned long ua = (unsigned long)a;
+    unsigned long ub = (unsigned long)b;
+    switch (op) {
+        case IRBIN_ADD: *out = (long)(ua + ub); return 1;
+        case IRBIN_SUB: *out = (long)(ua - ub); return 1;
+        case IRBIN_MUL: *out = (long)(ua * ub); return 1;
+        case IRBIN_DIV:
+            if (b == 0 || (b == -1 && a == LONG_MIN)) {
+                return 0;
+            }
+            *out = a / b;
+            return 1;
+        case IRBIN_BOTH: *out = (a != 0) && (b != 0); return 1;
+        case IRBIN_EITHER: *out = (a != 0) || (b != 0); return 1;
+        case IRBIN_SAME: *out = a == b; return 1;
+        case IRBIN_DIFF: *out = a != b; return 1;
+        case IRBIN_LESS: *out = a < b; return 1;
+        case IRBIN_MORE: *out = a > b; return 1;
+        case IRBIN_ATMOST: *out = a <= b; return 1;
+        case IRBIN_ATLEAST: *out = a >= b; return 1;
+        case IRBIN_CONCAT: return 0;
+        /* Constant texts are interned literals, equal only to themselves. */
+        case IRBIN_TEXT_SAME: *out = a == b; return 1;
+    }
+    return 0;
+}
+
+IRFunction *ir_find_function(const IRProgram *ir, const char *name) {
+    for (size_t i = 0; i < ir->functions.len; i++) {
+        if (strcmp(ir->functions.items[i].name, name) == 0) {
+            return &ir->functions.items[i];
+        }
+    }
+    return NULL;
+}
+
+/* A glyph is pure when it never chants and only calls pure glyphs. Starts
+   optimistic so mutually recursive glyphs can be pure, then clears the flag
+   until nothing changes. */
+void ir_compute_purity(IRProgram *ir) {
+    for (size_t i = 0; i < ir->functions.len; i++) {
+        ir->functions.items[i].pure = 1;
+    }
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (size_t i = 0; i < ir->functions.len; i++) {
+            IRFunction *fn = &ir->functions.items[i];
+            if (!fn->pure) {
+                continue;
+            }
+            for (size_t j = 0; j < fn->code.len && fn->pure; j++) {
+                const IRInstr *in = &fn->code.items[j];
+                if (in->op == IROP_CHANT) {
+                    fn->pure = 0;
+                } else if (in->op == IROP_CALL) {
+                    const IRFunction *callee = ir_find_function(ir, in->name);
+                    fn->pure = callee && callee->pure;
+                }
+            }
+            changed |= !fn->pure;
+        }
+    }
+}
+
+static const char *binop_name(IRBinOp op) {
+    switch (op) {
+        case IRBIN_ADD: return "add";
+        case IRBIN_SUB: return "sub";
+        case IRBIN_MUL: return "mul";
+        case IRBIN_DIV: return "div";
+        case IRBIN_BOTH: return "both";
+        case IRBIN_EITHER: return "either";
+        case IRBIN_SAME: return "same";
+        case IRBIN_DIFF: return "diff";
+        case IRBIN_LESS: return "less";
+        case IRBIN_MORE: return "more";
+        case IRBIN_ATMOST: return "atmost";
+        case IRBIN_ATLEAST: return "atleast";
+        case IRBIN_CONCAT: return "concat";
+        case IRBIN_TEXT_SAME: return "text_same";
+    }
+    return "?";
+}
+
+static void dump_instr(FILE *out, const IRFunction *fn, const IRInstr *in) {
+    switch (in->op) {
+        case IROP_LABEL:
+            fprintf(out, "L%d:\n", in->label);
+            return;
+        case IROP_JMP:
+            fprintf(out, "  jmp L%d", in->label);
+            break;
+        case IROP_JMP_FALSE:
+            fprintf(out, "  jmp_false t%d, L%d", in->src1, in->label);
+            break;
+        case IROP_IMM_INT:
+            fprintf(out, "  t%d = %ld", in->dst, in->imm);
+            break;
+        case IROP_IMM_BOOL:
+            fprintf(out, "  t%d = %s", in->dst, in->imm ? "yes" : "no");
+            break;
+        case IROP_IMM_STR:
+            fprintf(out, "  t%d = str#%ld", in->dst, in->imm);
+            break;
+        case IROP_LOAD_VAR:
+            fprintf(out, "  t%d = load %s.%d", in->dst, fn->vars.items[in->var_index].name, in->var_index);
+            break;
+        case IROP_STORE_VAR:
+            fprintf(out, "  store %s.%d, t%d", fn->vars.items[in->var_index].name, in->var_index, in->src1);
+            break;
+        case IROP_BIN:
+            fprintf(out, "  t%d = %s t%d, t%d", in->dst, binop_name(in->binop), in->src1, in->src2);
+            break;
+        case IROP_UN:
+            fprintf(out, "  t%d = %s t%d", in->dst,
+                    in->unop == IRUN_NEG ? "neg" : in->unop == IRUN_SPAN ? "span" : "flip", in->src1);
+            break;
+        case IROP_CALL:
+            if (in->dst >= 0) {
+                fprintf(out, "  t%d = ", in->dst);
+            } else {
+                fprintf(out, "  ");
+            }
+            fprintf(out, "call %s(", in->name);
+            for (int i = 0; i < in->argc; i++) {
+                fprintf(out, "%st%d", i == 0 ? "" : ", ", in->args[i]);
+            }
+            fprintf(out, ")");
+            break;
+        case IROP_CHANT:
+            fprintf(out, "  chant %s t%d", type_name(in->type), in->src1);
+            break;
+        case IROP_RET:
+            if (in->has_value) {
+                fprintf(out, "  ret t%d", in->src1);
+            } else {
+                fprintf(out, "  ret");
+            }
+            break;
+        case IROP_PHI:
+            fprintf(out, "  t%d = phi %s.%d", in->dst, fn->vars.items[in->var_index].name, in->var_index);
+            for (int i = 0; i < in->phi_count; i++) {
+                fprintf(out, "%s[L%d: t%d]", i == 0 ? " " : ", ", in->phi_labels[i], in->phi_temps[i]);
+            }
+            break;
+        case IROP_ARRAY_ZERO:
+            fprintf(out, "  zero %s.%d", fn->vars.items[in->var_index].name, in->var_index);
+            break;
+        case IROP_ARRAY_LOAD:
+            fprintf(out, "  t%d = %s.%d[t%d]", in->dst, fn->vars.items[in->var_index].name, in->var_index, in->src1);
+            break;
+        case IROP_ARRAY_STORE:
+            fprintf(out, "  %s.%d[t%d] = t%d", fn->vars.items[in->var_index].name, in->var_index, in->src1,
+                    in->src2);
+            break;
+        case IROP_CHECK_INDEX:
+            fprintf(out, "  check t%d < %ld", in->src1, in->imm);
+            break;
+        case IROP_VEC_MAP:
+            fprintf(out, "  vec %s.%d = %s %s.%d, %s.%d [t%d, t%d)", fn->vars.items[in->var_index].name,
+                    in->var_index, binop_name(in->binop), fn->vars.items[in->arrays[0]].name, in->arrays[0],
+                    fn->vars.items[in->arrays[1]].name, in->arrays[1], in->src1, in->src2);
+            break;
+        case IROP_VEC_SUM:
+            fprintf(out, "  t%d = vec sum %s.%d [t%d, t%d)", in->dst, fn->vars.items[in->arrays[0]].name,
+                    in->arrays[0], in->src1, in->src2);
+            break;
+        case IROP_COUNT:
+            fprintf(out, "  count #%ld", in->imm);
+            break;
+    }
+    if (fn->profiled && in->op == IROP_CALL) {
+        fprintf(out, "  ; runs %ld", in->prof[0]);
+    } else if (fn->profiled && in->op == IROP_JMP_FALSE) {
+        fprintf(out, "  ; falls through %ld, jumps %ld", in->prof[0], in->prof[1]);
+    }
+    fputc('\n', out);
+}
+
+void ir_dump_program(FILE *out, const IRProgram *ir) {
+    for (size_t i = 0; i < ir->arrays.len; i++) {
+        const IRArrayData *data = &ir->arrays.items[i];
+        fprintf(out, "array#%d:", data->id);
+        for (long k = 0; k < data->len; k++) {
+            fprintf(out, " %ld", data->values[k]);
+        }
+        fprintf(out, "\n");
+    }
+    if (ir->arrays.len > 0) {
+        fputc('\n', out);
+    }
+    for (size_t i = 0; i < ir->functions.len; i++) {
+        const IRFunction *fn = &ir->functions.items[i];
+        fprintf(out, "glyph %s: %zu vars, %d temps, %zu instrs", fn->name, fn->vars.len, fn->temp_count,
+                fn->code.len);
+        if (fn->memo) {
+            fprintf(out, ", memo");
+        }
+        if (fn->profiled) {
+            fprintf(out, ", entered %ld times", fn->entry_count);
+        }
+        fputc('\n', out);
+        for (size_t j = 0; j < fn->code.len; j++) {
+            dump_instr(out, fn, &fn->code.items[j]);
+        }
+        fputc('\n', out);
+    }
+}
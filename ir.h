@@ -4,6 +4,7 @@
 #include "ast.h"
 
 #include <stddef.h>
+#include <stdio.h>
 
 typedef enum IRBinOp {
     IRBIN_ADD,
@@ -17,12 +18,15 @@ typedef enum IRBinOp {
     IRBIN_LESS,
     IRBIN_MORE,
     IRBIN_ATMOST,
-    IRBIN_ATLEAST
+    IRBIN_ATLEAST,
+    IRBIN_CONCAT,   /* text of src1 followed by text of src2 */
+    IRBIN_TEXT_SAME /* texts with the same characters */
 } IRBinOp;
 
 typedef enum IRUnOp {
     IRUN_NEG,
-    IRUN_FLIP
+    IRUN_FLIP,
+    IRUN_SPAN /* length of a text */
 } IRUnOp;
 
 typedef enum IROp {
@@ -41,9 +45,24 @@ typedef enum IROp {
 
     IROP_CALL,
     IROP_CHANT,
-    IROP_RET
+    IROP_RET,
+
+    IROP_PHI,
+
+    IROP_ARRAY_ZERO,  /* every element of array var_index = 0 */
+    IROP_ARRAY_LOAD,  /* dst = var_index[src1], index already checked */
+    IROP_ARRAY_STORE, /* var_index[src1] = src2, index already checked */
+    IROP_CHECK_INDEX, /* stops the program unless 0 <= src1 < imm */
+    IROP_VEC_MAP,     /* var_index[k] = arrays[0][k] binop arrays[1][k] for src1 <= k < src2 */
+    IROP_VEC_SUM,     /* dst = sum of arrays[0][k] for src1 <= k < src2 */
+
+    IROP_COUNT /* bumps profile counter imm */
 } IROp;
 
+/* Upper bound on the temps a single instruction reads (call arguments or phi
+   operands). */
+#define IR_MAX_USES 16
+
 typedef struct IRInstr {
     IROp op;
     int line;
@@ -65,8 +84,16 @@ typedef struct IRInstr {
     int argc;
     int args[6];
 
+    int arrays[2]; /* array variables read by IROP_VEC_* */
+
+    long prof[2]; /* profile counts: runs of a call; jmp_false falling through, jumping */
+
     TypeKind type;
     int has_value;
+
+    int *phi_temps;
+    int *phi_labels;
+    int phi_count;
 } IRInstr;
 
 typedef struct IRInstrArray {
@@ -80,6 +107,8 @@ typedef struct IRVar {
     TypeKind type;
     int mutable_flag;
     int is_param;
+    long array_len; /* elements of an ember array, 0 for scalars */
+    int rodata;     /* constant array in IRProgram.arrays backing it, or -1 */
 } IRVar;
 
 typedef struct IRVarArray {
@@ -94,6 +123,12 @@ typedef struct IRFunction {
     IRVarArray vars;
     int param_count;
     int temp_count;
+    int label_count;
+    int pure; /* no chant reachable through the glyph or its callees */
+    int memo; /* results are cached by argument values at run time */
+    int profiled; /* entry_count and prof[] of the instructions come from a profile */
+    long entry_count;
+    int cold_label; /* first label of the blocks placed out of line, or -1 */
     IRInstrArray code;
 } IRFunction;
 
@@ -106,6 +141,7 @@ typedef struct IRFunctionArray {
 typedef struct IRString {
     int id;
     char *value;
+    size_t len; /* bytes in value, which may include NUL */
 } IRString;
 
 typedef struct IRStringArray {
@@ -114,12 +150,48 @@ typedef struct IRStringArray {
     size_t cap;
 } IRStringArray;
 
+/* Contents of an immutable array bound to constants, emitted as rodata. */
+typedef struct IRArrayData {
+    int id;
+    long *values;
+    long len;
+} IRArrayData;
+
+typedef struct IRArrayDataArray {
+    IRArrayData *items;
+    size_t len;
+    size_t cap;
+} IRArrayDataArray;
+
 typedef struct IRProgram {
     IRFunctionArray functions;
     IRStringArray strings;
+    IRArrayDataArray arrays;
+    int profile_counters; /* IROP_COUNT counters of an instrumented program */
+    unsigned long profile_hash;
 } IRProgram;
 
 void ir_generate_program(const Program *ast, IRProgram *out_ir);
 void free_ir_program(IRProgram *ir);
 
+void ir_push_instr(IRInstrArray *arr, IRInstr ins);
+IRInstr ir_make_instr(IROp op);
+int ir_add_var(IRFunction *fn, const char *name, TypeKind type, int mutable_flag, int is_param);
+
+int ir_instr_def(const IRInstr *in);
+int *ir_temp_defs(const IRFunction *fn);
+int ir_instr_use_refs(IRInstr *in, int **out_refs);
+int ir_instr_uses(const IRInstr *in, int *out_temps);
+int ir_instr_var_refs(IRInstr *in, int **out_refs);
+void ir_remove_instrs(IRFunction *fn, const unsigned char *dead);
+void ir_free_instr(IRInstr *in);
+
+int ir_fold_binop(IRBinOp op, long a, long b, long *out);
+int ir_intern_string(IRProgram *p, const char *value, size_t len);
+
+IRFunction *ir_find_function(const IRProgram *ir, const char *name);
+void ir_compute_purity(IRProgram *ir);
+
+void ir_dump_program(FILE *out, const IRProgram *ir);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "layout.h"
+
+#include "cfg.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Static branch weights when no profile says otherwise. A weight of 0 marks
+   an edge as cold. */
+#define WEIGHT_LIKELY 8
+#define WEIGHT_EVEN 4
+#define WEIGHT_UNLIKELY 1
+
+static const IRInstr *last_instr(const IRFunction *fn, const CFG *cfg, int b) {
+    return &fn->code.items[cfg->blocks[b].end - 1];
+}
+
+static int falls_through(const IRFunction *fn, const CFG *cfg, int b) {
+    IROp op = last_instr(fn, cfg, b)->op;
+    return op != IROP_JMP && op != IROP_RET && (size_t)b + 1 < cfg->len;
+}
+
+/* Weights of falling through and jumping for every block ending in
+   jmp_false: the profile counts when there are any, otherwise loop
+   branches stay in the loop, and where that says nothing an arm that
+   returns straight away while the other goes on is cold. */
+static long *branch_weights(const IRFunction *fn, CFG *cfg) {
+    long *w = xcalloc(cfg->len * 2, sizeof(long));
+    if (!fn->profiled) {
+        cfg_compute_dominators(cfg);
+        cfg_find_loops(cfg);
+    }
+    for (size_t b = 0; b < cfg->len; b++) {
+        const IRInstr *last = last_instr(fn, cfg, (int)b);
+        if (last->op != IROP_JMP_FALSE) {
+            continue;
+        }
+        if (fn->profiled) {
+            w[2 * b] = last->prof[0];
+            w[2 * b + 1] = last->prof[1];
+            continue;
+        }
+        int succ[2] = {(int)b + 1, cfg_block_of_label(cfg, last->label)};
+        long *sw = &w[2 * b];
+        sw[0] = sw[1] = WEIGHT_EVEN;
+        int loop = cfg->blocks[b].loop;
+        int stays[2] = {0, 0};
+        int returns[2] = {0, 0};
+        for (int k = 0; k < 2; k++) {
+            stays[k] = loop >= 0 && (size_t)succ[k] < cfg->len && cfg_loop_contains(cfg, loop, succ[k]);
+            returns[k] = (size_t)succ[k] < cfg->len && last_instr(fn, cfg, succ[k])->op == IROP_RET;
+        }
+        for (int k = 0; k < 2; k++) {
+            if (stays[k] != stays[1 - k]) {
+                sw[k] = stays[k] ? WEIGHT_LIKELY : WEIGHT_UNLIKELY;
+            } else if (returns[k] && !returns[1 - k]) {
+                sw[k] = 0;
+            }
+        }
+    }
+    return w;
+}
+
+/* Weight of the edge from block `from` to `to`, or -1 for edges that are
+   not one side of a conditional jump. */
+static long edge_weight(const IRFunction *fn, const CFG *cfg, const long *w, int from, int to) {
+    const IRInstr *last = last_instr(fn, cfg, from);
+    if (last->op != IROP_JMP_FALSE) {
+        return -1;
+    }
+    long weight = 0;
+    if (to == cfg_block_of_label(cfg, last->label)) {
+        weight += w[2 * from + 1];
+    }
+    if (to == from + 1) {
+        weight += w[2 * from];
+    }
+    return weight;
+}
+
+/* The successor a trace through b continues with: the heavier side of a
+   conditional jump, the fall-through block, or the target of a jump that
+   nothing else enters. */
+static int trace_next(const IRFunction *fn, const CFG *cfg, const long *w, int b, const unsigned char *placed,
+                      const unsigned char *warm) {
+    const CFGBlock *blk = &cfg->blocks[b];
+    const IRInstr *last = last_instr(fn, cfg, b);
+    int best = -1;
+    long best_weight = -1;
+    for (size_t k = 0; k < blk->succs.len; k++) {
+        int s = blk->succs.items[k];
+        if (placed[s] || warm[s] != warm[b]) {
+            continue;
+        }
+        if (last->op == IROP_JMP && cfg->blocks[s].preds.len > 1) {
+            continue;
+        }
+        long weight = edge_weight(fn, cfg, w, b, s);
+        if (weight > best_weight || (weight == best_weight && s == b + 1)) {
+            best = s;
+            best_weight = weight;
+        }
+    }
+    return best;
+}
+
+int layout_blocks(IRFunction *fn, int report) {
+    if (fn->code.len == 0 || (fn->profiled && fn->entry_count == 0)) {
+        return 0;
+    }
+    CFG cfg;
+    cfg_build(fn, &cfg);
+    long *w = branch_weights(fn, &cfg);
+
+    /* Warm blocks are reachable from the entry without crossing a cold
+       edge; the rest go after them. */
+    unsigned char *warm = xcalloc(cfg.len, 1);
+    unsigned char *placed = xcalloc(cfg.len, 1);
+    int *order = xmalloc(cfg.len * sizeof(int));
+    int *stack = xmalloc(cfg.len * sizeof(int));
+    size_t sp = 0;
+    warm[0] = 1;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        int b = stack[--sp];
+        for (size_t k = 0; k < cfg.blocks[b].succs.len; k++) {
+            int s = cfg.blocks[b].succs.items[k];
+            if (!warm[s] && edge_weight(fn, &cfg, w, b, s) != 0) {
+                warm[s] = 1;
+                stack[sp++] = s;
+            }
+        }
+    }
+
+    size_t n = 0;
+    size_t warm_count = 0;
+    for (int pass = 1; pass >= 0; pass--) {
+        for (size_t seed = 0; seed < cfg.len; seed++) {
+            for (int b = (int)seed; b >= 0 && !placed[b] && warm[b] == pass;
+                 b = trace_next(fn, &cfg, w, b, placed, warm)) {
+                placed[b] = 1;
+                order[n++] = b;
+            }
+        }
+        if (pass == 1) {
+            warm_count = n;
+        }
+    }
+
+    int changed = warm_count < n && warm_count > 0 && falls_through(fn, &cfg, order[warm_count - 1]);
+    for (size_t k = 0; k < n; k++) {
+        changed |= order[k] != (int)k;
+    }
+    int cold_label = warm_count < n ? cfg.blocks[order[warm_count]].label : -1;
+    if (!changed && cold_label == fn->cold_label) {
+        free(stack);
+        free(order);
+        free(placed);
+        free(warm);
+        free(w);
+        free_cfg(&cfg);
+        return 0;
+    }
+
+    /* Blocks entered by falling through need a label once they move, and
+       so does the first cold block. */
+    int *label = xmalloc(cfg.len * sizeof(int));
+    unsigned char *new_label = xcalloc(cfg.len, 1);
+    for (size_t k = 0; k < n; k++) {
+        int b = order[k];
+        label[b] = cfg.blocks[b].label;
+        int moved = b > 0 && falls_through(fn, &cfg, b - 1) && (k == 0 || order[k - 1] != b - 1);
+        if (label[b] < 0 && (moved || k == warm_count)) {
+            label[b] = fn->label_count++;
+            new_label[b] = 1;
+        }
+    }
+
+    IRInstrArray code;
+    memset(&code, 0, sizeof(code));
+    int inverted = 0;
+    for (size_t k = 0; k < n; k++) {
+        int b = order[k];
+        /* Nothing falls from the warm blocks into the cold ones. */
+        int next = k + 1 < n && k + 1 != warm_count ? order[k + 1] : -1;
+        const CFGBlock *blk = &cfg.blocks[b];
+        if (new_label[b]) {
+            IRInstr lbl = ir_make_instr(IROP_LABEL);
+            lbl.label = label[b];
+            ir_push_instr(&code, lbl);
+        }
+        for (size_t i = blk->start; i + 1 < blk->end; i++) {
+            ir_push_instr(&code, fn->code.items[i]);
+        }
+        IRInstr last = fn->code.items[blk->end - 1];
+        int fall = b + 1;
+        if (last.op == IROP_JMP || last.op == IROP_RET) {
+            ir_push_instr(&code, last);
+            continue;
+        }
+        if (last.op == IROP_JMP_FALSE && (size_t)fall < cfg.len && next != fall &&
+            next == cfg_block_of_label(&cfg, last.label)) {
+            IRInstr flip = ir_make_instr(IROP_UN);
+            flip.line = last.line;
+            flip.unop = IRUN_FLIP;
+            flip.src1 = last.src1;
+            flip.dst = fn->temp_count++;
+            ir_push_instr(&code, flip);
+            last.src1 = flip.dst;
+            last.label = label[fall];
+            long falls = last.prof[0];
+            last.prof[0] = last.prof[1];
+            last.prof[1] = falls;
+            ir_push_instr(&code, last);
+            inverted++;
+            continue;
+        }
+        ir_push_instr(&code, last);
+        if ((size_t)fall >= cfg.len) {
+            if (k + 1 < n) {
+                ir_push_instr(&code, ir_make_instr(IROP_RET));
+            }
+        } else if (next != fall) {
+            IRInstr jmp = ir_make_instr(IROP_JMP);
+            jmp.line = last.line;
+            jmp.label = label[fall];
+            ir_push_instr(&code, jmp);
+        }
+    }
+    free(fn->code.items);
+    fn->code = code;
+    fn->cold_label = warm_count < n ? label[order[warm_count]] : -1;
+    if (report) {
+        printf("layout: %s: blocks reordered%s, %d branches inverted, %zu cold blocks\n", fn->name,
+               fn->profiled ? " by profile" : "", inverted, n - warm_count);
+    }
+
+    free(new_label);
+    free(label);
+    free(stack);
+    free(order);
+    free(placed);
+    free(warm);
+    free(w);
+    free_cfg(&cfg);
+    return 1;
+}
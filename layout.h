@@ -0,0 +1,13 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "ir.h"
+
+/* Orders blocks along their likely successors so the likely side of each
+   branch falls through, inverting branches where needed, and moves cold
+   blocks to the end, recording the first in fn->cold_label. Branch weights
+   come from the profile when the glyph has one, otherwise from static
+   heuristics. Returns 1 if the code changed. */
+int layout_blocks(IRFunction *fn, int report);
+
+#endif
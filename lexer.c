@@ -44,6 +44,7 @@ static void emit_simple(Lexer *lx, TokenKind kind, int line, int col) {
     Token t;
     t.kind = kind;
     t.lexeme = NULL;
+    t.len = 0;
     t.int_value = 0;
     t.line = line;
     t.col = col;
@@ -60,6 +61,7 @@ static char *slice_dup(const char *src, size_t start, size_t end) {
 
 static TokenKind keyword_kind(const char *s) {
     if (strcmp(s, "glyph") == 0) return TOK_K_GLYPH;
+    if (strcmp(s, "memo") == 0) return TOK_K_MEMO;
     if (strcmp(s, "yields") == 0) return TOK_K_YIELDS;
     if (strcmp(s, "bind") == 0) return TOK_K_BIND;
     if (strcmp(s, "morph") == 0) return TOK_K_MORPH;
@@ -86,6 +88,7 @@ static TokenKind keyword_kind(const char *s) {
     if (strcmp(s, "both") == 0) return TOK_K_BOTH;
     if (strcmp(s, "either") == 0) return TOK_K_EITHER;
     if (strcmp(s, "flip") == 0) return TOK_K_FLIP;
+    if (strcmp(s, "span") == 0) return TOK_K_SPAN;
     if (strcmp(s, "same") == 0) return TOK_K_SAME;
     if (strcmp(s, "diff") == 0) return TOK_K_DIFF;
     if (strcmp(s, "less") == 0) return TOK_K_LESS;
@@ -105,6 +108,7 @@ static void lex_number(Lexer *lx, int line, int col) {
     Token t;
     t.kind = TOK_INT;
     t.lexeme = digits;
+    t.len = lx->pos - start;
     t.int_value = strtol(digits, NULL, 10);
     t.line = line;
     t.col = col;
@@ -121,6 +125,7 @@ static void lex_ident_or_kw(Lexer *lx, int line, int col) {
     Token t;
     t.kind = kind;
     t.lexeme = text;
+    t.len = lx->pos - start;
     t.int_value = 0;
     t.line = line;
     t.col = col;
@@ -197,6 +202,7 @@ static void lex_string(Lexer *lx, int line, int col) {
     Token t;
     t.kind = TOK_STRING;
     t.lexeme = buf;
+    t.len = len;
     t.int_value = 0;
     t.line = line;
     t.col = col;
@@ -301,6 +307,7 @@ const char *token_kind_name(TokenKind kind) {
         case TOK_LPAREN: return "(";
         case TOK_RPAREN: return ")";
         case TOK_K_GLYPH: return "glyph";
+        case TOK_K_MEMO: return "memo";
         case TOK_K_YIELDS: return "yields";
         case TOK_K_BIND: return "bind";
         case TOK_K_MORPH: return "morph";
@@ -325,6 +332,7 @@ const char *token_kind_name(TokenKind kind) {
         case TOK_K_BOTH: return "both";
         case TOK_K_EITHER: return "either";
         case TOK_K_FLIP: return "flip";
+        case TOK_K_SPAN: return "span";
         case TOK_K_SAME: return "same";
         case TOK_K_DIFF: return "diff";
         case TOK_K_LESS: return "less";
@@ -24,6 +24,7 @@ typedef enum TokenKind {
     TOK_RPAREN,
 
     TOK_K_GLYPH,
+    TOK_K_MEMO,
     TOK_K_YIELDS,
     TOK_K_BIND,
     TOK_K_MORPH,
@@ -50,6 +51,7 @@ typedef enum TokenKind {
     TOK_K_BOTH,
     TOK_K_EITHER,
     TOK_K_FLIP,
+    TOK_K_SPAN,
     TOK_K_SAME,
     TOK_K_DIFF,
     TOK_K_LESS,
@@ -61,6 +63,7 @@ typedef enum TokenKind {
 typedef struct Token {
     TokenKind kind;
     char *lexeme;
+    size_t len; /* bytes in lexeme; a string may hold NUL bytes */
     long int_value;
     int line;
     int col;
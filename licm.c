@@ -0,0 +1,237 @@
+#include "licm.h"
+
+#include "cfg.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct LoopScan {
+    const IRFunction *fn;
+    const CFG *cfg;
+    const CFGLoop *loop;
+    int *block_of;
+    int *defs;
+    unsigned char *in_loop;
+    unsigned char *stored;
+    unsigned char *invariant;
+    int *order;
+    size_t order_len;
+} LoopScan;
+
+static int is_terminator(IROp op) {
+    return op == IROP_JMP || op == IROP_JMP_FALSE || op == IROP_RET;
+}
+
+/* Hoisted code runs even when the loop body would not, so only operations
+   that cannot trap or observe anything qualify. */
+static int may_hoist(const LoopScan *s, const IRInstr *in) {
+    switch (in->op) {
+        case IROP_IMM_INT:
+        case IROP_IMM_BOOL:
+        case IROP_IMM_STR:
+        case IROP_UN:
+            return 1;
+        case IROP_LOAD_VAR:
+            return !s->stored[in->var_index];
+        case IROP_BIN: {
+            if (in->binop != IRBIN_DIV) {
+                return 1;
+            }
+            int d = s->defs[in->src2];
+            const IRInstr *div = d >= 0 ? &s->fn->code.items[d] : NULL;
+            return div && div->op == IROP_IMM_INT && div->imm != 0 && div->imm != -1;
+        }
+        default:
+            return 0;
+    }
+}
+
+static int operands_invariant(const LoopScan *s, const IRInstr *in) {
+    int ops[IR_MAX_USES];
+    int n = ir_instr_uses(in, ops);
+    for (int k = 0; k < n; k++) {
+        int d = s->defs[ops[k]];
+        if (d < 0 || (s->in_loop[s->block_of[d]] && !s->invariant[d])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Marks loop instructions whose operands are all defined outside the loop
+   or by other invariant instructions. order lists them so every definition
+   precedes its uses. */
+static void find_invariants(LoopScan *s) {
+    const IRFunction *fn = s->fn;
+    memset(s->in_loop, 0, s->cfg->len);
+    memset(s->stored, 0, fn->vars.len + 1);
+    memset(s->invariant, 0, fn->code.len + 1);
+    s->order_len = 0;
+    for (size_t k = 0; k < s->loop->blocks.len; k++) {
+        const CFGBlock *blk = &s->cfg->blocks[s->loop->blocks.items[k]];
+        s->in_loop[s->loop->blocks.items[k]] = 1;
+        for (size_t i = blk->start; i < blk->end; i++) {
+            if (fn->code.items[i].op == IROP_STORE_VAR) {
+                s->stored[fn->code.items[i].var_index] = 1;
+            }
+        }
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (size_t k = 0; k < s->loop->blocks.len; k++) {
+            const CFGBlock *blk = &s->cfg->blocks[s->loop->blocks.items[k]];
+            for (size_t i = blk->start; i < blk->end; i++) {
+                const IRInstr *in = &fn->code.items[i];
+                if (s->invariant[i] || !may_hoist(s, in) || !operands_invariant(s, in)) {
+                    continue;
+                }
+                s->invariant[i] = 1;
+                s->order[s->order_len++] = (int)i;
+                changed = 1;
+            }
+        }
+    }
+}
+
+/* Moves the invariant instructions in front of the loop header. A lone
+   outside predecessor that only flows into the header serves as the
+   preheader; otherwise a new labelled block is placed before the header and
+   outside jumps to the header are redirected to it. */
+static void hoist(IRFunction *fn, const LoopScan *s) {
+    const CFG *cfg = s->cfg;
+    const CFGBlock *hdr = &cfg->blocks[s->loop->header];
+    int outside = -1;
+    size_t outside_count = 0;
+    for (size_t p = 0; p < hdr->preds.len; p++) {
+        if (!s->in_loop[hdr->preds.items[p]]) {
+            outside = hdr->preds.items[p];
+            outside_count++;
+        }
+    }
+
+    size_t insert_at;
+    int pre_label = -1;
+    int header_label = hdr->label;
+    int new_header_label = 0;
+    if (outside_count == 1 && cfg->blocks[outside].succs.len == 1) {
+        const CFGBlock *pre = &cfg->blocks[outside];
+        insert_at = is_terminator(fn->code.items[pre->end - 1].op) ? pre->end - 1 : pre->end;
+    } else {
+        insert_at = hdr->start;
+        pre_label = fn->label_count++;
+        if (header_label < 0) {
+            header_label = fn->label_count++;
+            new_header_label = 1;
+        }
+    }
+
+    IRInstrArray code;
+    memset(&code, 0, sizeof(code));
+    for (size_t i = 0; i <= fn->code.len; i++) {
+        if (i == insert_at) {
+            if (pre_label >= 0) {
+                /* A loop block laid out right before the header must still reach it. */
+                if (i > 0 && s->in_loop[s->block_of[i - 1]] && fn->code.items[i - 1].op != IROP_JMP &&
+                    fn->code.items[i - 1].op != IROP_RET) {
+                    IRInstr jmp = ir_make_instr(IROP_JMP);
+                    jmp.label = header_label;
+                    ir_push_instr(&code, jmp);
+                }
+                IRInstr lbl = ir_make_instr(IROP_LABEL);
+                lbl.label = pre_label;
+                ir_push_instr(&code, lbl);
+            }
+            for (size_t k = 0; k < s->order_len; k++) {
+                ir_push_instr(&code, fn->code.items[s->order[k]]);
+            }
+            if (new_header_label) {
+                IRInstr lbl = ir_make_instr(IROP_LABEL);
+                lbl.label = header_label;
+                ir_push_instr(&code, lbl);
+            }
+        }
+        if (i == fn->code.len) {
+            break;
+        }
+        if (s->invariant[i]) {
+            continue;
+        }
+        IRInstr in = fn->code.items[i];
+        if (pre_label >= 0 && (in.op == IROP_JMP || in.op == IROP_JMP_FALSE) && !s->in_loop[s->block_of[i]] &&
+            cfg_block_of_label(cfg, in.label) == s->loop->header) {
+            in.label = pre_label;
+        }
+        ir_push_instr(&code, in);
+    }
+
+    free(fn->code.items);
+    fn->code = code;
+}
+
+/* Loop-invariant code motion over the natural loops of the CFG, innermost
+   loops first so their invariants can keep moving outwards. Expects
+   phi-free IR. */
+int licm_function(IRFunction *fn) {
+    int changed = 0;
+    for (int attempt = 0; attempt < 64; attempt++) {
+        CFG cfg;
+        cfg_build(fn, &cfg);
+        cfg_compute_dominators(&cfg);
+        cfg_find_loops(&cfg);
+        if (cfg.loop_count == 0) {
+            free_cfg(&cfg);
+            break;
+        }
+
+        LoopScan s;
+        memset(&s, 0, sizeof(s));
+        s.fn = fn;
+        s.cfg = &cfg;
+        s.block_of = xmalloc((fn->code.len + 1) * sizeof(int));
+        s.defs = xmalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1) * sizeof(int));
+        s.in_loop = xmalloc(cfg.len);
+        s.stored = xmalloc(fn->vars.len + 1);
+        s.invariant = xmalloc(fn->code.len + 1);
+        s.order = xmalloc((fn->code.len + 1) * sizeof(int));
+        for (size_t b = 0; b < cfg.len; b++) {
+            for (size_t i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) {
+                s.block_of[i] = (int)b;
+            }
+        }
+        for (int t = 0; t < fn->temp_count; t++) {
+            s.defs[t] = -1;
+        }
+        for (size_t i = 0; i < fn->code.len; i++) {
+            int d = ir_instr_def(&fn->code.items[i]);
+            if (d >= 0) {
+                s.defs[d] = (int)i;
+            }
+        }
+
+        int hoisted = 0;
+        for (size_t l = cfg.loop_count; l > 0 && !hoisted; l--) {
+            s.loop = &cfg.loops[l - 1];
+            find_invariants(&s);
+            if (s.order_len > 0) {
+                hoist(fn, &s);
+                hoisted = 1;
+            }
+        }
+
+        free(s.order);
+        free(s.invariant);
+        free(s.stored);
+        free(s.in_loop);
+        free(s.defs);
+        free(s.block_of);
+        free_cfg(&cfg);
+        if (!hoisted) {
+            break;
+        }
+        changed = 1;
+    }
+    return changed;
+}
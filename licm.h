@@ -0,0 +1,8 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include "ir.h"
+
+int licm_function(IRFunction *fn);
+
+#endif
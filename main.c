@@ -1,8 +1,11 @@
 #include "ast.h"
+#include "cfg.h"
 #include "codegen.h"
 #include "ir.h"
 #include "lexer.h"
+#include "opt.h"
 #include "parser.h"
+#include "profile.h"
 #include "semantic.h"
 #include "update.h"
 #include "utils.h"
@@ -61,11 +64,125 @@ static void print_ascii_art(void) {
 static void usage(void) {
     printf(
             "Available commands:\n"
-            "anemo build <file.anm>\n"
-            "anemo run <file.anm>\n"
+            "anemo build [options] <file.anm>\n"
+            "anemo run [options] <file.anm>\n"
             "anemo vortex\n"
             "anemo update\n"
-            "anemo version\n");
+            "anemo version\n"
+            "\n"
+            "Build options:\n"
+            "-O0 | -O1 | -O2       Optimization level (default -O1)\n"
+            "--inline=off|small|aggressive\n"
+            "                      Inlining of small glyphs (default: small at -O1, aggressive at -O2)\n"
+            "--unroll=N            Unroll counted loops N times, 1 disables (default: 4 at -O2, 1 otherwise)\n"
+            "--simd=off|sse2|avx2  Instruction set for array loops (default: sse2 at -O1 and above;\n"
+            "                      avx2 needs a CPU that supports it)\n"
+            "--profile-generate[=path]\n"
+            "                      Count branches and calls at run time and write them to path\n"
+            "                      (default: <file>.anmprof) when the program exits\n"
+            "--profile-use[=path]  Guide inlining and block layout by a profile written by\n"
+            "                      a --profile-generate build of the same source\n"
+            "--line-buffered       Write chant output after every line even when it does not\n"
+            "                      go to a terminal, for programs read through a pipe\n"
+            "--no-libc             Link statically without libc, using system calls directly (Linux)\n"
+            "--opt-report          List optimization decisions such as inlined and rejected calls\n"
+            "--dump-ir             Print the optimized IR\n"
+            "--dump-cfg            Print basic blocks, dominators and loops of the optimized IR\n"
+            "--verify-ir           Check IR invariants after every optimization stage\n");
+}
+
+typedef struct BuildOptions {
+    OptOptions opt;
+    CodegenOptions codegen;
+    int dump_ir;
+    int dump_cfg;
+    int profile_generate;
+    int profile_use;
+    const char *profile_path; /* NULL for <stem>.anmprof */
+} BuildOptions;
+
+static int parse_build_args(int argc, char **argv, BuildOptions *opts, const char **out_src) {
+    memset(opts, 0, sizeof(*opts));
+    opts->opt.level = 1;
+    int inline_level = -1;
+    int simd = -1;
+    int unroll = -1;
+    *out_src = NULL;
+
+    for (int i = 2; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-O0") == 0 || strcmp(arg, "-O1") == 0 || strcmp(arg, "-O2") == 0) {
+            opts->opt.level = arg[2] - '0';
+        } else if (strcmp(arg, "--dump-ir") == 0) {
+            opts->dump_ir = 1;
+        } else if (strcmp(arg, "--dump-cfg") == 0) {
+            opts->dump_cfg = 1;
+        } else if (strcmp(arg, "--verify-ir") == 0) {
+            opts->opt.verify = 1;
+        } else if (strcmp(arg, "--opt-report") == 0) {
+            opts->opt.report = 1;
+        } else if (strcmp(arg, "--line-buffered") == 0) {
+            opts->codegen.line_buffered = 1;
+        } else if (strcmp(arg, "--no-libc") == 0) {
+#ifdef _WIN32
+            fprintf(stderr, "error: --no-libc is only supported on Linux\n");
+            return 0;
+#else
+            opts->codegen.libc_free = 1;
+#endif
+        } else if (strcmp(arg, "--inline=off") == 0) {
+            inline_level = 0;
+        } else if (strcmp(arg, "--inline=small") == 0) {
+            inline_level = 1;
+        } else if (strcmp(arg, "--inline=aggressive") == 0) {
+            inline_level = 2;
+        } else if (strcmp(arg, "--simd=off") == 0) {
+            simd = SIMD_OFF;
+        } else if (strcmp(arg, "--simd=sse2") == 0) {
+            simd = SIMD_SSE2;
+        } else if (strcmp(arg, "--simd=avx2") == 0) {
+            simd = SIMD_AVX2;
+        } else if (strncmp(arg, "--unroll=", 9) == 0) {
+            char *end;
+            long n = strtol(arg + 9, &end, 10);
+            if (end == arg + 9 || *end != '\0' || n < 1 || n > 16) {
+                fprintf(stderr, "error: --unroll expects a factor from 1 to 16\n");
+                return 0;
+            }
+            unroll = (int)n;
+        } else if (strcmp(arg, "--profile-generate") == 0 || strncmp(arg, "--profile-generate=", 19) == 0) {
+            opts->profile_generate = 1;
+            opts->profile_path = arg[18] == '=' ? arg + 19 : opts->profile_path;
+        } else if (strcmp(arg, "--profile-use") == 0 || strncmp(arg, "--profile-use=", 14) == 0) {
+            opts->profile_use = 1;
+            opts->profile_path = arg[13] == '=' ? arg + 14 : opts->profile_path;
+        } else if (arg[0] == '-') {
+            fprintf(stderr, "error: unknown build option '%s'\n", arg);
+            return 0;
+        } else if (*out_src) {
+            fprintf(stderr, "error: only one source file may be given\n");
+            return 0;
+        } else {
+            *out_src = arg;
+        }
+    }
+    if (opts->profile_generate && opts->profile_use) {
+        fprintf(stderr, "error: --profile-generate and --profile-use cannot be combined\n");
+        return 0;
+    }
+    if (opts->profile_path && opts->profile_path[0] == '\0') {
+        fprintf(stderr, "error: empty profile path\n");
+        return 0;
+    }
+    opts->opt.inline_level = inline_level >= 0 ? inline_level : opts->opt.level;
+    opts->opt.unroll = unroll >= 0 ? unroll : opts->opt.level >= 2 ? 4 : 1;
+    opts->codegen.peephole = opts->opt.level >= 1;
+    opts->codegen.omit_frames = opts->opt.level >= 1;
+    opts->codegen.split_cold = opts->opt.level >= 1;
+    opts->codegen.align_loops = opts->opt.level >= 1;
+    opts->codegen.simd = simd >= 0 ? (SimdLevel)simd : opts->opt.level >= 1 ? SIMD_SSE2 : SIMD_OFF;
+    opts->codegen.report = opts->opt.report;
+    return *out_src != NULL;
 }
 
 static int write_file_all_text(const char *path, const char *text) {
@@ -324,14 +441,13 @@ static void run_vortex(const char *self_path) {
     free(buffer);
 }
 
-static void compile_source(const char *input_path, const char *binary_out) {
+static void compile_source(const char *input_path, const char *binary_out, const BuildOptions *opts) {
     if (!has_extension(input_path, ".anm")) {
         fatal("input file must use .anm extension");
     }
 
     size_t src_size = 0;
     char *src = read_file_all(input_path, &src_size);
-    (void)src_size;
 
     TokenArray tokens;
     lex_source(input_path, src, &tokens);
@@ -345,17 +461,40 @@ static void compile_source(const char *input_path, const char *binary_out) {
         fatal("semantic pass failed");
     }
 
+    char *stem = path_stem(input_path);
+    char profile_path[512];
+    snprintf(profile_path, sizeof(profile_path), "%s.anmprof", stem);
+    if (opts->profile_path) {
+        snprintf(profile_path, sizeof(profile_path), "%s", opts->profile_path);
+    }
+
     IRProgram ir;
     ir_generate_program(&program, &ir);
-
-    char *stem = path_stem(input_path);
+    unsigned long hash = profile_source_hash(src, src_size);
+    CodegenOptions codegen = opts->codegen;
+    if (opts->profile_generate) {
+        profile_instrument(&ir, hash);
+        codegen.profile_path = profile_path;
+    } else if (opts->profile_use) {
+        Profile prof;
+        profile_load(profile_path, &prof);
+        profile_annotate(&ir, &prof, hash, profile_path);
+        free_profile(&prof);
+    }
+    ir_optimize_program(&ir, &opts->opt);
+    if (opts->dump_ir) {
+        ir_dump_program(stdout, &ir);
+    }
+    if (opts->dump_cfg) {
+        cfg_dump_program(stdout, &ir);
+    }
 
     char asm_path[512];
     char obj_path[512];
     snprintf(asm_path, sizeof(asm_path), "%s.s", stem);
     snprintf(obj_path, sizeof(obj_path), "%s.o", stem);
 
-    codegen_emit_assembly(&ir, asm_path);
+    codegen_emit_assembly(&ir, asm_path, &codegen);
 
     char cmd_as[1024];
     snprintf(cmd_as, sizeof(cmd_as), "as -o \"%s\" \"%s\"", obj_path, asm_path);
@@ -364,7 +503,8 @@ static void compile_source(const char *input_path, const char *binary_out) {
     }
 
     char cmd_link[1024];
-    snprintf(cmd_link, sizeof(cmd_link), "gcc -no-pie -o \"%s\" \"%s\"", binary_out, obj_path);
+    snprintf(cmd_link, sizeof(cmd_link), "gcc -no-pie %s-o \"%s\" \"%s\"",
+             codegen.libc_free ? "-nostdlib -static " : "", binary_out, obj_path);
     if (system(cmd_link) != 0) {
         fatal("linker failed: %s", cmd_link);
     }
@@ -399,11 +539,16 @@ int main(int argc, char **argv) {
         return anemo_run_update(ANEMO_VERSION);
     }
 
-    if ((strcmp(argv[1], "build") == 0 || strcmp(argv[1], "run") == 0) && argc == 3) {
-        const char *src = argv[2];
+    if (strcmp(argv[1], "build") == 0 || strcmp(argv[1], "run") == 0) {
+        BuildOptions opts;
+        const char *src = NULL;
+        if (!parse_build_args(argc, argv, &opts, &src)) {
+            usage();
+            return 1;
+        }
         char *stem = path_stem(src);
 
-        compile_source(src, stem);
+        compile_source(src, stem, &opts);
 
         if (strcmp(argv[1], "build") == 0) {
             printf("built: %s\n", stem);
@@ -0,0 +1,201 @@
+#include "mcode.h"
+
+#include "utils.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void grow(void **items, size_t *cap, size_t elem_size) {
+    size_t next = *cap == 0 ? 8 : *cap * 2;
+    *items = xrealloc(*items, next * elem_size);
+    *cap = next;
+}
+
+void mcode_init(MCode *code) {
+    memset(code, 0, sizeof(*code));
+}
+
+static void push_minstr(MCode *code, MInstr mi) {
+    if (code->len == code->cap) {
+        grow((void **)&code->items, &code->cap, sizeof(MInstr));
+    }
+    code->items[code->len++] = mi;
+}
+
+static MInstr make_raw(MInstrKind kind, const char *text, size_t len) {
+    MInstr mi;
+    memset(&mi, 0, sizeof(mi));
+    mi.kind = kind;
+    mi.text = xmalloc(len + 1);
+    memcpy(mi.text, text, len);
+    mi.text[len] = '\0';
+    return mi;
+}
+
+/* Splits "  op a, b" into mnemonic and operands. Commas inside parentheses
+   belong to memory operands. Returns 0 for lines that do not fit, which are
+   then kept verbatim. */
+static int parse_op(const char *p, const char *end, MInstr *mi) {
+    const char *s = p;
+    while (p < end && !isspace((unsigned char)*p)) {
+        p++;
+    }
+    if ((size_t)(p - s) >= sizeof(mi->op)) {
+        return 0;
+    }
+    memcpy(mi->op, s, (size_t)(p - s));
+    mi->op[p - s] = '\0';
+    mi->argc = 0;
+    while (p < end) {
+        while (p < end && isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        if (mi->argc == MCODE_MAX_ARGS) {
+            return 0;
+        }
+        s = p;
+        int depth = 0;
+        while (p < end && (depth > 0 || *p != ',')) {
+            depth += *p == '(' ? 1 : *p == ')' ? -1 : 0;
+            p++;
+        }
+        const char *e = p;
+        while (e > s && isspace((unsigned char)e[-1])) {
+            e--;
+        }
+        if ((size_t)(e - s) >= sizeof(mi->args[0]) || e == s) {
+            return 0;
+        }
+        memcpy(mi->args[mi->argc], s, (size_t)(e - s));
+        mi->args[mi->argc][e - s] = '\0';
+        mi->argc++;
+        if (p < end) {
+            p++;
+        }
+    }
+    return 1;
+}
+
+static void add_line(MCode *code, const char *line, size_t len) {
+    const char *p = line;
+    const char *end = line + len;
+    while (p < end && isspace((unsigned char)*p)) {
+        p++;
+    }
+    int has_space = 0;
+    for (const char *q = p; q < end; q++) {
+        has_space |= isspace((unsigned char)*q) != 0;
+    }
+    if (p < end && end[-1] == ':' && !has_space) {
+        push_minstr(code, make_raw(MINSTR_LABEL, p, (size_t)(end - p - 1)));
+        return;
+    }
+    if (p < end && *p != '.') {
+        MInstr mi;
+        memset(&mi, 0, sizeof(mi));
+        mi.kind = MINSTR_OP;
+        if (parse_op(p, end, &mi)) {
+            push_minstr(code, mi);
+            return;
+        }
+    }
+    push_minstr(code, make_raw(MINSTR_RAW, line, len));
+}
+
+/* Appends printf-formatted assembly text. Complete lines become machine
+   instructions; an unterminated tail waits for the next call. */
+void mcode_emit(MCode *code, const char *fmt, ...) {
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    char *text = buf;
+    if (n < 0) {
+        fatal("internal error: cannot format assembly");
+    }
+    if ((size_t)n >= sizeof(buf)) {
+        text = xmalloc((size_t)n + 1);
+        va_start(ap, fmt);
+        vsnprintf(text, (size_t)n + 1, fmt, ap);
+        va_end(ap);
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (text[i] != '\n') {
+            if (code->pending_len + 1 >= code->pending_cap) {
+                grow((void **)&code->pending, &code->pending_cap, 1);
+            }
+            code->pending[code->pending_len++] = text[i];
+            continue;
+        }
+        add_line(code, code->pending ? code->pending : "", code->pending_len);
+        code->pending_len = 0;
+    }
+    if (text != buf) {
+        free(text);
+    }
+}
+
+void mcode_set_op(MInstr *mi, const char *op, int argc, const char *a0, const char *a1) {
+    char tmp[2][64];
+    snprintf(tmp[0], sizeof(tmp[0]), "%s", a0 ? a0 : "");
+    snprintf(tmp[1], sizeof(tmp[1]), "%s", a1 ? a1 : "");
+    snprintf(mi->op, sizeof(mi->op), "%s", op);
+    memcpy(mi->args[0], tmp[0], sizeof(tmp[0]));
+    memcpy(mi->args[1], tmp[1], sizeof(tmp[1]));
+    mi->args[2][0] = '\0';
+    mi->argc = argc;
+}
+
+void mcode_compact(MCode *code) {
+    size_t out = 0;
+    for (size_t i = 0; i < code->len; i++) {
+        if (code->items[i].kind == MINSTR_DEAD) {
+            free(code->items[i].text);
+            continue;
+        }
+        code->items[out++] = code->items[i];
+    }
+    code->len = out;
+}
+
+void mcode_write(FILE *out, const MCode *code) {
+    for (size_t i = 0; i < code->len; i++) {
+        const MInstr *mi = &code->items[i];
+        switch (mi->kind) {
+            case MINSTR_OP:
+                fprintf(out, "  %s", mi->op);
+                for (int a = 0; a < mi->argc; a++) {
+                    fprintf(out, "%s%s", a == 0 ? " " : ", ", mi->args[a]);
+                }
+                fputc('\n', out);
+                break;
+            case MINSTR_LABEL:
+                fprintf(out, "%s:\n", mi->text);
+                break;
+            case MINSTR_RAW:
+                fprintf(out, "%s\n", mi->text);
+                break;
+            case MINSTR_DEAD:
+                break;
+        }
+    }
+    if (code->pending_len > 0) {
+        fwrite(code->pending, 1, code->pending_len, out);
+    }
+}
+
+void free_mcode(MCode *code) {
+    for (size_t i = 0; i < code->len; i++) {
+        free(code->items[i].text);
+    }
+    free(code->items);
+    free(code->pending);
+    memset(code, 0, sizeof(*code));
+}
@@ -0,0 +1,40 @@
+#ifndef MCODE_H
+#define MCODE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define MCODE_MAX_ARGS 3
+
+typedef enum MInstrKind {
+    MINSTR_OP,    /* instruction with mnemonic and operands */
+    MINSTR_LABEL, /* text holds the label name without ':' */
+    MINSTR_RAW,   /* directive or anything else, text holds the line */
+    MINSTR_DEAD   /* removed, skipped when writing */
+} MInstrKind;
+
+typedef struct MInstr {
+    MInstrKind kind;
+    char *text;
+    char op[16];
+    char args[MCODE_MAX_ARGS][64];
+    int argc;
+} MInstr;
+
+typedef struct MCode {
+    MInstr *items;
+    size_t len;
+    size_t cap;
+    char *pending; /* partial line not yet terminated by '\n' */
+    size_t pending_len;
+    size_t pending_cap;
+} MCode;
+
+void mcode_init(MCode *code);
+void mcode_emit(MCode *code, const char *fmt, ...);
+void mcode_set_op(MInstr *mi, const char *op, int argc, const char *a0, const char *a1);
+void mcode_compact(MCode *code);
+void mcode_write(FILE *out, const MCode *code);
+void free_mcode(MCode *code);
+
+#endif
@@ -0,0 +1,780 @@
+#include "opt.h"
+
+#include "bce.h"
+#include "ceval.h"
+#include "cfg.h"
+#include "gvn.h"
+#include "inline.h"
+#include "layout.h"
+#include "licm.h"
+#include "scev.h"
+#include "ssa.h"
+#include "tailrec.h"
+#include "unroll.h"
+#include "utils.h"
+#include "verify.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int *temp_use_counts(const IRFunction *fn) {
+    int *uses = xcalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1), sizeof(int));
+    for (size_t i = 0; i < fn->code.len; i++) {
+        int ops[IR_MAX_USES];
+        int n = ir_instr_uses(&fn->code.items[i], ops);
+        for (int k = 0; k < n; k++) {
+            uses[ops[k]]++;
+        }
+    }
+    return uses;
+}
+
+static const IRInstr *const_def(const IRFunction *fn, const int *defs, int temp) {
+    if (temp < 0 || defs[temp] < 0) {
+        return NULL;
+    }
+    const IRInstr *d = &fn->code.items[defs[temp]];
+    if (d->op == IROP_IMM_INT || d->op == IROP_IMM_BOOL || d->op == IROP_IMM_STR) {
+        return d;
+    }
+    return NULL;
+}
+
+static int binop_yields_int(IRBinOp op) {
+    return op == IRBIN_ADD || op == IRBIN_SUB || op == IRBIN_MUL || op == IRBIN_DIV;
+}
+
+/* Branch folding changes the CFG, so it is skipped while phis name their
+   predecessor blocks. */
+static int fold_constants(IRFunction *fn, int fold_branches) {
+    int *defs = ir_temp_defs(fn);
+    unsigned char *dead = xcalloc(fn->code.len + 1, 1);
+    int changed = 0;
+    int removed = 0;
+
+    for (size_t i = 0; i < fn->code.len; i++) {
+        IRInstr *in = &fn->code.items[i];
+        if (in->op == IROP_BIN) {
+            const IRInstr *a = const_def(fn, defs, in->src1);
+            const IRInstr *b = const_def(fn, defs, in->src2);
+            long v = 0;
+            if (!a || !b) {
+                continue;
+            }
+            /* Interned strings only fold for text_same, which between literals
+               is identity. */
+            if ((a->op == IROP_IMM_STR || b->op == IROP_IMM_STR) && in->binop != IRBIN_TEXT_SAME) {
+                continue;
+            }
+            if (!ir_fold_binop(in->binop, a->imm, b->imm, &v)) {
+                continue;
+            }
+            in->op = binop_yields_int(in->binop) ? IROP_IMM_INT : IROP_IMM_BOOL;
+            in->imm = v;
+            changed = 1;
+        } else if (in->op == IROP_UN) {
+            const IRInstr *a = const_def(fn, defs, in->src1);
+            if (!a || a->op == IROP_IMM_STR) {
+                continue;
+            }
+            if (in->unop == IRUN_NEG) {
+                in->op = IROP_IMM_INT;
+                in->imm = (long)(0UL - (unsigned long)a->imm);
+            } else {
+                in->op = IROP_IMM_BOOL;
+                in->imm = a->imm == 0;
+            }
+            changed = 1;
+        } else if (in->op == IROP_CHECK_INDEX) {
+            const IRInstr *c = const_def(fn, defs, in->src1);
+            if (c && c->imm >= 0 && c->imm < in->imm) {
+                dead[i] = 1;
+                removed = 1;
+                changed = 1;
+            }
+        } else if (in->op == IROP_JMP_FALSE && fold_branches) {
+            const IRInstr *c = const_def(fn, defs, in->src1);
+            if (!c) {
+                continue;
+            }
+            if (c->imm != 0) {
+                dead[i] = 1;
+                removed = 1;
+            } else {
+                in->op = IROP_JMP;
+            }
+            changed = 1;
+        }
+    }
+
+    if (removed) {
+        ir_remove_instrs(fn, dead);
+    }
+    free(dead);
+    free(defs);
+    return changed;
+}
+
+static int remove_unreachable(IRFunction *fn) {
+    CFG cfg;
+    cfg_build(fn, &cfg);
+    unsigned char *dead = xcalloc(fn->code.len + 1, 1);
+    int changed = 0;
+    for (size_t b = 0; b < cfg.len; b++) {
+        if (cfg.blocks[b].reachable) {
+            continue;
+        }
+        for (size_t i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) {
+            dead[i] = 1;
+        }
+        changed = 1;
+    }
+    if (changed) {
+        ir_remove_instrs(fn, dead);
+    }
+    free(dead);
+    free_cfg(&cfg);
+    return changed;
+}
+
+/* Follows chains of labels that are immediately followed by an unconditional
+   jump, so branches land on their final destination. */
+static int final_target(const IRFunction *fn, const int *label_pos, int label) {
+    for (int hops = 0; hops < 16; hops++) {
+        size_t i = (size_t)label_pos[label];
+        while (i < fn->code.len && fn->code.items[i].op == IROP_LABEL) {
+            i++;
+        }
+        if (i >= fn->code.len || fn->code.items[i].op != IROP_JMP || fn->code.items[i].label == label) {
+            break;
+        }
+        label = fn->code.items[i].label;
+    }
+    return label;
+}
+
+static int simplify_jumps(IRFunction *fn) {
+    int nlabels = fn->label_count > 0 ? fn->label_count : 1;
+    int *label_pos = xmalloc((size_t)nlabels * sizeof(int));
+    int *refs = xcalloc((size_t)nlabels, sizeof(int));
+    unsigned char *dead = xcalloc(fn->code.len + 1, 1);
+    int changed = 0;
+
+    for (size_t i = 0; i < fn->code.len; i++) {
+        if (fn->code.items[i].op == IROP_LABEL) {
+            label_pos[fn->code.items[i].label] = (int)i;
+        }
+    }
+
+    for (size_t i = 0; i < fn->code.len; i++) {
+        IRInstr *in = &fn->code.items[i];
+        if (in->op != IROP_JMP && in->op != IROP_JMP_FALSE) {
+            continue;
+        }
+        int target = final_target(fn, label_pos, in->label);
+        if (target != in->label) {
+            in->label = target;
+            changed = 1;
+        }
+        size_t next = i + 1;
+        int to_next = 0;
+        while (next < fn->code.len && fn->code.items[next].op == IROP_LABEL) {
+            if (fn->code.items[next].label == in->label) {
+                to_next = 1;
+            }
+            next++;
+        }
+        if (to_next) {
+            dead[i] = 1;
+            changed = 1;
+            continue;
+        }
+        refs[in->label]++;
+    }
+
+    /* The label starting the cold blocks stays even when only reached by
+       falling through; codegen switches sections there. */
+    for (size_t i = 0; i < fn->code.len; i++) {
+        int label = fn->code.items[i].label;
+        if (fn->code.items[i].op == IROP_LABEL && refs[label] == 0 && label != fn->cold_label) {
+            dead[i] = 1;
+            changed = 1;
+        }
+    }
+
+    if (changed) {
+        ir_remove_instrs(fn, dead);
+    }
+    free(dead);
+    free(refs);
+    free(label_pos);
+    return changed;
+}
+
+/* Store-to-load forwarding state: for every variable slot, the temp that is
+   known to hold its current value, or -1. */
+static void avail_transfer(const IRInstr *in, int *avail, size_t nvars, int *replace_with) {
+    *replace_with = -1;
+    if (in->op == IROP_LOAD_VAR && avail[in->var_index] >= 0) {
+        *replace_with = avail[in->var_index];
+        return;
+    }
+    int d = ir_instr_def(in);
+    if (d >= 0) {
+        /* A temp redefined on a later loop iteration no longer mirrors the slot. */
+        for (size_t v = 0; v < nvars; v++) {
+            if (avail[v] == d) {
+                avail[v] = -1;
+            }
+        }
+    }
+    if (in->op == IROP_LOAD_VAR) {
+        avail[in->var_index] = in->dst;
+    } else if (in->op == IROP_STORE_VAR) {
+        avail[in->var_index] = in->src1;
+    }
+}
+
+static int resolve_temp(const int *rename, int t) {
+    while (rename[t] >= 0) {
+        t = rename[t];
+    }
+    return t;
+}
+
+static void avail_meet(const CFG *cfg, size_t b, const int *avail_out, const unsigned char *seen,
+                       size_t nvars, int *avail) {
+    const CFGBlock *blk = &cfg->blocks[b];
+    int first = 1;
+    for (size_t v = 0; v < nvars; v++) {
+        avail[v] = -1;
+    }
+    if (b == 0) {
+        return;
+    }
+    for (size_t p = 0; p < blk->preds.len; p++) {
+        size_t pred = (size_t)blk->preds.items[p];
+        if (!seen[pred]) {
+            continue;
+        }
+        const int *out = &avail_out[pred * nvars];
+        for (size_t v = 0; v < nvars; v++) {
+            if (first) {
+                avail[v] = out[v];
+            } else if (avail[v] != out[v]) {
+                avail[v] = -1;
+            }
+        }
+        first = 0;
+    }
+}
+
+static int forward_stores(IRFunction *fn) {
+    size_t nvars = fn->vars.len;
+    if (nvars == 0 || fn->code.len == 0) {
+        return 0;
+    }
+    CFG cfg;
+    cfg_build(fn, &cfg);
+
+    int *avail_out = xmalloc(cfg.len * nvars * sizeof(int));
+    unsigned char *seen = xcalloc(cfg.len, 1);
+    int *avail = xmalloc(nvars * sizeof(int));
+    int replace_with = -1;
+
+    /* Forward must-availability: a slot maps to a temp at block entry only if
+       every visited predecessor agrees on the same temp. Any fixed point is
+       sound, so iterate until the block outputs settle. */
+    int changed = 1;
+    int rounds = 0;
+    while (changed && rounds < 64) {
+        changed = 0;
+        rounds++;
+        for (size_t b = 0; b < cfg.len; b++) {
+            const CFGBlock *blk = &cfg.blocks[b];
+            avail_meet(&cfg, b, avail_out, seen, nvars, avail);
+            for (size_t i = blk->start; i < blk->end; i++) {
+                avail_transfer(&fn->code.items[i], avail, nvars, &replace_with);
+            }
+            int *out = &avail_out[b * nvars];
+            if (!seen[b] || memcmp(out, avail, nvars * sizeof(int)) != 0) {
+                memcpy(out, avail, nvars * sizeof(int));
+                seen[b] = 1;
+                changed = 1;
+            }
+        }
+    }
+
+    int *rename = xmalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1) * sizeof(int));
+    unsigned char *dead = xcalloc(fn->code.len + 1, 1);
+    int forwarded = 0;
+    for (int t = 0; t < fn->temp_count; t++) {
+        rename[t] = -1;
+    }
+    for (size_t b = 0; b < cfg.len && !changed; b++) {
+        const CFGBlock *blk = &cfg.blocks[b];
+        avail_meet(&cfg, b, avail_out, seen, nvars, avail);
+        for (size_t i = blk->start; i < blk->end; i++) {
+            avail_transfer(&fn->code.items[i], avail, nvars, &replace_with);
+            if (replace_with >= 0) {
+                rename[fn->code.items[i].dst] = replace_with;
+                dead[i] = 1;
+                forwarded = 1;
+            }
+        }
+    }
+
+    if (forwarded) {
+        for (size_t i = 0; i < fn->code.len; i++) {
+            int *refs[IR_MAX_USES];
+            int n = ir_instr_use_refs(&fn->code.items[i], refs);
+            for (int k = 0; k < n; k++) {
+                *refs[k] = resolve_temp(rename, *refs[k]);
+            }
+        }
+        ir_remove_instrs(fn, dead);
+    }
+
+    free(dead);
+    free(rename);
+    free(avail);
+    free(seen);
+    free(avail_out);
+    free_cfg(&cfg);
+    return forwarded;
+}
+
+static int is_removable(const IRFunction *fn, const int *defs, const IRInstr *in) {
+    switch (in->op) {
+        case IROP_IMM_INT:
+        case IROP_IMM_BOOL:
+        case IROP_IMM_STR:
+        case IROP_LOAD_VAR:
+        case IROP_UN:
+        case IROP_PHI:
+        case IROP_ARRAY_LOAD:
+        case IROP_VEC_SUM:
+            return 1;
+        case IROP_BIN: {
+            if (in->binop != IRBIN_DIV) {
+                return 1;
+            }
+            /* Keep divisions that may trap at runtime. */
+            const IRInstr *d = const_def(fn, defs, in->src2);
+            return d && d->imm != 0 && d->imm != -1;
+        }
+        default:
+            return 0;
+    }
+}
+
+/* A store whose slot is not live afterwards is dead. */
+static void mark_dead_stores(const IRFunction *fn, const CFG *cfg, unsigned char *dead) {
+    size_t nvars = fn->vars.len;
+    if (nvars == 0 || cfg->len == 0) {
+        return;
+    }
+    unsigned char *live_in = cfg_var_live_in(fn, cfg);
+    unsigned char *live = xmalloc(nvars);
+
+    for (size_t b = 0; b < cfg->len; b++) {
+        const CFGBlock *blk = &cfg->blocks[b];
+        memset(live, 0, nvars);
+        for (size_t s = 0; s < blk->succs.len; s++) {
+            const unsigned char *in = &live_in[(size_t)blk->succs.items[s] * nvars];
+            for (size_t v = 0; v < nvars; v++) {
+                live[v] |= in[v];
+            }
+        }
+        for (size_t i = blk->end; i > blk->start; i--) {
+            const IRInstr *in = &fn->code.items[i - 1];
+            if (in->op == IROP_STORE_VAR) {
+                if (!live[in->var_index]) {
+                    dead[i - 1] = 1;
+                }
+                live[in->var_index] = 0;
+            } else if (in->op == IROP_LOAD_VAR) {
+                live[in->var_index] = 1;
+            }
+        }
+    }
+
+    free(live);
+    free(live_in);
+}
+
+static int eliminate_dead_code(IRFunction *fn) {
+    int changed = 0;
+    for (;;) {
+        CFG cfg;
+        cfg_build(fn, &cfg);
+        unsigned char *dead = xcalloc(fn->code.len + 1, 1);
+        mark_dead_stores(fn, &cfg, dead);
+        free_cfg(&cfg);
+
+        int *defs = ir_temp_defs(fn);
+        int *uses = temp_use_counts(fn);
+        for (size_t i = 0; i < fn->code.len; i++) {
+            if (!dead[i]) {
+                continue;
+            }
+            int ops[IR_MAX_USES];
+            int n = ir_instr_uses(&fn->code.items[i], ops);
+            for (int k = 0; k < n; k++) {
+                uses[ops[k]]--;
+            }
+        }
+        for (size_t i = fn->code.len; i > 0; i--) {
+            IRInstr *in = &fn->code.items[i - 1];
+            int d = ir_instr_def(in);
+            if (dead[i - 1] || d < 0 || uses[d] > 0 || !is_removable(fn, defs, in)) {
+                continue;
+            }
+            dead[i - 1] = 1;
+            int ops[IR_MAX_USES];
+            int n = ir_instr_uses(in, ops);
+            for (int k = 0; k < n; k++) {
+                uses[ops[k]]--;
+            }
+        }
+
+        int removed = 0;
+        for (size_t i = 0; i < fn->code.len; i++) {
+            removed |= dead[i];
+        }
+        if (removed) {
+            ir_remove_instrs(fn, dead);
+            changed = 1;
+        }
+        free(uses);
+        free(defs);
+        free(dead);
+        if (!removed) {
+            break;
+        }
+    }
+    return changed;
+}
+
+/* Renumbers temps and non-parameter variables densely so the frame only
+   holds slots that survived the passes above. */
+static void compact_slots(IRFunction *fn) {
+    int *temp_map = xmalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1) * sizeof(int));
+    int *var_map = xmalloc((fn->vars.len > 0 ? fn->vars.len : 1) * sizeof(int));
+    for (int t = 0; t < fn->temp_count; t++) {
+        temp_map[t] = -1;
+    }
+    for (size_t v = 0; v < fn->vars.len; v++) {
+        var_map[v] = (int)v < fn->param_count ? (int)v : -1;
+    }
+
+    int next_temp = 0;
+    int next_var = fn->param_count;
+    for (size_t i = 0; i < fn->code.len; i++) {
+        IRInstr *in = &fn->code.items[i];
+        int d = ir_instr_def(in);
+        if (d >= 0 && temp_map[d] < 0) {
+            temp_map[d] = next_temp++;
+        }
+        int *vars[3];
+        int nvars = ir_instr_var_refs(in, vars);
+        for (int k = 0; k < nvars; k++) {
+            if (var_map[*vars[k]] < 0) {
+                var_map[*vars[k]] = next_var++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < fn->code.len; i++) {
+        IRInstr *in = &fn->code.items[i];
+        int *refs[IR_MAX_USES];
+        int n = ir_instr_use_refs(in, refs);
+        for (int k = 0; k < n; k++) {
+            *refs[k] = temp_map[*refs[k]];
+        }
+        if (ir_instr_def(in) >= 0) {
+            in->dst = temp_map[in->dst];
+        }
+        int *vars[3];
+        int nvars = ir_instr_var_refs(in, vars);
+        for (int k = 0; k < nvars; k++) {
+            *vars[k] = var_map[*vars[k]];
+        }
+    }
+
+    IRVar *vars = xmalloc((size_t)(next_var > 0 ? next_var : 1) * sizeof(IRVar));
+    for (size_t v = 0; v < fn->vars.len; v++) {
+        if (var_map[v] >= 0) {
+            vars[var_map[v]] = fn->vars.items[v];
+        } else {
+            free(fn->vars.items[v].name);
+        }
+    }
+    free(fn->vars.items);
+    fn->vars.items = vars;
+    fn->vars.len = (size_t)next_var;
+    fn->vars.cap = (size_t)(next_var > 0 ? next_var : 1);
+    fn->temp_count = next_temp;
+
+    free(var_map);
+    free(temp_map);
+}
+
+/* A phi whose operands are all the same temp (or the phi itself, around a
+   loop) is just that temp. */
+static int simplify_phis(IRFunction *fn) {
+    int *rename = xmalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1) * sizeof(int));
+    unsigned char *dead = xcalloc(fn->code.len + 1, 1);
+    int changed = 0;
+    for (int t = 0; t < fn->temp_count; t++) {
+        rename[t] = -1;
+    }
+
+    for (size_t i = 0; i < fn->code.len; i++) {
+        const IRInstr *in = &fn->code.items[i];
+        if (in->op != IROP_PHI) {
+            continue;
+        }
+        int same = -1;
+        int unique = 1;
+        for (int k = 0; k < in->phi_count && unique; k++) {
+            int t = resolve_temp(rename, in->phi_temps[k]);
+            if (t == in->dst || t == same) {
+                continue;
+            }
+            unique = same < 0;
+            same = t;
+        }
+        if (unique && same >= 0) {
+            rename[in->dst] = same;
+            dead[i] = 1;
+            changed = 1;
+        }
+    }
+
+    if (changed) {
+        for (size_t i = 0; i < fn->code.len; i++) {
+            int *refs[IR_MAX_USES];
+            int n = ir_instr_use_refs(&fn->code.items[i], refs);
+            for (int k = 0; k < n; k++) {
+                *refs[k] = resolve_temp(rename, *refs[k]);
+            }
+        }
+        ir_remove_instrs(fn, dead);
+    }
+    free(dead);
+    free(rename);
+    return changed;
+}
+
+/* What chanting the constant defined by def prints, without the newline,
+   appended to *text. */
+static void render_constant(const IRProgram *ir, const IRInstr *chant, const IRInstr *def, char **text, size_t *len) {
+    char num[32];
+    const char *piece = num;
+    size_t n = 0;
+    if (chant->type == TYPE_STRING) {
+        piece = "";
+        for (size_t k = 0; k < ir->strings.len; k++) {
+            if (ir->strings.items[k].id == def->imm) {
+                piece = ir->strings.items[k].value;
+                n = ir->strings.items[k].len;
+            }
+        }
+    } else if (chant->type == TYPE_BOOL) {
+        piece = def->imm ? "yes" : "no";
+        n = strlen(piece);
+    } else {
+        n = (size_t)snprintf(num, sizeof(num), "%ld", def->imm);
+    }
+    *text = xrealloc(*text, *len + n + 2);
+    memcpy(*text + *len, piece, n);
+    *len += n;
+    (*text)[*len] = '\0';
+}
+
+static int constant_chant(const IRFunction *fn, const int *defs, const IRInstr *in) {
+    return in->op == IROP_CHANT && const_def(fn, defs, in->src1) != NULL;
+}
+
+/* Instructions that may sit between merged chants: they cannot stop the
+   program and nothing they do can be seen from outside. */
+static int invisible(const IRInstr *in) {
+    switch (in->op) {
+        case IROP_IMM_INT:
+        case IROP_IMM_BOOL:
+        case IROP_IMM_STR:
+        case IROP_LOAD_VAR:
+        case IROP_STORE_VAR:
+        case IROP_UN:
+        case IROP_ARRAY_LOAD:
+        case IROP_COUNT:
+            return 1;
+        case IROP_BIN:
+            return in->binop != IRBIN_DIV;
+        default:
+            return 0;
+    }
+}
+
+/* A run of chants of constants prints text known at compile time, so it
+   becomes one chant of that text with the lines joined by newlines. The
+   first chant of the run turns into the definition of the text and the
+   last one chants it. */
+static int merge_constant_chants(IRProgram *ir, IRFunction *fn, int report) {
+    int *defs = ir_temp_defs(fn);
+    unsigned char *dead = xcalloc(fn->code.len + 1, 1);
+    int changed = 0;
+
+    for (size_t i = 0; i < fn->code.len; i++) {
+        if (!constant_chant(fn, defs, &fn->code.items[i])) {
+            continue;
+        }
+        size_t last = i;
+        int count = 1;
+        for (size_t j = i + 1; j < fn->code.len; j++) {
+            const IRInstr *in = &fn->code.items[j];
+            if (constant_chant(fn, defs, in)) {
+                last = j;
+                count++;
+            } else if (!invisible(in)) {
+                break;
+            }
+        }
+        if (count < 2) {
+            continue;
+        }
+
+        char *text = xstrdup("");
+        size_t len = 0;
+        for (size_t j = i; j <= last; j++) {
+            const IRInstr *in = &fn->code.items[j];
+            if (in->op != IROP_CHANT) {
+                continue;
+            }
+            if (j > i) {
+                text[len++] = '\n';
+            }
+            render_constant(ir, in, const_def(fn, defs, in->src1), &text, &len);
+            dead[j] = j != i && j != last;
+        }
+        IRInstr *first = &fn->code.items[i];
+        IRInstr *chant = &fn->code.items[last];
+        first->op = IROP_IMM_STR;
+        first->dst = fn->temp_count++;
+        first->imm = ir_intern_string(ir, text, len);
+        first->src1 = -1;
+        chant->src1 = first->dst;
+        chant->type = TYPE_STRING;
+        if (report) {
+            printf("chant: %s:%d: %d constant chants printed as one text\n", fn->name, first->line, count);
+        }
+        free(text);
+        changed = 1;
+        i = last;
+    }
+
+    if (changed) {
+        ir_remove_instrs(fn, dead);
+    }
+    free(dead);
+    free(defs);
+    return changed;
+}
+
+static void verify_stage(const IRFunction *fn, const OptOptions *opts, const char *stage) {
+    if (opts->verify) {
+        ir_verify_function(fn, stage);
+    }
+}
+
+static void cleanup_rounds(const IRProgram *ir, IRFunction *fn, const OptOptions *opts) {
+    for (int round = 0; round < 8; round++) {
+        int changed = 0;
+        changed |= fold_constants(fn, 1);
+        changed |= ceval_calls(ir, fn, opts->report);
+        changed |= remove_unreachable(fn);
+        changed |= simplify_jumps(fn);
+        changed |= forward_stores(fn);
+        changed |= gvn_function(fn, ir);
+        changed |= licm_function(fn);
+        changed |= eliminate_bounds_checks(fn, opts->report);
+        changed |= eliminate_dead_code(fn);
+        verify_stage(fn, opts, "cleanup");
+        if (!changed) {
+            break;
+        }
+    }
+}
+
+/* Passes that keep the CFG intact, so they are safe while phis exist. */
+static void ssa_rounds(const IRProgram *ir, IRFunction *fn, const OptOptions *opts) {
+    for (int round = 0; round < 8; round++) {
+        int changed = 0;
+        changed |= simplify_phis(fn);
+        changed |= fold_constants(fn, 0);
+        changed |= gvn_function(fn, ir);
+        changed |= eliminate_dead_code(fn);
+        verify_stage(fn, opts, "SSA optimization");
+        if (!changed) {
+            break;
+        }
+    }
+}
+
+/* Loops are replaced or unrolled on the first visit only; glyphs optimized
+   again after inlining already hold the transformed copies of their own and
+   inlined loops. */
+static void optimize_function(IRProgram *ir, IRFunction *fn, const OptOptions *opts, int first) {
+    verify_stage(fn, opts, "IR generation");
+    if (opts->level <= 0) {
+        return;
+    }
+    cleanup_rounds(ir, fn, opts);
+    if (eliminate_tail_recursion(fn, opts->report)) {
+        verify_stage(fn, opts, "tail recursion elimination");
+        cleanup_rounds(ir, fn, opts);
+    }
+    if (first && scev_replace_loops(fn, opts->report)) {
+        verify_stage(fn, opts, "closed-form loop replacement");
+        cleanup_rounds(ir, fn, opts);
+    }
+    if (first && unroll_loops(fn, opts->unroll, opts->report)) {
+        verify_stage(fn, opts, "loop unrolling");
+        cleanup_rounds(ir, fn, opts);
+    }
+    if (opts->level >= 2 && ssa_construct(fn)) {
+        verify_stage(fn, opts, "SSA construction");
+        ssa_rounds(ir, fn, opts);
+        ssa_destruct(fn);
+        verify_stage(fn, opts, "SSA destruction");
+        cleanup_rounds(ir, fn, opts);
+    }
+    if (merge_constant_chants(ir, fn, opts->report)) {
+        verify_stage(fn, opts, "chant merging");
+        cleanup_rounds(ir, fn, opts);
+    }
+    if (layout_blocks(fn, opts->report)) {
+        simplify_jumps(fn);
+        verify_stage(fn, opts, "block layout");
+    }
+    compact_slots(fn);
+    verify_stage(fn, opts, "slot compaction");
+}
+
+/* Glyphs are optimized callees first, so by the time a caller considers
+   inlining, its callees are already in their final, smallest form. */
+void ir_optimize_program(IRProgram *ir, const OptOptions *opts) {
+    ir_compute_purity(ir);
+    CallGraph graph;
+    call_graph_build(ir, &graph);
+    for (size_t i = 0; i < graph.len; i++) {
+        IRFunction *fn = &ir->functions.items[graph.order[i]];
+        optimize_function(ir, fn, opts, 1);
+        if (inline_calls(ir, &graph, fn, opts)) {
+            verify_stage(fn, opts, "inlining");
+            optimize_function(ir, fn, opts, 0);
+        }
+    }
+    free_call_graph(&graph);
+}
@@ -0,0 +1,16 @@
+#ifndef OPT_H
+#define OPT_H
+
+#include "ir.h"
+
+typedef struct OptOptions {
+    int level;
+    int verify;
+    int inline_level; /* 0 off, 1 small helpers, 2 aggressive */
+    int unroll;       /* unroll factor for counted loops, below 2 disables */
+    int report;       /* print optimization remarks to stdout */
+} OptOptions;
+
+void ir_optimize_program(IRProgram *ir, const OptOptions *opts);
+
+#endif
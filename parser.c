@@ -100,6 +100,20 @@ static Expr *parse_direct_call(Parser *p, const Token *name_tok) {
     return call;
 }
 
+static Expr *parse_array_literal(Parser *p, const Token *open) {
+    Expr *e = expr_new(EXPR_ARRAY, open->line, open->col);
+    if (check(p, TOK_RBRACKET)) {
+        fatal_at(p->file, open->line, open->col, "array literal needs at least one element");
+    }
+    expr_array_push(&e->as.array.items, parse_expr(p));
+    while (match(p, TOK_COMMA)) {
+        expr_array_push(&e->as.array.items, parse_expr(p));
+    }
+    expect(p, TOK_RBRACKET, "expected ']' to close array literal");
+    e->as.array.len = (long)e->as.array.items.len;
+    return e;
+}
+
 static Expr *parse_primary(Parser *p) {
     const Token *t = peek(p);
 
@@ -110,7 +124,8 @@ static Expr *parse_primary(Parser *p) {
     }
     if (match(p, TOK_STRING)) {
         Expr *e = expr_new(EXPR_STRING, t->line, t->col);
-        e->as.string_value = xstrdup(t->lexeme);
+        e->as.string.value = xmemdup(t->lexeme, t->len);
+        e->as.string.len = t->len;
         return e;
     }
     if (match(p, TOK_K_YES)) {
@@ -126,6 +141,17 @@ static Expr *parse_primary(Parser *p) {
     if (check(p, TOK_K_INVOKE)) {
         return parse_call(p);
     }
+    if (match(p, TOK_LBRACKET)) {
+        return parse_array_literal(p, t);
+    }
+    if (match(p, TOK_K_EMBER)) {
+        expect(p, TOK_LBRACKET, "expected '[' after ember in expression");
+        const Token *len = expect(p, TOK_INT, "expected array length");
+        expect(p, TOK_RBRACKET, "expected ']' after array length");
+        Expr *e = expr_new(EXPR_ARRAY, t->line, t->col);
+        e->as.array.len = len->int_value;
+        return e;
+    }
     if (match(p, TOK_LPAREN)) {
         Expr *inner = parse_expr(p);
         expect(p, TOK_RPAREN, "expected ')' to close grouped expression");
@@ -135,6 +161,13 @@ static Expr *parse_primary(Parser *p) {
         if (check(p, TOK_LPAREN)) {
             return parse_direct_call(p, t);
         }
+        if (match(p, TOK_LBRACKET)) {
+            Expr *e = expr_new(EXPR_INDEX, t->line, t->col);
+            e->as.index.name = xstrdup(t->lexeme);
+            e->as.index.index = parse_expr(p);
+            expect(p, TOK_RBRACKET, "expected ']' after index");
+            return e;
+        }
         Expr *e = expr_new(EXPR_VAR, t->line, t->col);
         e->as.var_name = xstrdup(t->lexeme);
         return e;
@@ -159,6 +192,13 @@ static Expr *parse_unary(Parser *p) {
         e->as.unary.operand = parse_unary(p);
         return e;
     }
+    if (match(p, TOK_K_SPAN)) {
+        const Token *op = prev(p);
+        Expr *e = expr_new(EXPR_UNARY, op->line, op->col);
+        e->as.unary.op = UN_SPAN;
+        e->as.unary.operand = parse_unary(p);
+        return e;
+    }
     return parse_primary(p);
 }
 
@@ -296,6 +336,10 @@ static Stmt *parse_stmt(Parser *p) {
         Stmt *s = stmt_new(STMT_SHIFT, t->line, t->col);
         const Token *name = expect(p, TOK_IDENT, "expected identifier after shift");
         s->as.shift.name = xstrdup(name->lexeme);
+        if (match(p, TOK_LBRACKET)) {
+            s->as.shift.index = parse_expr(p);
+            expect(p, TOK_RBRACKET, "expected ']' after index");
+        }
         expect(p, TOK_ASSIGN, "expected '=' in shift statement");
         s->as.shift.value = parse_expr(p);
         expect_line_end(p);
@@ -397,14 +441,16 @@ static Block *parse_block_until_any(Parser *p, TokenKind end_a, TokenKind end_b,
 }
 
 static Function parse_function(Parser *p) {
-    const Token *kw = expect(p, TOK_K_GLYPH, "expected glyph");
+    const Token *memo = match(p, TOK_K_MEMO) ? prev(p) : NULL;
+    const Token *kw = expect(p, TOK_K_GLYPH, memo ? "expected glyph after memo" : "expected glyph");
     const Token *name = expect(p, TOK_IDENT, "expected function name after glyph");
 
     Function fn;
     memset(&fn, 0, sizeof(fn));
     fn.name = xstrdup(name->lexeme);
-    fn.line = kw->line;
-    fn.col = kw->col;
+    fn.memo = memo != NULL;
+    fn.line = memo ? memo->line : kw->line;
+    fn.col = memo ? memo->col : kw->col;
 
     expect(p, TOK_LBRACKET, "expected '[' to start parameter list");
     if (!check(p, TOK_RBRACKET)) {
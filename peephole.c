@@ -0,0 +1,542 @@
+#include "peephole.h"
+
+#include "utils.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The code generator keeps every value in its stack slot between IR
+   instructions, so at a label or jump only %rax (the return value on its way
+   to the epilogue) can carry anything, and flags never live across blocks.
+   Stack slots are only reached through N(%rbp) operands; their address is
+   never taken. The rules below rely on both facts. */
+
+enum {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+    REG_COUNT
+};
+
+static const char *reg_names[REG_COUNT][4] = {
+    {"rax", "eax", "ax", "al"},     {"rcx", "ecx", "cx", "cl"},     {"rdx", "edx", "dx", "dl"},
+    {"rbx", "ebx", "bx", "bl"},     {"rsp", "esp", "sp", "spl"},    {"rbp", "ebp", "bp", "bpl"},
+    {"rsi", "esi", "si", "sil"},    {"rdi", "edi", "di", "dil"},    {"r8", "r8d", "r8w", "r8b"},
+    {"r9", "r9d", "r9w", "r9b"},    {"r10", "r10d", "r10w", "r10b"}, {"r11", "r11d", "r11w", "r11b"},
+    {"r12", "r12d", "r12w", "r12b"}, {"r13", "r13d", "r13w", "r13b"}, {"r14", "r14d", "r14w", "r14b"},
+    {"r15", "r15d", "r15w", "r15b"},
+};
+
+#define BIT(r) (1u << (r))
+#define CALLER_SAVED                                                                                      \
+    (BIT(REG_RAX) | BIT(REG_RCX) | BIT(REG_RDX) | BIT(REG_RSI) | BIT(REG_RDI) | BIT(REG_R8) | BIT(REG_R9) | \
+     BIT(REG_R10) | BIT(REG_R11))
+#define ARG_REGS (BIT(REG_RAX) | BIT(REG_RCX) | BIT(REG_RDX) | BIT(REG_RSI) | BIT(REG_RDI) | BIT(REG_R8) | BIT(REG_R9))
+
+static int reg_family(const char *name, size_t len, int *width) {
+    for (int r = 0; r < REG_COUNT; r++) {
+        for (int w = 0; w < 4; w++) {
+            if (strlen(reg_names[r][w]) == len && strncmp(reg_names[r][w], name, len) == 0) {
+                if (width) {
+                    *width = w;
+                }
+                return r;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Family of a bare 64-bit register operand such as "%rax", or -1. */
+static int reg64(const char *arg) {
+    int width = 0;
+    if (arg[0] != '%') {
+        return -1;
+    }
+    int r = reg_family(arg + 1, strlen(arg + 1), &width);
+    return r >= 0 && width == 0 ? r : -1;
+}
+
+/* Family of any bare register operand, or -1. */
+static int reg_any(const char *arg) {
+    return arg[0] == '%' ? reg_family(arg + 1, strlen(arg + 1), NULL) : -1;
+}
+
+static unsigned operand_regs(const char *arg) {
+    unsigned mask = 0;
+    for (const char *p = arg; *p; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        const char *s = ++p;
+        while (isalnum((unsigned char)*p)) {
+            p++;
+        }
+        int r = reg_family(s, (size_t)(p - s), NULL);
+        if (r >= 0) {
+            mask |= BIT(r);
+        }
+        p--;
+    }
+    return mask;
+}
+
+static int parse_imm(const char *arg, long *out) {
+    if (arg[0] != '$' || arg[1] == '\0') {
+        return 0;
+    }
+    char *end = NULL;
+    long v = strtol(arg + 1, &end, 10);
+    if (*end != '\0') {
+        return 0;
+    }
+    *out = v;
+    return 1;
+}
+
+static int fits_imm32(long v) {
+    return v >= -2147483648L && v <= 2147483647L;
+}
+
+/* Slot number of an "N(%rbp)" operand, or -1. */
+static int slot_of(const char *arg) {
+    char *end = NULL;
+    long off = strtol(arg, &end, 10);
+    if (end == arg || strcmp(end, "(%rbp)") != 0 || off >= 0 || off % 8 != 0) {
+        return -1;
+    }
+    return (int)(-off / 8);
+}
+
+static int starts_with(const char *s, const char *prefix) {
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+static int is_move(const char *op) {
+    return strcmp(op, "movq") == 0 || strcmp(op, "movl") == 0 || strcmp(op, "movabsq") == 0 ||
+           strcmp(op, "leaq") == 0 || strcmp(op, "movzbq") == 0 || strcmp(op, "movzbl") == 0 ||
+           strcmp(op, "movslq") == 0;
+}
+
+static int is_jump(const char *op) {
+    return op[0] == 'j';
+}
+
+static int reads_flags(const char *op) {
+    return (is_jump(op) && strcmp(op, "jmp") != 0) || starts_with(op, "set") || starts_with(op, "cmov") ||
+           starts_with(op, "adc") || starts_with(op, "sbb");
+}
+
+static int writes_flags(const char *op) {
+    static const char *ops[] = {"add", "sub", "and", "or", "xor", "cmp", "test", "neg", "imul",
+                                "shl", "sal", "sar", "shr", "inc", "dec", "idiv", "div", "call"};
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (starts_with(op, ops[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Registers an instruction reads and writes, by family. Partial writes
+   count as reads too. Unknown instructions read and write everything. */
+static void reg_effects(const MInstr *mi, unsigned *reads, unsigned *writes) {
+    const char *op = mi->op;
+    unsigned all = 0;
+    for (int a = 0; a < mi->argc; a++) {
+        all |= operand_regs(mi->args[a]);
+    }
+    int last = mi->argc > 0 ? reg_any(mi->args[mi->argc - 1]) : -1;
+    *reads = all;
+    *writes = 0;
+
+    if (is_move(op) && mi->argc == 2) {
+        *reads = operand_regs(mi->args[0]) | (last < 0 ? operand_regs(mi->args[1]) : 0);
+        *writes = last >= 0 ? BIT(last) : 0;
+    } else if ((starts_with(op, "xor") || starts_with(op, "sub")) && mi->argc == 2 && last >= 0 &&
+               strcmp(mi->args[0], mi->args[1]) == 0) {
+        *reads = 0;
+        *writes = BIT(last);
+    } else if (starts_with(op, "set")) {
+        *writes = last >= 0 ? BIT(last) : 0;
+    } else if (strcmp(op, "cqto") == 0) {
+        *reads = BIT(REG_RAX);
+        *writes = BIT(REG_RDX);
+    } else if (starts_with(op, "idiv") || starts_with(op, "div") || (starts_with(op, "imul") && mi->argc == 1)) {
+        *reads = all | BIT(REG_RAX) | BIT(REG_RDX);
+        *writes = BIT(REG_RAX) | BIT(REG_RDX);
+    } else if (strcmp(op, "call") == 0) {
+        *reads = ARG_REGS;
+        *writes = CALLER_SAVED;
+    } else if (strcmp(op, "jmp") == 0 && mi->argc == 1 && !starts_with(mi->args[0], ".L_")) {
+        /* Leaving the glyph for a runtime routine passes arguments like a call. */
+        *reads = ARG_REGS | BIT(REG_RAX);
+    } else if (is_jump(op) || strcmp(op, "ret") == 0) {
+        *reads = all | BIT(REG_RAX);
+    } else if (strcmp(op, "leave") == 0) {
+        *reads = BIT(REG_RAX) | BIT(REG_RBP);
+        *writes = BIT(REG_RBP) | BIT(REG_RSP);
+    } else if (starts_with(op, "push")) {
+        *writes = BIT(REG_RSP);
+    } else if (starts_with(op, "pop")) {
+        *writes = (last >= 0 ? BIT(last) : 0) | BIT(REG_RSP);
+    } else if (starts_with(op, "cmp") || starts_with(op, "test")) {
+        *writes = 0;
+    } else if (writes_flags(op) || starts_with(op, "cmov") || starts_with(op, "not")) {
+        *writes = last >= 0 ? BIT(last) : 0;
+    } else {
+        *reads = ~0u;
+        *writes = ~0u;
+    }
+}
+
+static size_t next_live(const MCode *code, size_t i, size_t end) {
+    for (i++; i < end && code->items[i].kind == MINSTR_DEAD; i++) {
+    }
+    return i;
+}
+
+static int reg_dead_after(const MCode *code, size_t i, size_t end, int reg) {
+    if (reg == REG_RSP || reg == REG_RBP) {
+        return 0;
+    }
+    for (size_t j = next_live(code, i, end); j < end; j = next_live(code, j, end)) {
+        const MInstr *mi = &code->items[j];
+        if (mi->kind != MINSTR_OP) {
+            return reg != REG_RAX;
+        }
+        unsigned reads, writes;
+        reg_effects(mi, &reads, &writes);
+        if (reads & BIT(reg)) {
+            return 0;
+        }
+        if (writes & BIT(reg)) {
+            return 1;
+        }
+        if (strcmp(mi->op, "jmp") == 0 || strcmp(mi->op, "ret") == 0) {
+            return reg != REG_RAX;
+        }
+    }
+    return reg != REG_RAX;
+}
+
+static int flags_dead_after(const MCode *code, size_t i, size_t end) {
+    for (size_t j = next_live(code, i, end); j < end; j = next_live(code, j, end)) {
+        const MInstr *mi = &code->items[j];
+        if (mi->kind != MINSTR_OP) {
+            return 1;
+        }
+        if (reads_flags(mi->op)) {
+            return 0;
+        }
+        if (writes_flags(mi->op) || strcmp(mi->op, "jmp") == 0 || strcmp(mi->op, "ret") == 0) {
+            return 1;
+        }
+    }
+    return 1;
+}
+
+typedef struct SlotState {
+    unsigned regs; /* register families holding the same value */
+    int imm_known;
+    long imm;
+} SlotState;
+
+typedef struct Forward {
+    SlotState *slots;
+    int slot_count;
+    unsigned same[REG_COUNT]; /* other registers known to hold the same value */
+    int reg_imm_known[REG_COUNT];
+    long reg_imm[REG_COUNT];
+} Forward;
+
+static void forward_clear(Forward *f) {
+    for (int k = 0; k < f->slot_count; k++) {
+        f->slots[k].regs = 0;
+        f->slots[k].imm_known = 0;
+    }
+    memset(f->same, 0, sizeof(f->same));
+    memset(f->reg_imm_known, 0, sizeof(f->reg_imm_known));
+}
+
+static void forget_reg(Forward *f, int r) {
+    for (int k = 0; k < f->slot_count; k++) {
+        f->slots[k].regs &= ~BIT(r);
+    }
+    for (int x = 0; x < REG_COUNT; x++) {
+        f->same[x] &= ~BIT(r);
+    }
+    f->same[r] = 0;
+    f->reg_imm_known[r] = 0;
+}
+
+/* Records that r now holds the same value as every register in regs. */
+static void join_regs(Forward *f, int r, unsigned regs) {
+    regs &= ~BIT(r);
+    f->same[r] = regs;
+    for (int x = 0; x < REG_COUNT; x++) {
+        if (regs & BIT(x)) {
+            f->same[x] |= BIT(r);
+        }
+    }
+}
+
+static int lowest_reg(unsigned regs) {
+    for (int r = 0; r < REG_COUNT; r++) {
+        if (regs & BIT(r)) {
+            return r;
+        }
+    }
+    return -1;
+}
+
+static void kill(MInstr *mi, PeepholeStats *stats) {
+    mi->kind = MINSTR_DEAD;
+    stats->removed++;
+}
+
+/* Within each block, remembers which registers or immediate a stack slot
+   holds and turns later loads of it into register copies, immediates, or
+   nothing when the destination already has the value. */
+static int forward_slots(MCode *code, size_t start, size_t end, Forward *f, PeepholeStats *stats) {
+    int changed = 0;
+    forward_clear(f);
+    for (size_t i = start; i < end; i++) {
+        MInstr *mi = &code->items[i];
+        if (mi->kind == MINSTR_DEAD) {
+            continue;
+        }
+        if (mi->kind != MINSTR_OP) {
+            forward_clear(f);
+            continue;
+        }
+
+        int is_movq = strcmp(mi->op, "movq") == 0 && mi->argc == 2;
+        int dst = is_movq ? reg64(mi->args[1]) : -1;
+        int k = is_movq ? slot_of(mi->args[0]) : -1;
+        if (k >= 0 && dst >= 0 && k < f->slot_count) {
+            const SlotState *s = &f->slots[k];
+            if (s->regs & BIT(dst)) {
+                kill(mi, stats);
+                changed = 1;
+                continue;
+            }
+            if (s->regs != 0) {
+                char src[8];
+                snprintf(src, sizeof(src), "%%%s", reg_names[lowest_reg(s->regs)][0]);
+                mcode_set_op(mi, "movq", 2, src, mi->args[1]);
+                stats->rewritten++;
+                changed = 1;
+            } else if (s->imm_known) {
+                char src[32];
+                snprintf(src, sizeof(src), "$%ld", s->imm);
+                mcode_set_op(mi, "movq", 2, src, mi->args[1]);
+                stats->rewritten++;
+                changed = 1;
+            }
+        }
+        int src = is_movq ? reg64(mi->args[0]) : -1;
+        if (src >= 0 && dst >= 0 && (src == dst || (f->same[src] & BIT(dst)))) {
+            kill(mi, stats);
+            changed = 1;
+            continue;
+        }
+
+        unsigned reads, writes;
+        reg_effects(mi, &reads, &writes);
+        for (int r = 0; r < REG_COUNT; r++) {
+            if (writes & BIT(r)) {
+                forget_reg(f, r);
+            }
+        }
+
+        const char *last = mi->args[mi->argc > 0 ? mi->argc - 1 : 0];
+        int store = mi->argc == 2 ? slot_of(last) : -1;
+        long v;
+        if (store >= 0 && store < f->slot_count) {
+            SlotState *s = &f->slots[store];
+            s->regs = 0;
+            s->imm_known = 0;
+            if (is_movq && src >= 0) {
+                s->regs = BIT(src) | f->same[src];
+                s->imm_known = f->reg_imm_known[src];
+                s->imm = f->reg_imm[src];
+            } else if (is_movq && parse_imm(mi->args[0], &v)) {
+                s->imm_known = 1;
+                s->imm = v;
+            }
+        } else if (mi->argc == 2 && strchr(last, '(') && !starts_with(mi->op, "cmp") && !starts_with(mi->op, "test")) {
+            forward_clear(f);
+        }
+
+        if (dst >= 0 && src >= 0) {
+            join_regs(f, dst, BIT(src) | f->same[src]);
+            for (int s = 0; s < f->slot_count; s++) {
+                if (f->slots[s].regs & BIT(src)) {
+                    f->slots[s].regs |= BIT(dst);
+                }
+            }
+            f->reg_imm_known[dst] = f->reg_imm_known[src];
+            f->reg_imm[dst] = f->reg_imm[src];
+        } else if (dst >= 0 && (k = slot_of(mi->args[0])) >= 0 && k < f->slot_count) {
+            join_regs(f, dst, f->slots[k].regs);
+            f->slots[k].regs |= BIT(dst);
+            f->reg_imm_known[dst] = f->slots[k].imm_known;
+            f->reg_imm[dst] = f->slots[k].imm;
+        } else if (dst >= 0 && parse_imm(mi->args[0], &v)) {
+            f->reg_imm_known[dst] = 1;
+            f->reg_imm[dst] = v;
+        }
+        if (strcmp(mi->op, "jmp") == 0) {
+            forward_clear(f);
+        }
+    }
+    return changed;
+}
+
+/* Drops stores to slots that no instruction in the function reads. */
+static int remove_dead_stores(MCode *code, size_t start, size_t end, int slot_count, PeepholeStats *stats) {
+    unsigned char *read = xcalloc((size_t)slot_count + 1, 1);
+    for (size_t i = start; i < end; i++) {
+        const MInstr *mi = &code->items[i];
+        if (mi->kind != MINSTR_OP) {
+            continue;
+        }
+        for (int a = 0; a < mi->argc; a++) {
+            int k = slot_of(mi->args[a]);
+            int is_store = a == mi->argc - 1 && mi->argc == 2 && is_move(mi->op);
+            if (k >= 0 && !is_store) {
+                read[k] = 1;
+            }
+        }
+    }
+    int changed = 0;
+    for (size_t i = start; i < end; i++) {
+        MInstr *mi = &code->items[i];
+        if (mi->kind != MINSTR_OP || strcmp(mi->op, "movq") != 0 || mi->argc != 2) {
+            continue;
+        }
+        int k = slot_of(mi->args[1]);
+        if (k >= 0 && !read[k]) {
+            kill(mi, stats);
+            changed = 1;
+        }
+    }
+    free(read);
+    return changed;
+}
+
+static int is_fold_target(const MInstr *mi) {
+    static const char *ops[] = {"addq", "subq", "andq", "orq", "xorq", "cmpq", "imulq"};
+    if (mi->kind != MINSTR_OP || mi->argc != 2) {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strcmp(mi->op, ops[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Rewrites over adjacent instructions: immediates folded into the ALU
+   operation or store that consumes them, zeroing by xor, cmp against zero
+   as test, and jumps to the label that directly follows. */
+static int local_rewrites(MCode *code, size_t start, size_t end, PeepholeStats *stats) {
+    int changed = 0;
+    for (size_t i = start; i < end; i++) {
+        MInstr *mi = &code->items[i];
+        if (mi->kind != MINSTR_OP) {
+            continue;
+        }
+        size_t j = next_live(code, i, end);
+        MInstr *next = j < end ? &code->items[j] : NULL;
+        long v = 0;
+
+        /* movq X, %s followed by a single reader of %s: the reader takes X. */
+        if (strcmp(mi->op, "movq") == 0 && mi->argc == 2 && reg64(mi->args[1]) >= 0 && next &&
+            next->kind == MINSTR_OP && next->argc == 2 && strcmp(next->args[0], mi->args[1]) == 0) {
+            int s = reg64(mi->args[1]);
+            int imm = parse_imm(mi->args[0], &v);
+            int mem = slot_of(mi->args[0]) >= 0;
+            int reg = reg64(mi->args[0]) >= 0;
+            int usable = (imm && fits_imm32(v)) || mem || reg;
+            int into_alu = usable && is_fold_target(next) && reg_any(next->args[1]) >= 0 && reg_any(next->args[1]) != s;
+            int into_store = (reg || (imm && fits_imm32(v))) && strcmp(next->op, "movq") == 0 &&
+                             slot_of(next->args[1]) >= 0;
+            int into_reg = (imm || mem || reg) && strcmp(next->op, "movq") == 0 && reg64(next->args[1]) >= 0;
+            if ((into_alu || into_store || into_reg) && reg_dead_after(code, j, end, s)) {
+                snprintf(next->args[0], sizeof(next->args[0]), "%s", mi->args[0]);
+                kill(mi, stats);
+                stats->rewritten++;
+                changed = 1;
+                continue;
+            }
+        }
+
+        int r = mi->argc == 2 ? reg64(mi->args[1]) : -1;
+        if (is_move(mi->op) && r >= 0 && reg_dead_after(code, i, end, r)) {
+            kill(mi, stats);
+            changed = 1;
+            continue;
+        }
+        if (strcmp(mi->op, "movq") == 0 && r >= 0 && strcmp(mi->args[0], "$0") == 0 && flags_dead_after(code, i, end)) {
+            char reg[8];
+            snprintf(reg, sizeof(reg), "%%%s", reg_names[r][1]);
+            mcode_set_op(mi, "xorl", 2, reg, reg);
+            stats->rewritten++;
+            changed = 1;
+            continue;
+        }
+        if (strcmp(mi->op, "cmpq") == 0 && r >= 0 && strcmp(mi->args[0], "$0") == 0) {
+            mcode_set_op(mi, "testq", 2, mi->args[1], mi->args[1]);
+            stats->rewritten++;
+            changed = 1;
+            continue;
+        }
+
+        if (is_jump(mi->op) && mi->argc == 1) {
+            for (size_t k = j; k < end && code->items[k].kind != MINSTR_OP; k = next_live(code, k, end)) {
+                if (code->items[k].kind == MINSTR_LABEL && strcmp(code->items[k].text, mi->args[0]) == 0) {
+                    kill(mi, stats);
+                    changed = 1;
+                    break;
+                }
+                if (code->items[k].kind != MINSTR_LABEL) {
+                    break;
+                }
+            }
+        }
+    }
+    return changed;
+}
+
+/* Runs the rules over code[start, end), one function's body, until none
+   applies. Removed instructions are left as MINSTR_DEAD for the caller to
+   compact. */
+void peephole_optimize(MCode *code, size_t start, size_t end, PeepholeStats *stats) {
+    int slot_count = 0;
+    for (size_t i = start; i < end; i++) {
+        const MInstr *mi = &code->items[i];
+        for (int a = 0; mi->kind == MINSTR_OP && a < mi->argc; a++) {
+            int k = slot_of(mi->args[a]);
+            if (k >= slot_count) {
+                slot_count = k + 1;
+            }
+        }
+    }
+
+    Forward f;
+    memset(&f, 0, sizeof(f));
+    f.slot_count = slot_count;
+    f.slots = xmalloc((size_t)(slot_count > 0 ? slot_count : 1) * sizeof(SlotState));
+    for (int round = 0; round < 16; round++) {
+        int changed = forward_slots(code, start, end, &f, stats);
+        changed |= remove_dead_stores(code, start, end, slot_count, stats);
+        changed |= local_rewrites(code, start, end, stats);
+        if (!changed) {
+            break;
+        }
+    }
+    free(f.slots);
+}
@@ -0,0 +1,13 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "mcode.h"
+
+typedef struct PeepholeStats {
+    int removed;
+    int rewritten;
+} PeepholeStats;
+
+void peephole_optimize(MCode *code, size_t start, size_t end, PeepholeStats *stats);
+
+#endif
@@ -0,0 +1,123 @@
+#include "profile.h"
+
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Profile files hold this magic, the counter count, the source hash and the
+   counters, all as 64-bit little-endian words, exactly as the instrumented
+   program keeps them in memory. */
+#define PROFILE_MAGIC "ANMPROF1"
+#define PROFILE_HEADER 24
+
+/* FNV-1a, so a profile recorded for other source is rejected. */
+unsigned long profile_source_hash(const char *src, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)src[i];
+        h *= 1099511628211ULL;
+    }
+    return (unsigned long)h;
+}
+
+static IRInstr make_count(int counter, int line) {
+    IRInstr in = ir_make_instr(IROP_COUNT);
+    in.imm = counter;
+    in.line = line;
+    return in;
+}
+
+/* Counters are numbered glyph by glyph straight after IR generation: one
+   for the entry, one per call and two per conditional jump, counting how
+   often it runs and how often it falls through. profile_annotate walks the
+   same order. */
+void profile_instrument(IRProgram *ir, unsigned long hash) {
+    int next = 0;
+    for (size_t f = 0; f < ir->functions.len; f++) {
+        IRFunction *fn = &ir->functions.items[f];
+        IRInstrArray code;
+        memset(&code, 0, sizeof(code));
+        ir_push_instr(&code, make_count(next++, 0));
+        for (size_t i = 0; i < fn->code.len; i++) {
+            const IRInstr *in = &fn->code.items[i];
+            if (in->op == IROP_CALL || in->op == IROP_JMP_FALSE) {
+                ir_push_instr(&code, make_count(next++, in->line));
+            }
+            ir_push_instr(&code, *in);
+            if (in->op == IROP_JMP_FALSE) {
+                ir_push_instr(&code, make_count(next++, in->line));
+            }
+        }
+        free(fn->code.items);
+        fn->code = code;
+    }
+    ir->profile_counters = next;
+    ir->profile_hash = hash;
+}
+
+static uint64_t read_word(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int k = 7; k >= 0; k--) {
+        v = (v << 8) | p[k];
+    }
+    return v;
+}
+
+void profile_load(const char *path, Profile *out) {
+    size_t size = 0;
+    unsigned char *data = (unsigned char *)read_file_all(path, &size);
+    if (size < PROFILE_HEADER || memcmp(data, PROFILE_MAGIC, 8) != 0) {
+        fatal("'%s' is not an anemo profile", path);
+    }
+    uint64_t len = read_word(data + 8);
+    if (len != (size - PROFILE_HEADER) / 8 || (size - PROFILE_HEADER) % 8 != 0) {
+        fatal("profile '%s' is truncated", path);
+    }
+    out->hash = (unsigned long)read_word(data + 16);
+    out->len = (size_t)len;
+    out->counts = xmalloc((out->len + 1) * sizeof(long));
+    for (size_t i = 0; i < out->len; i++) {
+        out->counts[i] = (long)read_word(data + PROFILE_HEADER + 8 * i);
+    }
+    free(data);
+}
+
+void profile_annotate(IRProgram *ir, const Profile *prof, unsigned long hash, const char *path) {
+    size_t needed = 0;
+    for (size_t f = 0; f < ir->functions.len; f++) {
+        const IRFunction *fn = &ir->functions.items[f];
+        needed++;
+        for (size_t i = 0; i < fn->code.len; i++) {
+            IROp op = fn->code.items[i].op;
+            needed += op == IROP_CALL ? 1 : op == IROP_JMP_FALSE ? 2 : 0;
+        }
+    }
+    if (prof->hash != hash || prof->len != needed) {
+        fatal("profile '%s' was recorded for a different program", path);
+    }
+
+    size_t next = 0;
+    for (size_t f = 0; f < ir->functions.len; f++) {
+        IRFunction *fn = &ir->functions.items[f];
+        fn->profiled = 1;
+        fn->entry_count = prof->counts[next++];
+        for (size_t i = 0; i < fn->code.len; i++) {
+            IRInstr *in = &fn->code.items[i];
+            if (in->op == IROP_CALL) {
+                in->prof[0] = prof->counts[next++];
+            } else if (in->op == IROP_JMP_FALSE) {
+                long runs = prof->counts[next++];
+                in->prof[0] = prof->counts[next++];
+                in->prof[1] = runs - in->prof[0];
+            }
+        }
+    }
+}
+
+void free_profile(Profile *prof) {
+    free(prof->counts);
+    memset(prof, 0, sizeof(*prof));
+}
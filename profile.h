@@ -0,0 +1,22 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "ir.h"
+
+#include <stddef.h>
+
+/* Counters an instrumented program wrote at exit. */
+typedef struct Profile {
+    unsigned long hash;
+    long *counts;
+    size_t len;
+} Profile;
+
+unsigned long profile_source_hash(const char *src, size_t len);
+
+void profile_instrument(IRProgram *ir, unsigned long hash);
+void profile_load(const char *path, Profile *out);
+void profile_annotate(IRProgram *ir, const Profile *prof, unsigned long hash, const char *path);
+void free_profile(Profile *prof);
+
+#endif
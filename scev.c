@@ -0,0 +1,603 @@
+#include "scev.h"
+
+#include "utils.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Largest step a counter may take per iteration. */
+#define SCEV_MAX_STEP (1L << 20)
+
+/* Inverse of 3 modulo 2^64. */
+#define SCEV_INVERSE_3 (-6148914691236517205L)
+
+static void grow(void **items, size_t *cap, size_t elem_size) {
+    size_t next = *cap == 0 ? 8 : *cap * 2;
+    *items = xrealloc(*items, next * elem_size);
+    *cap = next;
+}
+
+static IRBinOp swap_compare(IRBinOp op) {
+    switch (op) {
+        case IRBIN_LESS: return IRBIN_MORE;
+        case IRBIN_MORE: return IRBIN_LESS;
+        case IRBIN_ATMOST: return IRBIN_ATLEAST;
+        case IRBIN_ATLEAST: return IRBIN_ATMOST;
+        default: return op;
+    }
+}
+
+static const IRInstr *def_of(const IRFunction *fn, const int *defs, int t) {
+    return t >= 0 && defs[t] >= 0 ? &fn->code.items[defs[t]] : NULL;
+}
+
+/* The step var takes on each iteration: its only store in the loop sits in
+   the body and writes var +/- constant, read before that store. */
+static int find_step(const IRFunction *fn, const int *defs, const CountedLoop *cl, long *out_step) {
+    size_t store = 0;
+    int stores = 0;
+    for (size_t i = cl->cond_start; i < cl->body_end; i++) {
+        const IRInstr *in = &fn->code.items[i];
+        if (in->op == IROP_STORE_VAR && in->var_index == cl->var) {
+            store = i;
+            stores++;
+        }
+    }
+    if (stores != 1 || store < cl->body_start) {
+        return 0;
+    }
+    const IRInstr *bin = def_of(fn, defs, fn->code.items[store].src1);
+    if (!bin || bin->op != IROP_BIN || (bin->binop != IRBIN_ADD && bin->binop != IRBIN_SUB)) {
+        return 0;
+    }
+    for (int side = 0; side < 2; side++) {
+        int from = side == 0 ? bin->src1 : bin->src2;
+        int by = side == 0 ? bin->src2 : bin->src1;
+        const IRInstr *ld = def_of(fn, defs, from);
+        const IRInstr *c = def_of(fn, defs, by);
+        if (side == 1 && bin->binop == IRBIN_SUB) {
+            break;
+        }
+        if (!ld || ld->op != IROP_LOAD_VAR || ld->var_index != cl->var || (size_t)defs[from] < cl->cond_start ||
+            (size_t)defs[from] > store || !c || c->op != IROP_IMM_INT) {
+            continue;
+        }
+        if (c->imm == 0 || c->imm > SCEV_MAX_STEP || c->imm < -SCEV_MAX_STEP) {
+            return 0;
+        }
+        *out_step = bin->binop == IRBIN_ADD ? c->imm : -c->imm;
+        return 1;
+    }
+    return 0;
+}
+
+/* Recognizes a counted loop; see CountedLoop. defs and block_of map temps
+   to their defining instruction and instructions to their block. */
+int scev_counted_loop(const IRFunction *fn, const CFG *cfg, const int *defs, const int *block_of, int loop,
+                      CountedLoop *out) {
+    const CFGLoop *lp = &cfg->loops[loop];
+    if (lp->blocks.len != 2 || lp->latches.len != 1) {
+        return 0;
+    }
+    const CFGBlock *hdr = &cfg->blocks[lp->header];
+    const CFGBlock *body = &cfg->blocks[lp->latches.items[0]];
+    if (!hdr->reachable || hdr->label < 0 || body->start != hdr->end || body->preds.len != 1 ||
+        body->end - body->start < 2) {
+        return 0;
+    }
+    const IRInstr *term = &fn->code.items[hdr->end - 1];
+    const IRInstr *back = &fn->code.items[body->end - 1];
+    if (term->op != IROP_JMP_FALSE || back->op != IROP_JMP || back->label != hdr->label ||
+        fn->code.items[body->start].op == IROP_LABEL) {
+        return 0;
+    }
+    for (size_t i = hdr->start + 1; i < body->end - 1; i++) {
+        if (fn->code.items[i].op == IROP_PHI) {
+            return 0;
+        }
+    }
+
+    const IRInstr *cmp = def_of(fn, defs, term->src1);
+    if (!cmp || cmp->op != IROP_BIN || block_of[defs[term->src1]] != lp->header ||
+        (cmp->binop != IRBIN_LESS && cmp->binop != IRBIN_MORE && cmp->binop != IRBIN_ATMOST &&
+         cmp->binop != IRBIN_ATLEAST)) {
+        return 0;
+    }
+    const IRInstr *load = def_of(fn, defs, cmp->src1);
+    out->cmp = cmp->binop;
+    out->bound = cmp->src2;
+    if (!load || load->op != IROP_LOAD_VAR || block_of[defs[cmp->src1]] != lp->header) {
+        load = def_of(fn, defs, cmp->src2);
+        out->cmp = swap_compare(cmp->binop);
+        out->bound = cmp->src1;
+        if (!load || load->op != IROP_LOAD_VAR || block_of[defs[cmp->src2]] != lp->header) {
+            return 0;
+        }
+    }
+    if (defs[out->bound] < 0 || cfg_loop_contains(cfg, loop, block_of[defs[out->bound]])) {
+        return 0;
+    }
+
+    out->loop = loop;
+    out->header_label = hdr->label;
+    out->exit_label = term->label;
+    out->cond_start = hdr->start + 1;
+    out->cond_end = hdr->end - 1;
+    out->body_start = body->start;
+    out->body_end = body->end - 1;
+    out->var = load->var_index;
+    out->line = cmp->line;
+    if (!find_step(fn, defs, out, &out->step)) {
+        return 0;
+    }
+    /* Only loops that count towards their bound. */
+    return (out->step > 0) == (out->cmp == IRBIN_LESS || out->cmp == IRBIN_ATMOST);
+}
+
+/* A value in iteration k (counting from 0) as c0 + c1*k + c2*k^2, plus the
+   value a variable had when the iteration started. Coefficients are temps
+   computed in front of the loop, -1 standing for zero. */
+typedef struct Poly {
+    int known;
+    int coef[3];
+    int acc;
+} Poly;
+
+typedef struct ScevBuild {
+    IRFunction *fn;
+    const CountedLoop *cl;
+    const int *defs;
+    IRInstrArray pre;
+    Poly *sym;
+    int *store_at; /* per variable: its store in the loop, -1 none, -2 several */
+    int start;     /* temp holding the counter before the loop */
+} ScevBuild;
+
+static int emit(ScevBuild *b, IRInstr in) {
+    in.line = b->cl->line;
+    in.dst = b->fn->temp_count++;
+    ir_push_instr(&b->pre, in);
+    return in.dst;
+}
+
+static int emit_imm(ScevBuild *b, long value) {
+    IRInstr in = ir_make_instr(IROP_IMM_INT);
+    in.imm = value;
+    return emit(b, in);
+}
+
+static int emit_bin(ScevBuild *b, IRBinOp op, int left, int right) {
+    IRInstr in = ir_make_instr(IROP_BIN);
+    in.binop = op;
+    in.src1 = left;
+    in.src2 = right;
+    return emit(b, in);
+}
+
+static int emit_load(ScevBuild *b, int var) {
+    IRInstr in = ir_make_instr(IROP_LOAD_VAR);
+    in.var_index = var;
+    return emit(b, in);
+}
+
+static void emit_jump(ScevBuild *b, IROp op, int cond, int label) {
+    IRInstr in = ir_make_instr(op);
+    in.line = b->cl->line;
+    in.src1 = cond;
+    in.label = label;
+    ir_push_instr(&b->pre, in);
+}
+
+static int coef_add(ScevBuild *b, int x, int y, int negate) {
+    if (y < 0) {
+        return x;
+    }
+    if (x < 0) {
+        return negate ? emit_bin(b, IRBIN_SUB, emit_imm(b, 0), y) : y;
+    }
+    return emit_bin(b, negate ? IRBIN_SUB : IRBIN_ADD, x, y);
+}
+
+static int coef_mul(ScevBuild *b, int x, int y) {
+    return x < 0 || y < 0 ? -1 : emit_bin(b, IRBIN_MUL, x, y);
+}
+
+static Poly poly_unknown(void) {
+    Poly p;
+    memset(&p, 0, sizeof(p));
+    p.acc = -1;
+    return p;
+}
+
+static Poly poly_const(int temp) {
+    Poly p = poly_unknown();
+    p.known = 1;
+    p.coef[0] = temp;
+    p.coef[1] = -1;
+    p.coef[2] = -1;
+    return p;
+}
+
+static int poly_degree(const Poly *p) {
+    int d = -1;
+    for (int j = 0; j < 3; j++) {
+        if (p->coef[j] >= 0) {
+            d = j;
+        }
+    }
+    return d;
+}
+
+static Poly poly_add(ScevBuild *b, Poly p, Poly q, int negate) {
+    if (!p.known || !q.known || (q.acc >= 0 && (negate || p.acc >= 0))) {
+        return poly_unknown();
+    }
+    Poly r = p;
+    r.acc = p.acc >= 0 ? p.acc : q.acc;
+    for (int j = 0; j < 3; j++) {
+        r.coef[j] = coef_add(b, p.coef[j], q.coef[j], negate);
+    }
+    return r;
+}
+
+static Poly poly_mul(ScevBuild *b, Poly p, Poly q) {
+    if (!p.known || !q.known || p.acc >= 0 || q.acc >= 0 || poly_degree(&p) + poly_degree(&q) > 2) {
+        return poly_unknown();
+    }
+    Poly r = poly_const(-1);
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; i + j < 3; j++) {
+            r.coef[i + j] = coef_add(b, r.coef[i + j], coef_mul(b, p.coef[i], q.coef[j]), 0);
+        }
+    }
+    return r;
+}
+
+static Poly operand(const ScevBuild *b, int t) {
+    int d = b->defs[t];
+    if (d >= (int)b->cl->cond_start && d < (int)b->cl->body_end) {
+        return b->sym[t];
+    }
+    return poly_const(t);
+}
+
+/* Expresses the temps of the loop as polynomials in the iteration number.
+   Fails when the loop does anything besides computing such values and
+   storing them, or reads a variable after the loop stored it. */
+static int evaluate_loop(ScevBuild *b) {
+    const CountedLoop *cl = b->cl;
+    IRFunction *fn = b->fn;
+    for (size_t i = cl->cond_start; i < cl->body_end; i++) {
+        const IRInstr *in = &fn->code.items[i];
+        if (i == cl->cond_end) {
+            continue;
+        }
+        switch (in->op) {
+            case IROP_IMM_INT:
+                b->sym[in->dst] = poly_const(emit_imm(b, in->imm));
+                break;
+            case IROP_IMM_BOOL:
+            case IROP_IMM_STR:
+                b->sym[in->dst] = poly_unknown();
+                break;
+            case IROP_LOAD_VAR: {
+                int at = b->store_at[in->var_index];
+                if (at >= 0 && i > (size_t)at) {
+                    return 0;
+                }
+                if (in->var_index == cl->var) {
+                    b->sym[in->dst] = poly_const(b->start);
+                    b->sym[in->dst].coef[1] = emit_imm(b, cl->step);
+                } else if (at >= 0) {
+                    b->sym[in->dst] = poly_const(-1);
+                    b->sym[in->dst].acc = in->var_index;
+                } else {
+                    b->sym[in->dst] = poly_const(emit_load(b, in->var_index));
+                }
+                break;
+            }
+            case IROP_BIN: {
+                Poly l = operand(b, in->src1);
+                Poly r = operand(b, in->src2);
+                if (in->binop == IRBIN_DIV) {
+                    return 0;
+                }
+                b->sym[in->dst] = in->binop == IRBIN_ADD   ? poly_add(b, l, r, 0)
+                                  : in->binop == IRBIN_SUB ? poly_add(b, l, r, 1)
+                                  : in->binop == IRBIN_MUL ? poly_mul(b, l, r)
+                                                           : poly_unknown();
+                break;
+            }
+            case IROP_UN:
+                b->sym[in->dst] = in->unop == IRUN_NEG ? poly_add(b, poly_const(-1), operand(b, in->src1), 1)
+                                                       : poly_unknown();
+                break;
+            case IROP_STORE_VAR:
+                break;
+            default:
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* Binomial coefficients C(n, 2) and C(n, 3) modulo 2^64 for 0 <= n < 2^63:
+   the even one of n and n - 1 is halved before multiplying, and the division
+   by 3 becomes a multiplication by its modular inverse. */
+static int emit_choose2(ScevBuild *b, int n) {
+    int one = emit_imm(b, 1);
+    int two = emit_imm(b, 2);
+    int half = emit_bin(b, IRBIN_DIV, n, two);
+    int odd = emit_bin(b, IRBIN_SUB, n, emit_bin(b, IRBIN_MUL, half, two));
+    return emit_bin(b, IRBIN_MUL, half, emit_bin(b, IRBIN_ADD, emit_bin(b, IRBIN_SUB, n, one), odd));
+}
+
+static int emit_choose3(ScevBuild *b, int n, int choose2) {
+    int less_two = emit_bin(b, IRBIN_SUB, n, emit_imm(b, 2));
+    return emit_bin(b, IRBIN_MUL, emit_bin(b, IRBIN_MUL, choose2, less_two), emit_imm(b, SCEV_INVERSE_3));
+}
+
+/* Iterations the loop runs, computed only when the counter can neither
+   wrap around nor start past the bound; otherwise the original loop runs. */
+static int emit_trip_count(ScevBuild *b) {
+    const CountedLoop *cl = b->cl;
+    int up = cl->step > 0;
+    int inclusive = cl->cmp == IRBIN_ATMOST || cl->cmp == IRBIN_ATLEAST;
+    long c = up ? cl->step : -cl->step;
+
+    emit_jump(b, IROP_JMP_FALSE, emit_bin(b, cl->cmp, b->start, cl->bound), cl->header_label);
+    int dist = up ? emit_bin(b, IRBIN_SUB, cl->bound, b->start) : emit_bin(b, IRBIN_SUB, b->start, cl->bound);
+    if (inclusive) {
+        dist = emit_bin(b, IRBIN_ADD, dist, emit_imm(b, 1));
+    }
+    emit_jump(b, IROP_JMP_FALSE, emit_bin(b, IRBIN_MORE, dist, emit_imm(b, 0)), cl->header_label);
+    /* The last step must not carry the counter past the ember range. */
+    long limit = up ? LONG_MAX - c + (inclusive ? 0 : 1) : LONG_MIN + c - (inclusive ? 0 : 1);
+    if (inclusive || c > 1) {
+        int ok = emit_bin(b, up ? IRBIN_ATMOST : IRBIN_ATLEAST, cl->bound, emit_imm(b, limit));
+        emit_jump(b, IROP_JMP_FALSE, ok, cl->header_label);
+    }
+    if (c == 1) {
+        return dist;
+    }
+    int one = emit_imm(b, 1);
+    int steps = emit_bin(b, IRBIN_DIV, emit_bin(b, IRBIN_SUB, dist, one), emit_imm(b, c));
+    return emit_bin(b, IRBIN_ADD, steps, one);
+}
+
+static void emit_store(ScevBuild *b, int var, int value) {
+    IRInstr in = ir_make_instr(IROP_STORE_VAR);
+    in.line = b->cl->line;
+    in.var_index = var;
+    in.src1 = value;
+    ir_push_instr(&b->pre, in);
+}
+
+/* Computes the variables' values after n iterations: the counter moves n
+   steps, an accumulator s = s + g(k) adds the sum of g(k) for k < n, and any
+   other variable holds its value from iteration n - 1. */
+static void emit_final_values(ScevBuild *b, const Poly *stored, int n) {
+    const CountedLoop *cl = b->cl;
+    size_t nvars = b->fn->vars.len;
+    int *values = xmalloc((nvars + 1) * sizeof(int));
+    int choose2 = -1;
+    int choose3 = -1;
+    int last = -1;
+    for (size_t v = 0; v < nvars; v++) {
+        const Poly *p = &stored[v];
+        values[v] = -1;
+        if (b->store_at[v] < 0) {
+            continue;
+        }
+        if ((int)v == cl->var) {
+            values[v] = emit_bin(b, IRBIN_ADD, b->start, emit_bin(b, IRBIN_MUL, n, emit_imm(b, cl->step)));
+            continue;
+        }
+        if (p->acc < 0) {
+            if (last < 0) {
+                last = emit_bin(b, IRBIN_SUB, n, emit_imm(b, 1));
+            }
+            int value = coef_add(b, p->coef[0], coef_mul(b, p->coef[1], last), 0);
+            value = coef_add(b, value, coef_mul(b, p->coef[2], coef_mul(b, last, last)), 0);
+            values[v] = value >= 0 ? value : emit_imm(b, 0);
+            continue;
+        }
+        if (poly_degree(p) >= 1 && choose2 < 0) {
+            choose2 = emit_choose2(b, n);
+        }
+        if (poly_degree(p) >= 2 && choose3 < 0) {
+            choose3 = emit_choose3(b, n, choose2);
+        }
+        /* sum k = C(n, 2), sum k^2 = 2 C(n, 3) + C(n, 2) */
+        int value = coef_add(b, emit_load(b, (int)v), coef_mul(b, p->coef[0], n), 0);
+        value = coef_add(b, value, coef_mul(b, p->coef[1], choose2), 0);
+        if (p->coef[2] >= 0) {
+            int squares = emit_bin(b, IRBIN_ADD, emit_bin(b, IRBIN_ADD, choose3, choose3), choose2);
+            value = coef_add(b, value, coef_mul(b, p->coef[2], squares), 0);
+        }
+        values[v] = value;
+    }
+    for (size_t v = 0; v < nvars; v++) {
+        if (values[v] >= 0) {
+            emit_store(b, (int)v, values[v]);
+        }
+    }
+    free(values);
+}
+
+/* Whether code after the loop reads a temp computed in its header. */
+static int header_escapes(const IRFunction *fn, const int *defs, const CountedLoop *cl) {
+    for (size_t i = 0; i < fn->code.len; i++) {
+        if (i >= cl->cond_start && i <= cl->body_end) {
+            continue;
+        }
+        int ops[IR_MAX_USES];
+        int n = ir_instr_uses(&fn->code.items[i], ops);
+        for (int k = 0; k < n; k++) {
+            if (defs[ops[k]] >= (int)cl->cond_start && defs[ops[k]] < (int)cl->cond_end) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Builds the code replacing the loop. Returns 0, leaving the function
+   untouched, when some variable does not follow a closed form. */
+static int build_closed_form(ScevBuild *b) {
+    const CountedLoop *cl = b->cl;
+    IRFunction *fn = b->fn;
+    for (size_t v = 0; v < fn->vars.len; v++) {
+        b->store_at[v] = -1;
+    }
+    for (size_t i = cl->cond_start; i < cl->body_end; i++) {
+        const IRInstr *in = &fn->code.items[i];
+        if (in->op == IROP_STORE_VAR) {
+            if (i < cl->body_start || b->store_at[in->var_index] != -1) {
+                return 0;
+            }
+            b->store_at[in->var_index] = (int)i;
+        }
+    }
+
+    b->start = emit_load(b, cl->var);
+    if (!evaluate_loop(b)) {
+        return 0;
+    }
+    Poly *stored = xmalloc((fn->vars.len + 1) * sizeof(Poly));
+    int ok = 1;
+    for (size_t v = 0; v < fn->vars.len && ok; v++) {
+        if (b->store_at[v] < 0 || (int)v == cl->var) {
+            continue;
+        }
+        stored[v] = operand(b, fn->code.items[b->store_at[v]].src1);
+        ok = stored[v].known && (stored[v].acc < 0 || stored[v].acc == (int)v);
+    }
+    if (ok) {
+        int n = emit_trip_count(b);
+        emit_final_values(b, stored, n);
+        int exit = header_escapes(fn, b->defs, cl) ? cl->header_label : cl->exit_label;
+        emit_jump(b, IROP_JMP, -1, exit);
+    }
+    free(stored);
+    return ok;
+}
+
+static void splice_closed_form(IRFunction *fn, const CFG *cfg, const int *block_of, const CountedLoop *cl,
+                               IRInstrArray *pre) {
+    const CFGBlock *hdr = &cfg->blocks[cfg->loops[cl->loop].header];
+    int pre_label = fn->label_count++;
+    IRInstrArray code;
+    memset(&code, 0, sizeof(code));
+    for (size_t i = 0; i < fn->code.len; i++) {
+        if (i == hdr->start) {
+            if (i > 0 && cfg_loop_contains(cfg, cl->loop, block_of[i - 1]) && fn->code.items[i - 1].op != IROP_JMP &&
+                fn->code.items[i - 1].op != IROP_RET) {
+                IRInstr jmp = ir_make_instr(IROP_JMP);
+                jmp.line = cl->line;
+                jmp.label = cl->header_label;
+                ir_push_instr(&code, jmp);
+            }
+            IRInstr lbl = ir_make_instr(IROP_LABEL);
+            lbl.line = cl->line;
+            lbl.label = pre_label;
+            ir_push_instr(&code, lbl);
+            for (size_t k = 0; k < pre->len; k++) {
+                ir_push_instr(&code, pre->items[k]);
+            }
+        }
+        IRInstr in = fn->code.items[i];
+        if ((in.op == IROP_JMP || in.op == IROP_JMP_FALSE) && in.label == cl->header_label &&
+            !cfg_loop_contains(cfg, cl->loop, block_of[i])) {
+            in.label = pre_label;
+        }
+        ir_push_instr(&code, in);
+    }
+    free(fn->code.items);
+    fn->code = code;
+}
+
+/* Replaces counted loops that only update variables with polynomials of
+   degree up to 2 in the counter by the closed form of their final values.
+   The original loop stays behind guards for starts past the bound and for
+   counters or distances that would wrap around, keeping 64-bit wraparound
+   semantics. Expects phi-free IR. */
+int scev_replace_loops(IRFunction *fn, int report) {
+    int changed = 0;
+    size_t done_cap = 8;
+    size_t done_len = 0;
+    int *done = xmalloc(done_cap * sizeof(int));
+    for (;;) {
+        CFG cfg;
+        cfg_build(fn, &cfg);
+        cfg_compute_dominators(&cfg);
+        cfg_find_loops(&cfg);
+
+        int *block_of = xmalloc((fn->code.len + 1) * sizeof(int));
+        int *defs = xmalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1) * sizeof(int));
+        for (size_t b = 0; b < cfg.len; b++) {
+            for (size_t i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) {
+                block_of[i] = (int)b;
+            }
+        }
+        for (int t = 0; t < fn->temp_count; t++) {
+            defs[t] = -1;
+        }
+        for (size_t i = 0; i < fn->code.len; i++) {
+            int d = ir_instr_def(&fn->code.items[i]);
+            if (d >= 0) {
+                defs[d] = (int)i;
+            }
+        }
+
+        int replaced = 0;
+        for (size_t l = 0; l < cfg.loop_count && !replaced; l++) {
+            CountedLoop cl;
+            int seen = 0;
+            int header_label = cfg.blocks[cfg.loops[l].header].label;
+            for (size_t k = 0; k < done_len; k++) {
+                seen |= done[k] == header_label;
+            }
+            if (seen || !scev_counted_loop(fn, &cfg, defs, block_of, (int)l, &cl)) {
+                continue;
+            }
+            if (done_len == done_cap) {
+                grow((void **)&done, &done_cap, sizeof(int));
+            }
+            done[done_len++] = header_label;
+
+            ScevBuild b;
+            memset(&b, 0, sizeof(b));
+            b.fn = fn;
+            b.cl = &cl;
+            b.defs = defs;
+            b.sym = xmalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1) * sizeof(Poly));
+            b.store_at = xmalloc((fn->vars.len + 1) * sizeof(int));
+            int temps = fn->temp_count;
+            if (build_closed_form(&b)) {
+                splice_closed_form(fn, &cfg, block_of, &cl, &b.pre);
+                replaced = 1;
+                if (report) {
+                    printf("scev: %s:%d: loop replaced by its closed form\n", fn->name, cl.line);
+                }
+            } else {
+                fn->temp_count = temps;
+            }
+            free(b.pre.items);
+            free(b.store_at);
+            free(b.sym);
+        }
+
+        free(defs);
+        free(block_of);
+        free_cfg(&cfg);
+        if (!replaced) {
+            break;
+        }
+        changed = 1;
+    }
+    free(done);
+    return changed;
+}
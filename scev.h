@@ -0,0 +1,32 @@
+#ifndef SCEV_H
+#define SCEV_H
+
+#include "cfg.h"
+#include "ir.h"
+
+#include <stddef.h>
+
+/* A loop made of one header block testing `var cmp bound` against a
+   loop-invariant bound and one straight-line body block whose only store to
+   var steps it by a constant towards the bound. cmp is normalized so var is
+   its left operand. */
+typedef struct CountedLoop {
+    int loop;
+    int header_label;
+    int exit_label;
+    size_t cond_start; /* header instructions between the label and jmp_false */
+    size_t cond_end;
+    size_t body_start; /* body instructions before the back-edge jmp */
+    size_t body_end;
+    int var;
+    long step;
+    IRBinOp cmp;
+    int bound;
+    int line;
+} CountedLoop;
+
+int scev_counted_loop(const IRFunction *fn, const CFG *cfg, const int *defs, const int *block_of, int loop,
+                      CountedLoop *out);
+int scev_replace_loops(IRFunction *fn, int report);
+
+#endif
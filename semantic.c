@@ -10,12 +10,18 @@ typedef struct VarSym {
     TypeKind type;
     int mutable_flag;
     int depth;
+    long array_len; /* elements of an ember array, 0 otherwise */
 } VarSym;
 
 typedef struct FnSym {
     char *name;
     TypeKind ret;
     ParamArray params;
+    int memo;
+    int chants; /* chants directly or through a glyph it invokes */
+    int *callees;
+    size_t callee_len;
+    size_t callee_cap;
     int line;
     int col;
 } FnSym;
@@ -94,7 +100,8 @@ static void end_scope(Checker *c) {
     c->depth--;
 }
 
-static void define_var(Checker *c, const char *name, TypeKind type, int mutable_flag, int line, int col) {
+static void define_var(Checker *c, const char *name, TypeKind type, long array_len, int mutable_flag, int line,
+                       int col) {
     for (size_t i = c->var_len; i > 0; i--) {
         VarSym *v = &c->vars[i - 1];
         if (v->depth != c->depth) {
@@ -110,6 +117,7 @@ static void define_var(Checker *c, const char *name, TypeKind type, int mutable_
     v.type = type;
     v.mutable_flag = mutable_flag;
     v.depth = c->depth;
+    v.array_len = array_len;
     var_push(c, v);
 }
 
@@ -121,6 +129,36 @@ static void require_type(Checker *c, Expr *e, TypeKind got, TypeKind expected, c
     }
 }
 
+static VarSym *check_index(Checker *c, const char *name, Expr *index, int line, int col) {
+    VarSym *v = find_var(c, name);
+    if (!v) {
+        fatal_at(c->file, line, col, "unknown symbol '%s'", name);
+    }
+    if (v->type != TYPE_ARRAY) {
+        fatal_at(c->file, line, col, "'%s' is %s, not an array", name, type_name(v->type));
+    }
+    require_type(c, index, check_expr(c, index), TYPE_INT, "array index");
+    long k;
+    if (expr_literal_int(index, &k) && (k < 0 || k >= v->array_len)) {
+        fatal_at(c->file, index->line, index->col, "index %ld is out of range for '%s' of length %ld", k, name,
+                 v->array_len);
+    }
+    return v;
+}
+
+/* Arrays are only created as the value of a bind or morph. */
+static TypeKind check_array(Checker *c, Expr *e) {
+    if (e->as.array.len < 1 || e->as.array.len > ARRAY_MAX_LEN) {
+        fatal_at(c->file, e->line, e->col, "array length must be between 1 and %d", ARRAY_MAX_LEN);
+    }
+    for (size_t i = 0; i < e->as.array.items.len; i++) {
+        Expr *item = e->as.array.items.items[i];
+        require_type(c, item, check_expr(c, item), TYPE_INT, "array element");
+    }
+    e->inferred_type = TYPE_ARRAY;
+    return TYPE_ARRAY;
+}
+
 static TypeKind check_call(Checker *c, Expr *e) {
     FnSym *fn = find_fn(c, e->as.call.name);
     if (!fn) {
@@ -137,6 +175,13 @@ static TypeKind check_call(Checker *c, Expr *e) {
                  e->as.call.name, fn->params.len, e->as.call.args.len);
     }
 
+    FnSym *caller = c->current_fn;
+    if (caller->callee_len == caller->callee_cap) {
+        caller->callee_cap = caller->callee_cap == 0 ? 8 : caller->callee_cap * 2;
+        caller->callees = xrealloc(caller->callees, caller->callee_cap * sizeof(int));
+    }
+    caller->callees[caller->callee_len++] = (int)(fn - c->fns);
+
     for (size_t i = 0; i < e->as.call.args.len; i++) {
         TypeKind arg_t = check_expr(c, e->as.call.args.items[i]);
         TypeKind exp_t = fn->params.items[i].type;
@@ -172,9 +217,19 @@ static TypeKind check_expr(Checker *c, Expr *e) {
             if (!v) {
                 fatal_at(c->file, e->line, e->col, "unknown symbol '%s'", e->as.var_name);
             }
+            if (v->type == TYPE_ARRAY) {
+                fatal_at(c->file, e->line, e->col, "array '%s' can only be used through an index", e->as.var_name);
+            }
             t = v->type;
             break;
         }
+        case EXPR_ARRAY:
+            fatal_at(c->file, e->line, e->col, "arrays can only be the value of bind or morph");
+            break;
+        case EXPR_INDEX:
+            check_index(c, e->as.index.name, e->as.index.index, e->line, e->col);
+            t = TYPE_INT;
+            break;
         case EXPR_CALL:
             t = check_call(c, e);
             break;
@@ -183,6 +238,9 @@ static TypeKind check_expr(Checker *c, Expr *e) {
             if (e->as.unary.op == UN_NEG) {
                 require_type(c, e->as.unary.operand, inner, TYPE_INT, "negation");
                 t = TYPE_INT;
+            } else if (e->as.unary.op == UN_SPAN) {
+                require_type(c, e->as.unary.operand, inner, TYPE_STRING, "span");
+                t = TYPE_INT;
             } else {
                 require_type(c, e->as.unary.operand, inner, TYPE_BOOL, "flip");
                 t = TYPE_BOOL;
@@ -197,6 +255,10 @@ static TypeKind check_expr(Checker *c, Expr *e) {
                 case BIN_SUB:
                 case BIN_MUL:
                 case BIN_DIV:
+                    if (e->as.binary.op == BIN_ADD && lt == TYPE_STRING && rt == TYPE_STRING) {
+                        t = TYPE_STRING;
+                        break;
+                    }
                     if (lt != TYPE_INT || rt != TYPE_INT) {
                         fatal_at(c->file, e->line, e->col, "arithmetic needs ember operands");
                     }
@@ -238,16 +300,27 @@ static void check_block(Checker *c, Block *block);
 static void check_stmt(Checker *c, Stmt *s) {
     switch (s->kind) {
         case STMT_BIND: {
-            TypeKind t = check_expr(c, s->as.bind.value);
-            define_var(c, s->as.bind.name, t, 0, s->line, s->col);
+            Expr *value = s->as.bind.value;
+            TypeKind t = value->kind == EXPR_ARRAY ? check_array(c, value) : check_expr(c, value);
+            define_var(c, s->as.bind.name, t, t == TYPE_ARRAY ? value->as.array.len : 0, 0, s->line, s->col);
             break;
         }
         case STMT_MORPH: {
-            TypeKind t = check_expr(c, s->as.morph.value);
-            define_var(c, s->as.morph.name, t, 1, s->line, s->col);
+            Expr *value = s->as.morph.value;
+            TypeKind t = value->kind == EXPR_ARRAY ? check_array(c, value) : check_expr(c, value);
+            define_var(c, s->as.morph.name, t, t == TYPE_ARRAY ? value->as.array.len : 0, 1, s->line, s->col);
             break;
         }
         case STMT_SHIFT: {
+            if (s->as.shift.index) {
+                VarSym *v = check_index(c, s->as.shift.name, s->as.shift.index, s->line, s->col);
+                if (!v->mutable_flag) {
+                    fatal_at(c->file, s->line, s->col, "cannot shift elements of immutable array '%s'",
+                             s->as.shift.name);
+                }
+                require_type(c, s->as.shift.value, check_expr(c, s->as.shift.value), TYPE_INT, "array element");
+                break;
+            }
             VarSym *v = find_var(c, s->as.shift.name);
             if (!v) {
                 fatal_at(c->file, s->line, s->col, "unknown symbol '%s'", s->as.shift.name);
@@ -255,6 +328,10 @@ static void check_stmt(Checker *c, Stmt *s) {
             if (!v->mutable_flag) {
                 fatal_at(c->file, s->line, s->col, "cannot shift immutable symbol '%s'", s->as.shift.name);
             }
+            if (v->type == TYPE_ARRAY) {
+                fatal_at(c->file, s->line, s->col, "cannot shift array '%s' as a whole, shift its elements",
+                         s->as.shift.name);
+            }
             TypeKind t = check_expr(c, s->as.shift.value);
             if (t != v->type) {
                 fatal_at(c->file, s->line, s->col,
@@ -327,6 +404,7 @@ static void check_stmt(Checker *c, Stmt *s) {
             if (t != TYPE_INT && t != TYPE_BOOL && t != TYPE_STRING) {
                 fatal_at(c->file, s->line, s->col, "chant supports ember|pulse|text");
             }
+            c->current_fn->chants = 1;
             break;
         }
         case STMT_EXPR: {
@@ -349,9 +427,11 @@ static void collect_functions(Checker *c) {
             fatal_at(c->file, f->line, f->col, "duplicate glyph '%s'", f->name);
         }
         FnSym sym;
+        memset(&sym, 0, sizeof(sym));
         sym.name = f->name;
         sym.ret = f->return_type;
         sym.params = f->params;
+        sym.memo = f->memo;
         sym.line = f->line;
         sym.col = f->col;
         fn_push(c, sym);
@@ -368,7 +448,14 @@ static void check_function(Checker *c, Function *f) {
     begin_scope(c);
     for (size_t i = 0; i < f->params.len; i++) {
         Param *p = &f->params.items[i];
-        define_var(c, p->name, p->type, 0, p->line, p->col);
+        if (f->memo && p->type != TYPE_INT && p->type != TYPE_BOOL) {
+            fatal_at(c->file, p->line, p->col, "parameter '%s' of memo glyph '%s' must be ember or pulse", p->name,
+                     f->name);
+        }
+        define_var(c, p->name, p->type, 0, 0, p->line, p->col);
+    }
+    if (f->memo && f->return_type == TYPE_VOID) {
+        fatal_at(c->file, f->line, f->col, "memo glyph '%s' must yield a value", f->name);
     }
     check_block(c, f->body);
     end_scope(c);
@@ -378,6 +465,29 @@ static void check_function(Checker *c, Function *f) {
     }
 }
 
+/* Memo glyphs skip their body on a cache hit, so neither they nor anything
+   they invoke may chant. */
+static void check_memo_purity(Checker *c) {
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (size_t i = 0; i < c->fn_len; i++) {
+            FnSym *fn = &c->fns[i];
+            for (size_t k = 0; k < fn->callee_len && !fn->chants; k++) {
+                if (c->fns[fn->callees[k]].chants) {
+                    fn->chants = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < c->fn_len; i++) {
+        if (c->fns[i].memo && c->fns[i].chants) {
+            fatal_at(c->file, c->fns[i].line, c->fns[i].col,
+                     "memo glyph '%s' must not chant, directly or through the glyphs it invokes", c->fns[i].name);
+        }
+    }
+}
+
 void semantic_check_program(const char *file, Program *program, SemanticResult *out_result) {
     Checker c;
     memset(&c, 0, sizeof(c));
@@ -397,10 +507,18 @@ void semantic_check_program(const char *file, Program *program, SemanticResult *
         fatal("glyph main must yield ember");
     }
 
+    if (main_fn->memo) {
+        fatal("glyph main cannot be memo");
+    }
+
     for (size_t i = 0; i < program->functions.len; i++) {
         check_function(&c, &program->functions.items[i]);
     }
+    check_memo_purity(&c);
 
+    for (size_t i = 0; i < c.fn_len; i++) {
+        free(c.fns[i].callees);
+    }
     free(c.fns);
     free(c.vars);
 
@@ -0,0 +1,419 @@
+#include "ssa.h"
+
+#include "cfg.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void grow(void **items, size_t *cap, size_t elem_size) {
+    size_t next = *cap == 0 ? 8 : *cap * 2;
+    *items = xrealloc(*items, next * elem_size);
+    *cap = next;
+}
+
+static void replace_code(IRFunction *fn, IRInstrArray code) {
+    free(fn->code.items);
+    fn->code = code;
+}
+
+/* Gives every block a leading label so phi operands can name their
+   predecessor, and makes sure the entry block has no predecessors. */
+static void label_all_blocks(IRFunction *fn) {
+    CFG cfg;
+    cfg_build(fn, &cfg);
+    IRInstrArray code;
+    memset(&code, 0, sizeof(code));
+
+    if (cfg.len > 0 && cfg.blocks[0].preds.len > 0) {
+        IRInstr entry = ir_make_instr(IROP_LABEL);
+        entry.label = fn->label_count++;
+        ir_push_instr(&code, entry);
+        IRInstr jmp = ir_make_instr(IROP_JMP);
+        jmp.label = cfg.blocks[0].label;
+        ir_push_instr(&code, jmp);
+    }
+    for (size_t b = 0; b < cfg.len; b++) {
+        if (cfg.blocks[b].label < 0) {
+            IRInstr lbl = ir_make_instr(IROP_LABEL);
+            lbl.label = fn->label_count++;
+            ir_push_instr(&code, lbl);
+        }
+        for (size_t i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) {
+            ir_push_instr(&code, fn->code.items[i]);
+        }
+    }
+
+    free_cfg(&cfg);
+    replace_code(fn, code);
+}
+
+typedef struct Renamer {
+    IRFunction *fn;
+    CFG *cfg;
+    const unsigned char *promoted;
+    int base_temps; /* temps at or above this were created here, e.g. parameter loads */
+    int *current;
+    int *rename;
+    unsigned char *dead;
+} Renamer;
+
+static void rename_block(Renamer *r, int b) {
+    IRFunction *fn = r->fn;
+    CFGBlock *blk = &r->cfg->blocks[b];
+    size_t nvars = fn->vars.len;
+    int *saved = xmalloc(nvars * sizeof(int));
+    memcpy(saved, r->current, nvars * sizeof(int));
+
+    for (size_t i = blk->start; i < blk->end; i++) {
+        IRInstr *in = &fn->code.items[i];
+        if (in->op == IROP_PHI) {
+            r->current[in->var_index] = in->dst;
+        } else if (in->op == IROP_LOAD_VAR && r->promoted[in->var_index] && in->dst < r->base_temps) {
+            r->rename[in->dst] = r->current[in->var_index];
+            r->dead[i] = 1;
+        } else if (in->op == IROP_STORE_VAR && r->promoted[in->var_index]) {
+            r->current[in->var_index] = in->src1;
+            r->dead[i] = 1;
+        }
+    }
+
+    for (size_t s = 0; s < blk->succs.len; s++) {
+        CFGBlock *succ = &r->cfg->blocks[blk->succs.items[s]];
+        for (size_t i = succ->start; i < succ->end; i++) {
+            IRInstr *in = &fn->code.items[i];
+            if (in->op == IROP_LABEL) {
+                continue;
+            }
+            if (in->op != IROP_PHI) {
+                break;
+            }
+            for (int k = 0; k < in->phi_count; k++) {
+                if (in->phi_labels[k] == blk->label) {
+                    in->phi_temps[k] = r->current[in->var_index];
+                }
+            }
+        }
+    }
+
+    for (size_t c = 0; c < blk->dom_children.len; c++) {
+        rename_block(r, blk->dom_children.items[c]);
+    }
+
+    memcpy(r->current, saved, nvars * sizeof(int));
+    free(saved);
+}
+
+static int resolve(const int *rename, int t) {
+    while (t >= 0 && rename[t] >= 0) {
+        t = rename[t];
+    }
+    return t;
+}
+
+/* Promotes every variable slot to SSA temps (Cytron et al.): phis are placed
+   on the iterated dominance frontier of each variable's stores, pruned to
+   blocks where the variable is live, and loads/stores are then renamed along
+   the dominator tree. Parameters keep a single load of their incoming slot in
+   the entry block. Returns 0 when the function was left unchanged. */
+int ssa_construct(IRFunction *fn) {
+    size_t nvars = fn->vars.len;
+    if (fn->code.len == 0 || nvars == 0) {
+        return 0;
+    }
+    int base_temps = fn->temp_count;
+
+    label_all_blocks(fn);
+
+    CFG cfg;
+    cfg_build(fn, &cfg);
+    for (size_t b = 0; b < cfg.len; b++) {
+        if (!cfg.blocks[b].reachable) {
+            free_cfg(&cfg);
+            return 0;
+        }
+    }
+    cfg_compute_dominators(&cfg);
+    cfg_compute_frontiers(&cfg);
+    unsigned char *live_in = cfg_var_live_in(fn, &cfg);
+
+    /* has_phi[b * nvars + v] marks phi placement; variables whose phis would
+       exceed IR_MAX_USES operands stay in memory. */
+    unsigned char *has_phi = xcalloc(cfg.len * nvars, 1);
+    unsigned char *promoted = xmalloc(nvars);
+    int *work = xmalloc(cfg.len * sizeof(int));
+    unsigned char *queued = xmalloc(cfg.len);
+
+    for (size_t v = 0; v < nvars; v++) {
+        size_t wl = 0;
+        promoted[v] = 1;
+        memset(queued, 0, cfg.len);
+        queued[0] = 1;
+        work[wl++] = 0;
+        for (size_t b = 0; b < cfg.len; b++) {
+            for (size_t i = cfg.blocks[b].start; i < cfg.blocks[b].end && !queued[b]; i++) {
+                const IRInstr *in = &fn->code.items[i];
+                if (in->op == IROP_STORE_VAR && in->var_index == (int)v) {
+                    queued[b] = 1;
+                    work[wl++] = (int)b;
+                }
+            }
+        }
+        while (wl > 0) {
+            int b = work[--wl];
+            const CFGEdgeArray *df = &cfg.blocks[b].frontier;
+            for (size_t f = 0; f < df->len; f++) {
+                int y = df->items[f];
+                if (has_phi[(size_t)y * nvars + v] || !live_in[(size_t)y * nvars + v]) {
+                    continue;
+                }
+                has_phi[(size_t)y * nvars + v] = 1;
+                if (cfg.blocks[y].preds.len > IR_MAX_USES) {
+                    promoted[v] = 0;
+                }
+                if (!queued[y]) {
+                    queued[y] = 1;
+                    work[wl++] = y;
+                }
+            }
+        }
+        if (!promoted[v]) {
+            for (size_t b = 0; b < cfg.len; b++) {
+                has_phi[b * nvars + v] = 0;
+            }
+        }
+    }
+
+    /* Rebuild the code with phis after each block's label and initial
+       definitions at the top of the entry block. */
+    IRInstrArray code;
+    memset(&code, 0, sizeof(code));
+    int *initial = xmalloc(nvars * sizeof(int));
+    int undef = -1;
+    for (size_t b = 0; b < cfg.len; b++) {
+        const CFGBlock *blk = &cfg.blocks[b];
+        size_t i = blk->start;
+        while (i < blk->end && fn->code.items[i].op == IROP_LABEL) {
+            ir_push_instr(&code, fn->code.items[i]);
+            i++;
+        }
+        if (b == 0) {
+            for (size_t v = 0; v < nvars; v++) {
+                initial[v] = -1;
+                if (!promoted[v]) {
+                    continue;
+                }
+                if ((int)v < fn->param_count) {
+                    IRInstr ld = ir_make_instr(IROP_LOAD_VAR);
+                    ld.dst = fn->temp_count++;
+                    ld.var_index = (int)v;
+                    ir_push_instr(&code, ld);
+                    initial[v] = ld.dst;
+                } else {
+                    /* Never observed: the checker rejects reads before a binding. */
+                    if (undef < 0) {
+                        IRInstr zero = ir_make_instr(IROP_IMM_INT);
+                        zero.dst = undef = fn->temp_count++;
+                        ir_push_instr(&code, zero);
+                    }
+                    initial[v] = undef;
+                }
+            }
+        }
+        for (size_t v = 0; v < nvars; v++) {
+            if (!has_phi[b * nvars + v]) {
+                continue;
+            }
+            IRInstr phi = ir_make_instr(IROP_PHI);
+            phi.dst = fn->temp_count++;
+            phi.var_index = (int)v;
+            phi.type = fn->vars.items[v].type;
+            phi.phi_count = (int)blk->preds.len;
+            phi.phi_temps = xmalloc(blk->preds.len * sizeof(int));
+            phi.phi_labels = xmalloc(blk->preds.len * sizeof(int));
+            for (size_t p = 0; p < blk->preds.len; p++) {
+                phi.phi_temps[p] = -1;
+                phi.phi_labels[p] = cfg.blocks[blk->preds.items[p]].label;
+            }
+            ir_push_instr(&code, phi);
+        }
+        for (; i < blk->end; i++) {
+            ir_push_instr(&code, fn->code.items[i]);
+        }
+    }
+    replace_code(fn, code);
+    free_cfg(&cfg);
+
+    cfg_build(fn, &cfg);
+    cfg_compute_dominators(&cfg);
+
+    Renamer r;
+    r.fn = fn;
+    r.cfg = &cfg;
+    r.promoted = promoted;
+    r.base_temps = base_temps;
+    r.current = initial;
+    r.rename = xmalloc((size_t)fn->temp_count * sizeof(int));
+    r.dead = xcalloc(fn->code.len + 1, 1);
+    for (int t = 0; t < fn->temp_count; t++) {
+        r.rename[t] = -1;
+    }
+    rename_block(&r, 0);
+
+    for (size_t i = 0; i < fn->code.len; i++) {
+        int *refs[IR_MAX_USES];
+        int n = ir_instr_use_refs(&fn->code.items[i], refs);
+        for (int k = 0; k < n; k++) {
+            *refs[k] = resolve(r.rename, *refs[k]);
+        }
+    }
+    ir_remove_instrs(fn, r.dead);
+
+    free(r.dead);
+    free(r.rename);
+    free(initial);
+    free(queued);
+    free(work);
+    free(promoted);
+    free(has_phi);
+    free(live_in);
+    free_cfg(&cfg);
+    return 1;
+}
+
+typedef struct EdgeCopy {
+    int var;
+    int temp;
+} EdgeCopy;
+
+typedef struct EdgeCopyArray {
+    EdgeCopy *items;
+    size_t len;
+    size_t cap;
+} EdgeCopyArray;
+
+static void copy_push(EdgeCopyArray *arr, int var, int temp) {
+    if (arr->len == arr->cap) {
+        grow((void **)&arr->items, &arr->cap, sizeof(EdgeCopy));
+    }
+    arr->items[arr->len].var = var;
+    arr->items[arr->len].temp = temp;
+    arr->len++;
+}
+
+static void emit_copies(IRInstrArray *code, const EdgeCopyArray *copies) {
+    for (size_t c = 0; c < copies->len; c++) {
+        IRInstr st = ir_make_instr(IROP_STORE_VAR);
+        st.var_index = copies->items[c].var;
+        st.src1 = copies->items[c].temp;
+        ir_push_instr(code, st);
+    }
+}
+
+/* Lowers phis back to variable slots: each incoming edge stores its operand
+   into the phi's original slot and the phi becomes a load. Edges leaving a
+   conditional branch towards its label target are split into a stub placed
+   after the function body. */
+void ssa_destruct(IRFunction *fn) {
+    CFG cfg;
+    cfg_build(fn, &cfg);
+
+    /* Per block: copies for the edge to its fall-through successor, for the
+       edge to its branch target, and for an unconditional exit. */
+    EdgeCopyArray *fall = xcalloc(cfg.len + 1, sizeof(EdgeCopyArray));
+    EdgeCopyArray *taken = xcalloc(cfg.len + 1, sizeof(EdgeCopyArray));
+    int any = 0;
+
+    for (size_t b = 0; b < cfg.len; b++) {
+        const CFGBlock *blk = &cfg.blocks[b];
+        for (size_t i = blk->start; i < blk->end; i++) {
+            IRInstr *in = &fn->code.items[i];
+            if (in->op == IROP_LABEL) {
+                continue;
+            }
+            if (in->op != IROP_PHI) {
+                break;
+            }
+            for (int k = 0; k < in->phi_count; k++) {
+                int p = cfg_block_of_label(&cfg, in->phi_labels[k]);
+                if (p < 0 || in->phi_temps[k] < 0) {
+                    continue;
+                }
+                const IRInstr *last = &fn->code.items[cfg.blocks[p].end - 1];
+                int to_target = (last->op == IROP_JMP || last->op == IROP_JMP_FALSE) &&
+                                cfg_block_of_label(&cfg, last->label) == (int)b;
+                int to_fall = last->op != IROP_JMP && last->op != IROP_RET && (size_t)p + 1 == b;
+                if (to_target && last->op == IROP_JMP_FALSE) {
+                    copy_push(&taken[p], in->var_index, in->phi_temps[k]);
+                }
+                if (to_fall || !to_target || last->op == IROP_JMP) {
+                    copy_push(&fall[p], in->var_index, in->phi_temps[k]);
+                }
+            }
+            int var = in->var_index;
+            int dst = in->dst;
+            ir_free_instr(in);
+            *in = ir_make_instr(IROP_LOAD_VAR);
+            in->dst = dst;
+            in->var_index = var;
+            any = 1;
+        }
+    }
+
+    if (!any) {
+        free(fall);
+        free(taken);
+        free_cfg(&cfg);
+        return;
+    }
+
+    IRInstrArray code;
+    IRInstrArray stubs;
+    memset(&code, 0, sizeof(code));
+    memset(&stubs, 0, sizeof(stubs));
+    for (size_t b = 0; b < cfg.len; b++) {
+        const CFGBlock *blk = &cfg.blocks[b];
+        for (size_t i = blk->start; i + 1 < blk->end; i++) {
+            ir_push_instr(&code, fn->code.items[i]);
+        }
+        IRInstr last = fn->code.items[blk->end - 1];
+        if (last.op == IROP_JMP) {
+            emit_copies(&code, &fall[b]);
+            ir_push_instr(&code, last);
+        } else if (last.op == IROP_JMP_FALSE) {
+            if (taken[b].len > 0) {
+                IRInstr lbl = ir_make_instr(IROP_LABEL);
+                lbl.label = fn->label_count++;
+                ir_push_instr(&stubs, lbl);
+                emit_copies(&stubs, &taken[b]);
+                IRInstr jmp = ir_make_instr(IROP_JMP);
+                jmp.label = last.label;
+                ir_push_instr(&stubs, jmp);
+                last.label = lbl.label;
+            }
+            ir_push_instr(&code, last);
+            emit_copies(&code, &fall[b]);
+        } else {
+            ir_push_instr(&code, last);
+            emit_copies(&code, &fall[b]);
+        }
+        free(fall[b].items);
+        free(taken[b].items);
+    }
+
+    if (stubs.len > 0) {
+        if (code.len > 0 && code.items[code.len - 1].op != IROP_JMP && code.items[code.len - 1].op != IROP_RET) {
+            IRInstr ret = ir_make_instr(IROP_RET);
+            ir_push_instr(&code, ret);
+        }
+        for (size_t i = 0; i < stubs.len; i++) {
+            ir_push_instr(&code, stubs.items[i]);
+        }
+    }
+    free(stubs.items);
+
+    replace_code(fn, code);
+    free(fall);
+    free(taken);
+    free_cfg(&cfg);
+}
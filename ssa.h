@@ -0,0 +1,9 @@
+#ifndef SSA_H
+#define SSA_H
+
+#include "ir.h"
+
+int ssa_construct(IRFunction *fn);
+void ssa_destruct(IRFunction *fn);
+
+#endif
@@ -0,0 +1,223 @@
+#include "tailrec.h"
+
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum SiteKind {
+    SITE_NONE,
+    SITE_TAIL,       /* offer f(args) */
+    SITE_ACCUMULATE  /* offer x + f(args), offer x * f(args) */
+} SiteKind;
+
+/* Per instruction: what the rewrite does with it. */
+typedef struct Site {
+    SiteKind kind;
+    size_t call;
+    size_t combine;
+    IRBinOp op;
+    int other;
+} Site;
+
+/* Instructions that may sit between a recursive call and its return without
+   being observable when they run before the deeper levels instead of after.
+   Divisions are excluded because they can trap. */
+static int is_quiet(const IRInstr *in) {
+    switch (in->op) {
+        case IROP_IMM_INT:
+        case IROP_IMM_BOOL:
+        case IROP_IMM_STR:
+        case IROP_LOAD_VAR:
+        case IROP_UN:
+            return 1;
+        case IROP_BIN:
+            return in->binop != IRBIN_DIV;
+        default:
+            return 0;
+    }
+}
+
+static int uses_temp(const IRInstr *in, int t) {
+    int ops[IR_MAX_USES];
+    int n = ir_instr_uses(in, ops);
+    for (int k = 0; k < n; k++) {
+        if (ops[k] == t) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Matches a self call at index i followed by quiet instructions and either a
+   return of its result, or one add/mul combining it with another value whose
+   result is returned. Fills *site and returns the index of the return. */
+static size_t match_site(const IRFunction *fn, size_t i, Site *site) {
+    const IRInstr *call = &fn->code.items[i];
+    if (call->op != IROP_CALL || strcmp(call->name, fn->name) != 0) {
+        return 0;
+    }
+    memset(site, 0, sizeof(*site));
+    site->call = i;
+    int c = call->dst;
+    size_t combine = 0;
+    for (size_t j = i + 1; j < fn->code.len; j++) {
+        const IRInstr *in = &fn->code.items[j];
+        if (in->op == IROP_RET) {
+            if (combine == 0 && (c < 0 ? !in->has_value : in->has_value && in->src1 == c)) {
+                site->kind = SITE_TAIL;
+                return j;
+            }
+            if (combine != 0 && in->has_value && in->src1 == fn->code.items[combine].dst) {
+                site->kind = SITE_ACCUMULATE;
+                return j;
+            }
+            return 0;
+        }
+        if (!is_quiet(in)) {
+            return 0;
+        }
+        if (c < 0 || !uses_temp(in, c)) {
+            continue;
+        }
+        if (combine != 0 || fn->return_type != TYPE_INT || in->op != IROP_BIN ||
+            (in->binop != IRBIN_ADD && in->binop != IRBIN_MUL) || in->src1 == in->src2) {
+            return 0;
+        }
+        combine = j;
+        site->combine = j;
+        site->op = in->binop;
+        site->other = in->src1 == c ? in->src2 : in->src1;
+    }
+    return 0;
+}
+
+static int new_temp(IRFunction *fn) {
+    return fn->temp_count++;
+}
+
+static int emit_combine(IRFunction *fn, IRInstrArray *code, int acc_var, IRBinOp op, int value) {
+    IRInstr ld = ir_make_instr(IROP_LOAD_VAR);
+    ld.dst = new_temp(fn);
+    ld.var_index = acc_var;
+    ir_push_instr(code, ld);
+    IRInstr bin = ir_make_instr(IROP_BIN);
+    bin.dst = new_temp(fn);
+    bin.binop = op;
+    bin.src1 = ld.dst;
+    bin.src2 = value;
+    ir_push_instr(code, bin);
+    return bin.dst;
+}
+
+/* Turns self-recursive tail calls into jumps to the top of the glyph after
+   storing the new arguments into the parameter slots. Linear recursion that
+   combines the recursive result with add or mul (both associative and
+   commutative, also under 64-bit wraparound) becomes a loop over an
+   accumulator that starts at the identity and is folded into every
+   remaining return. */
+int eliminate_tail_recursion(IRFunction *fn, int report) {
+    size_t n = fn->code.len;
+    Site *sites = xcalloc(n + 1, sizeof(Site));
+    unsigned char *skip = xcalloc(n + 1, 1);
+    int have_acc = 0;
+    IRBinOp acc_op = IRBIN_ADD;
+    int found = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        Site site;
+        size_t ret = match_site(fn, i, &site);
+        if (ret == 0) {
+            continue;
+        }
+        if (site.kind == SITE_ACCUMULATE) {
+            if (have_acc && site.op != acc_op) {
+                continue;
+            }
+            have_acc = 1;
+            acc_op = site.op;
+        }
+        sites[ret] = site;
+        skip[i] = 1;
+        if (site.kind == SITE_ACCUMULATE) {
+            skip[site.combine] = 1;
+        }
+        found = 1;
+        if (report) {
+            printf("tailrec: %s:%d: %s\n", fn->name, fn->code.items[i].line,
+                   site.kind == SITE_TAIL ? "tail call turned into a jump"
+                                          : "accumulating recursion turned into a loop");
+        }
+    }
+    if (!found) {
+        free(skip);
+        free(sites);
+        return 0;
+    }
+
+    IRInstrArray code;
+    memset(&code, 0, sizeof(code));
+    int start = fn->label_count++;
+    int acc_var = -1;
+    if (have_acc) {
+        acc_var = ir_add_var(fn, "tailrec.acc", TYPE_INT, 1, 0);
+
+        IRInstr init = ir_make_instr(IROP_IMM_INT);
+        init.dst = new_temp(fn);
+        init.imm = acc_op == IRBIN_MUL ? 1 : 0;
+        ir_push_instr(&code, init);
+        IRInstr st = ir_make_instr(IROP_STORE_VAR);
+        st.var_index = acc_var;
+        st.src1 = init.dst;
+        ir_push_instr(&code, st);
+    }
+    IRInstr top = ir_make_instr(IROP_LABEL);
+    top.label = start;
+    ir_push_instr(&code, top);
+
+    for (size_t i = 0; i < n; i++) {
+        IRInstr *in = &fn->code.items[i];
+        if (skip[i]) {
+            ir_free_instr(in);
+            continue;
+        }
+        const Site *site = &sites[i];
+        if (site->kind == SITE_NONE) {
+            if (in->op == IROP_RET && in->has_value && have_acc) {
+                in->src1 = emit_combine(fn, &code, acc_var, acc_op, in->src1);
+            }
+            ir_push_instr(&code, *in);
+            continue;
+        }
+
+        const IRInstr *call = &fn->code.items[site->call];
+        if (site->kind == SITE_ACCUMULATE) {
+            int next = emit_combine(fn, &code, acc_var, acc_op, site->other);
+            IRInstr st = ir_make_instr(IROP_STORE_VAR);
+            st.var_index = acc_var;
+            st.src1 = next;
+            ir_push_instr(&code, st);
+        }
+        for (int p = 0; p < call->argc; p++) {
+            IRInstr st = ir_make_instr(IROP_STORE_VAR);
+            st.line = call->line;
+            st.col = call->col;
+            st.var_index = p;
+            st.src1 = call->args[p];
+            ir_push_instr(&code, st);
+        }
+        IRInstr jmp = ir_make_instr(IROP_JMP);
+        jmp.line = in->line;
+        jmp.col = in->col;
+        jmp.label = start;
+        ir_push_instr(&code, jmp);
+        ir_free_instr(in);
+    }
+
+    free(fn->code.items);
+    fn->code = code;
+    free(skip);
+    free(sites);
+    return 1;
+}
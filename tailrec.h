@@ -0,0 +1,8 @@
+#ifndef TAILREC_H
+#define TAILREC_H
+
+#include "ir.h"
+
+int eliminate_tail_recursion(IRFunction *fn, int report);
+
+#endif
@@ -0,0 +1,224 @@
+#include "unroll.h"
+
+#include "scev.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Instructions an unrolled loop body may grow to. */
+#define UNROLL_MAX_INSTRS 64
+
+static void grow(void **items, size_t *cap, size_t elem_size) {
+    size_t next = *cap == 0 ? 8 : *cap * 2;
+    *items = xrealloc(*items, next * elem_size);
+    *cap = next;
+}
+
+static void copy_range(IRFunction *fn, IRInstrArray *code, size_t start, size_t end, int *rename) {
+    for (size_t i = start; i < end; i++) {
+        const IRInstr *src = &fn->code.items[i];
+        IRInstr in = *src;
+        in.name = src->name ? xstrdup(src->name) : NULL;
+        int *refs[IR_MAX_USES];
+        int n = ir_instr_use_refs(&in, refs);
+        for (int k = 0; k < n; k++) {
+            *refs[k] = rename[*refs[k]];
+        }
+        if (ir_instr_def(&in) >= 0) {
+            rename[src->dst] = fn->temp_count++;
+            in.dst = rename[src->dst];
+        }
+        ir_push_instr(code, in);
+    }
+}
+
+/* Places an unrolled copy of the loop in front of it. A preheader computes
+   lim = bound - (factor - 1) * step; while var still compares to lim like
+   it would to bound, the next factor iterations all pass the loop test, so
+   they run back to back without it. The original loop finishes the
+   remaining iterations. When lim wraps around the unrolled loop is
+   skipped. */
+static void unroll_loop(IRFunction *fn, const CFG *cfg, const int *block_of, const CountedLoop *cl, int factor,
+                        int *done, size_t *done_len) {
+    const CFGBlock *hdr = &cfg->blocks[cfg->loops[cl->loop].header];
+    int pre_label = fn->label_count++;
+    int loop_label = fn->label_count++;
+    int *rename = xmalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1) * sizeof(int));
+    int original_temps = fn->temp_count;
+
+    IRInstrArray code;
+    memset(&code, 0, sizeof(code));
+    for (size_t i = 0; i < fn->code.len; i++) {
+        if (i == hdr->start) {
+            if (i > 0 && cfg_loop_contains(cfg, cl->loop, block_of[i - 1]) &&
+                fn->code.items[i - 1].op != IROP_JMP && fn->code.items[i - 1].op != IROP_RET) {
+                IRInstr jmp = ir_make_instr(IROP_JMP);
+                jmp.line = cl->line;
+                jmp.label = cl->header_label;
+                ir_push_instr(&code, jmp);
+            }
+            IRInstr in = ir_make_instr(IROP_LABEL);
+            in.line = cl->line;
+            in.label = pre_label;
+            ir_push_instr(&code, in);
+            in = ir_make_instr(IROP_IMM_INT);
+            in.line = cl->line;
+            in.dst = fn->temp_count++;
+            in.imm = (long)(factor - 1) * cl->step;
+            ir_push_instr(&code, in);
+            in = ir_make_instr(IROP_BIN);
+            in.line = cl->line;
+            in.binop = IRBIN_SUB;
+            in.src1 = cl->bound;
+            in.src2 = fn->temp_count - 1;
+            in.dst = fn->temp_count++;
+            ir_push_instr(&code, in);
+            int lim = in.dst;
+            in = ir_make_instr(IROP_BIN);
+            in.line = cl->line;
+            in.binop = cl->cmp;
+            in.src1 = lim;
+            in.src2 = cl->bound;
+            in.dst = fn->temp_count++;
+            ir_push_instr(&code, in);
+            in = ir_make_instr(IROP_JMP_FALSE);
+            in.line = cl->line;
+            in.src1 = fn->temp_count - 1;
+            in.label = cl->header_label;
+            ir_push_instr(&code, in);
+
+            in = ir_make_instr(IROP_LABEL);
+            in.line = cl->line;
+            in.label = loop_label;
+            ir_push_instr(&code, in);
+            in = ir_make_instr(IROP_LOAD_VAR);
+            in.line = cl->line;
+            in.var_index = cl->var;
+            in.dst = fn->temp_count++;
+            ir_push_instr(&code, in);
+            in = ir_make_instr(IROP_BIN);
+            in.line = cl->line;
+            in.binop = cl->cmp;
+            in.src1 = fn->temp_count - 1;
+            in.src2 = lim;
+            in.dst = fn->temp_count++;
+            ir_push_instr(&code, in);
+            in = ir_make_instr(IROP_JMP_FALSE);
+            in.line = cl->line;
+            in.src1 = fn->temp_count - 1;
+            in.label = cl->header_label;
+            ir_push_instr(&code, in);
+            for (int k = 0; k < factor; k++) {
+                for (int t = 0; t < original_temps; t++) {
+                    rename[t] = t;
+                }
+                copy_range(fn, &code, cl->cond_start, cl->cond_end, rename);
+                copy_range(fn, &code, cl->body_start, cl->body_end, rename);
+            }
+            in = ir_make_instr(IROP_JMP);
+            in.line = cl->line;
+            in.label = loop_label;
+            ir_push_instr(&code, in);
+        }
+        IRInstr in = fn->code.items[i];
+        if ((in.op == IROP_JMP || in.op == IROP_JMP_FALSE) && in.label == cl->header_label &&
+            !cfg_loop_contains(cfg, cl->loop, block_of[i])) {
+            in.label = pre_label;
+        }
+        ir_push_instr(&code, in);
+    }
+
+    free(rename);
+    free(fn->code.items);
+    fn->code = code;
+    done[(*done_len)++] = cl->header_label;
+    done[(*done_len)++] = loop_label;
+}
+
+static int is_done(const int *done, size_t len, int label) {
+    for (size_t i = 0; i < len; i++) {
+        if (done[i] == label) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Unrolls counted loops by up to factor, keeping the original loop for the
+   remainder. Small bodies get the full factor; larger ones as many copies
+   as fit UNROLL_MAX_INSTRS. Expects phi-free IR. */
+int unroll_loops(IRFunction *fn, int factor, int report) {
+    if (factor < 2) {
+        return 0;
+    }
+    int changed = 0;
+    size_t done_cap = 16;
+    size_t done_len = 0;
+    int *done = xmalloc(done_cap * sizeof(int));
+    for (;;) {
+        CFG cfg;
+        cfg_build(fn, &cfg);
+        cfg_compute_dominators(&cfg);
+        cfg_find_loops(&cfg);
+
+        int *block_of = xmalloc((fn->code.len + 1) * sizeof(int));
+        int *defs = xmalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1) * sizeof(int));
+        for (size_t b = 0; b < cfg.len; b++) {
+            for (size_t i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) {
+                block_of[i] = (int)b;
+            }
+        }
+        for (int t = 0; t < fn->temp_count; t++) {
+            defs[t] = -1;
+        }
+        for (size_t i = 0; i < fn->code.len; i++) {
+            int d = ir_instr_def(&fn->code.items[i]);
+            if (d >= 0) {
+                defs[d] = (int)i;
+            }
+        }
+
+        int unrolled = 0;
+        for (size_t l = 0; l < cfg.loop_count && !unrolled; l++) {
+            CountedLoop cl;
+            int header_label = cfg.blocks[cfg.loops[l].header].label;
+            if (is_done(done, done_len, header_label) ||
+                !scev_counted_loop(fn, &cfg, defs, block_of, (int)l, &cl)) {
+                continue;
+            }
+            size_t size = (cl.cond_end - cl.cond_start) + (cl.body_end - cl.body_start);
+            int copies = factor;
+            while (copies >= 2 && size * (size_t)copies > UNROLL_MAX_INSTRS) {
+                copies--;
+            }
+            if (done_len + 2 > done_cap) {
+                grow((void **)&done, &done_cap, sizeof(int));
+            }
+            if (copies < 2) {
+                done[done_len++] = header_label;
+                if (report) {
+                    printf("unroll: %s:%d: loop not unrolled: body of %zu instructions too large\n", fn->name,
+                           cl.line, size);
+                }
+                continue;
+            }
+            unroll_loop(fn, &cfg, block_of, &cl, copies, done, &done_len);
+            unrolled = 1;
+            if (report) {
+                printf("unroll: %s:%d: loop unrolled by %d with a remainder loop\n", fn->name, cl.line, copies);
+            }
+        }
+
+        free(defs);
+        free(block_of);
+        free_cfg(&cfg);
+        if (!unrolled) {
+            break;
+        }
+        changed = 1;
+    }
+    free(done);
+    return changed;
+}
@@ -0,0 +1,8 @@
+#ifndef UNROLL_H
+#define UNROLL_H
+
+#include "ir.h"
+
+int unroll_loops(IRFunction *fn, int factor, int report);
+
+#endif
@@ -37,6 +37,14 @@ char *xstrdup(const char *s) {
     return copy;
 }
 
+/* Copies len bytes that may include NUL and terminates the copy. */
+char *xmemdup(const char *s, size_t len) {
+    char *copy = xmalloc(len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
 static void vreport(const char *prefix, const char *fmt, va_list ap) {
     fprintf(stderr, "%s", prefix);
     vfprintf(stderr, fmt, ap);
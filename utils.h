@@ -7,6 +7,7 @@ void *xmalloc(size_t size);
 void *xcalloc(size_t count, size_t size);
 void *xrealloc(void *ptr, size_t size);
 char *xstrdup(const char *s);
+char *xmemdup(const char *s, size_t len);
 
 void fatal(const char *fmt, ...);
 void fatal_at(const char *file, int line, int col, const char *fmt, ...);
@@ -0,0 +1,153 @@
+#include "verify.h"
+
+#include "cfg.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void fail(const IRFunction *fn, const char *stage, size_t at, const char *what, int value) {
+    fatal("internal error: IR verification failed after %s in glyph '%s' at instruction %zu: %s (%d)",
+          stage, fn->name, at, what, value);
+}
+
+static int valid_temp(const IRFunction *fn, int t) {
+    return t >= 0 && t < fn->temp_count;
+}
+
+/* Checks the structural invariants every pass relies on: labels are unique
+   and defined, temps are defined exactly once and their definition dominates
+   every use, variable indices are in range and name arrays exactly where an
+   array is expected, and phis sit at block starts with one operand per
+   predecessor. */
+void ir_verify_function(const IRFunction *fn, const char *stage) {
+    int nlabels = fn->label_count > 0 ? fn->label_count : 1;
+    int *label_seen = xcalloc((size_t)nlabels, sizeof(int));
+    int *def_at = xmalloc((size_t)(fn->temp_count > 0 ? fn->temp_count : 1) * sizeof(int));
+    for (int t = 0; t < fn->temp_count; t++) {
+        def_at[t] = -1;
+    }
+
+    for (size_t i = 0; i < fn->code.len; i++) {
+        const IRInstr *in = &fn->code.items[i];
+        if (in->op == IROP_LABEL) {
+            if (in->label < 0 || in->label >= fn->label_count) {
+                fail(fn, stage, i, "label out of range", in->label);
+            }
+            if (label_seen[in->label]++) {
+                fail(fn, stage, i, "label defined twice", in->label);
+            }
+        }
+        int *vars[3];
+        int nvars = ir_instr_var_refs((IRInstr *)in, vars);
+        for (int k = 0; k < nvars; k++) {
+            int v = *vars[k];
+            if (v < 0 || (size_t)v >= fn->vars.len) {
+                fail(fn, stage, i, "variable index out of range", v);
+            }
+            int is_array = fn->vars.items[v].array_len > 0;
+            int wants_array = in->op != IROP_LOAD_VAR && in->op != IROP_STORE_VAR && in->op != IROP_PHI;
+            if (is_array != wants_array) {
+                fail(fn, stage, i, wants_array ? "scalar variable used as array" : "array used as scalar", v);
+            }
+        }
+        int d = ir_instr_def(in);
+        if (d >= 0) {
+            if (!valid_temp(fn, d)) {
+                fail(fn, stage, i, "temp out of range", d);
+            }
+            if (def_at[d] >= 0) {
+                fail(fn, stage, i, "temp defined twice", d);
+            }
+            def_at[d] = (int)i;
+        }
+        if (in->op == IROP_CALL && (in->argc < 0 || in->argc > 6)) {
+            fail(fn, stage, i, "bad call argument count", in->argc);
+        }
+    }
+
+    for (size_t i = 0; i < fn->code.len; i++) {
+        const IRInstr *in = &fn->code.items[i];
+        if ((in->op == IROP_JMP || in->op == IROP_JMP_FALSE) &&
+            (in->label < 0 || in->label >= fn->label_count || !label_seen[in->label])) {
+            fail(fn, stage, i, "jump to undefined label", in->label);
+        }
+    }
+
+    CFG cfg;
+    cfg_build(fn, &cfg);
+    cfg_compute_dominators(&cfg);
+    int *block_of = xmalloc((fn->code.len > 0 ? fn->code.len : 1) * sizeof(int));
+    for (size_t b = 0; b < cfg.len; b++) {
+        for (size_t i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) {
+            block_of[i] = (int)b;
+        }
+    }
+
+    for (size_t b = 0; b < cfg.len; b++) {
+        const CFGBlock *blk = &cfg.blocks[b];
+        if (!blk->reachable) {
+            continue;
+        }
+        int in_phis = 1;
+        for (size_t i = blk->start; i < blk->end; i++) {
+            const IRInstr *in = &fn->code.items[i];
+            if (in->op == IROP_LABEL) {
+                continue;
+            }
+            if (in->op != IROP_PHI) {
+                in_phis = 0;
+            } else if (!in_phis) {
+                fail(fn, stage, i, "phi after a non-phi instruction", in->dst);
+            }
+
+            if (in->op == IROP_PHI) {
+                if ((size_t)in->phi_count != blk->preds.len) {
+                    fail(fn, stage, i, "phi operand count differs from predecessor count", in->phi_count);
+                }
+                for (int k = 0; k < in->phi_count; k++) {
+                    int p = cfg_block_of_label(&cfg, in->phi_labels[k]);
+                    int is_pred = 0;
+                    for (size_t q = 0; q < blk->preds.len; q++) {
+                        is_pred |= blk->preds.items[q] == p;
+                    }
+                    if (p < 0 || !is_pred) {
+                        fail(fn, stage, i, "phi operand names a non-predecessor label", in->phi_labels[k]);
+                    }
+                    int t = in->phi_temps[k];
+                    if (!valid_temp(fn, t) || def_at[t] < 0) {
+                        fail(fn, stage, i, "phi operand is not a defined temp", t);
+                    }
+                    if (cfg.blocks[p].reachable && !cfg_dominates(&cfg, block_of[def_at[t]], p)) {
+                        fail(fn, stage, i, "phi operand does not dominate its predecessor", t);
+                    }
+                }
+                continue;
+            }
+
+            int ops[IR_MAX_USES];
+            int n = ir_instr_uses(in, ops);
+            for (int k = 0; k < n; k++) {
+                int t = ops[k];
+                if (!valid_temp(fn, t) || def_at[t] < 0) {
+                    fail(fn, stage, i, "use of undefined temp", t);
+                }
+                int db = block_of[def_at[t]];
+                if (db == (int)b ? def_at[t] >= (int)i : !cfg_dominates(&cfg, db, (int)b)) {
+                    fail(fn, stage, i, "definition does not dominate use", t);
+                }
+            }
+        }
+    }
+
+    free(block_of);
+    free_cfg(&cfg);
+    free(def_at);
+    free(label_seen);
+}
+
+void ir_verify_program(const IRProgram *ir, const char *stage) {
+    for (size_t i = 0; i < ir->functions.len; i++) {
+        ir_verify_function(&ir->functions.items[i], stage);
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "ir.h"
+
+void ir_verify_function(const IRFunction *fn, const char *stage);
+void ir_verify_program(const IRProgram *ir, const char *stage);
+
+#endif